@@ -0,0 +1,246 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+#include <atomic>
+#include <iostream>
+
+#include "arena.h"
+
+
+using namespace cryptar;
+using namespace std;
+
+
+const size_t BlockArena::max_piece_size;
+const size_t BlockArena::slab_size;
+
+
+/*
+  Every piece, from an arena or from the heap, starts with this, so
+  that release() knows where it came from.  A live piece is on its
+  arena's m_live list; a free one is on a free list by m_next.
+*/
+struct BlockArena::Piece {
+        BlockArena *m_arena;            /* or 0, for the heap */
+        void (*m_destroy)(void *);
+        Piece *m_previous;
+        Piece *m_next;
+};
+
+
+namespace {
+        // Pieces are rounded to this, and the header keeps what
+        // follows it so aligned.
+        const size_t piece_alignment = 16;
+
+        constexpr size_t round_up(size_t in_size)
+        {
+                return (in_size + piece_alignment - 1) & ~(piece_alignment - 1);
+        }
+
+        atomic<BlockArena *> current_arena(0);
+
+        atomic<unsigned long> heap_allocations(0);
+        atomic<unsigned long> heap_releases(0);
+        atomic<unsigned long long> heap_bytes(0);
+        atomic<unsigned long> heap_live(0);
+        atomic<unsigned long long> heap_live_bytes(0);
+}
+
+
+const size_t BlockArena::header_size = round_up(sizeof(Piece));
+
+
+
+BlockArena::BlockArena()
+        : m_previous(current_arena.exchange(this)),
+          m_free(max_piece_size / piece_alignment + 1, static_cast<Piece *>(0)),
+          m_cursor(0), m_end(0), m_live(0)
+{
+}
+
+
+
+/*
+  Destroying a block may delete others (which come back to us by
+  release()), so we take the live pieces one at a time and don't
+  hold the mutex while we destroy them.
+*/
+BlockArena::~BlockArena()
+{
+        BlockArena *self = this;
+        if(!current_arena.compare_exchange_strong(self, m_previous))
+                cerr << "BlockArena: arenas ended out of order.  This is a bug." << endl;
+        while(true) {
+                Piece *piece;
+                {
+                        boost::mutex::scoped_lock lock(m_mutex);
+                        piece = m_live;
+                        if(!piece)
+                                break;
+                        m_live = piece->m_next;
+                        if(m_live)
+                                m_live->m_previous = 0;
+                        m_stats.m_bulk_releases++;
+                        m_stats.m_live--;
+                }
+                piece->m_destroy(reinterpret_cast<char *>(piece) + header_size);
+        }
+        for(char *slab : m_slabs)
+                ::operator delete(slab);
+}
+
+
+
+BlockArena *BlockArena::current()
+{
+        return current_arena;
+}
+
+
+
+ArenaStats BlockArena::stats() const
+{
+        boost::mutex::scoped_lock lock(m_mutex);
+        return m_stats;
+}
+
+
+
+void *BlockArena::allocate(size_t in_size, void (*in_destroy)(void *))
+{
+        BlockArena *arena = current_arena;
+        if(arena && header_size + in_size <= max_piece_size)
+                return arena->take(in_size, in_destroy);
+        return allocate_heap(in_size);
+}
+
+
+
+void *BlockArena::allocate_heap(size_t in_size)
+{
+        Piece *piece = static_cast<Piece *>(::operator new(header_size + in_size));
+        piece->m_arena = 0;
+        heap_allocations++;
+        heap_bytes += in_size;
+        heap_live++;
+        heap_live_bytes += in_size;
+        return reinterpret_cast<char *>(piece) + header_size;
+}
+
+
+
+void BlockArena::release(void *in_memory, size_t in_size)
+{
+        if(!in_memory)
+                return;
+        Piece *piece = reinterpret_cast<Piece *>(static_cast<char *>(in_memory) - header_size);
+        if(piece->m_arena) {
+                piece->m_arena->give_back(piece, in_size);
+                return;
+        }
+        heap_releases++;
+        heap_live--;
+        heap_live_bytes -= in_size;
+        ::operator delete(piece);
+}
+
+
+
+/*
+  A piece from the free list for its size, or else from the end of
+  the last slab.  What is left at the end of a slab too short for the
+  piece is wasted.
+*/
+void *BlockArena::take(size_t in_size, void (*in_destroy)(void *))
+{
+        const size_t size = round_up(header_size + in_size);
+        boost::mutex::scoped_lock lock(m_mutex);
+        Piece *&free_list = m_free[size / piece_alignment];
+        Piece *piece = free_list;
+        if(piece)
+                free_list = piece->m_next;
+        else {
+                if(static_cast<size_t>(m_end - m_cursor) < size) {
+                        m_slabs.push_back(static_cast<char *>(::operator new(slab_size)));
+                        m_cursor = m_slabs.back();
+                        m_end = m_cursor + slab_size;
+                        m_stats.m_slabs++;
+                        m_stats.m_slab_bytes += slab_size;
+                }
+                piece = reinterpret_cast<Piece *>(m_cursor);
+                m_cursor += size;
+        }
+        piece->m_arena = this;
+        piece->m_destroy = in_destroy;
+        piece->m_previous = 0;
+        piece->m_next = m_live;
+        if(m_live)
+                m_live->m_previous = piece;
+        m_live = piece;
+        m_stats.m_allocations++;
+        m_stats.m_bytes += in_size;
+        m_stats.m_live++;
+        m_stats.m_live_bytes += in_size;
+        return reinterpret_cast<char *>(piece) + header_size;
+}
+
+
+
+void BlockArena::give_back(Piece *in_piece, size_t in_size)
+{
+        boost::mutex::scoped_lock lock(m_mutex);
+        if(in_piece->m_previous)
+                in_piece->m_previous->m_next = in_piece->m_next;
+        else
+                m_live = in_piece->m_next;
+        if(in_piece->m_next)
+                in_piece->m_next->m_previous = in_piece->m_previous;
+        Piece *&free_list = m_free[round_up(header_size + in_size) / piece_alignment];
+        in_piece->m_next = free_list;
+        free_list = in_piece;
+        m_stats.m_releases++;
+        m_stats.m_live--;
+        m_stats.m_live_bytes -= in_size;
+}
+
+
+
+ArenaStats cryptar::heap_block_stats()
+{
+        ArenaStats stats;
+        stats.m_allocations = heap_allocations;
+        stats.m_releases = heap_releases;
+        stats.m_bytes = heap_bytes;
+        stats.m_live = heap_live;
+        stats.m_live_bytes = heap_live_bytes;
+        return stats;
+}
+
+
+
+void cryptar::reset_heap_block_stats()
+{
+        heap_allocations = 0;
+        heap_releases = 0;
+        heap_bytes = 0;
+}
@@ -0,0 +1,153 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+#ifndef __ARENA_H__
+#define __ARENA_H__ 1
+
+
+#include <boost/thread/mutex.hpp>
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+
+namespace cryptar {
+
+        /*
+          What an arena (or the heap, for blocks made outside any
+          arena) has handed out.  Bytes are what objects asked for;
+          slab bytes are what the arena got from the heap to hold
+          them.
+        */
+        struct ArenaStats {
+                ArenaStats() : m_allocations(0), m_releases(0), m_bulk_releases(0),
+                               m_bytes(0), m_live(0), m_live_bytes(0),
+                               m_slabs(0), m_slab_bytes(0) {};
+
+                unsigned long m_allocations;
+                unsigned long m_releases;       /* one at a time, by delete */
+                unsigned long m_bulk_releases;  /* still live when the arena went */
+                unsigned long long m_bytes;
+                unsigned long m_live;
+                unsigned long long m_live_bytes;
+                unsigned long m_slabs;
+                unsigned long long m_slab_bytes;
+        };
+
+
+        /*
+          A backup session's blocks come from an arena: slabs of
+          memory cut into pieces of a few sizes, each size with its
+          own free list, so that making and deleting millions of
+          short-lived blocks costs a few heap allocations and not
+          millions.
+
+          Creating a BlockArena makes it the one block_by_id(),
+          block_by_content() and block_empty() allocate from until it
+          goes (and the arena it replaced is current again).  When
+          it goes, it destroys the blocks still live and frees its
+          slabs in one go, so a session need not delete its blocks.
+          No block from the arena may be used after that: end the
+          session after any StagePipeline using its blocks has
+          finished.  Deleting a block returns it to its arena, from
+          any thread.
+
+          There is one current arena at a time, for the process, not
+          per thread.
+        */
+        class BlockArena {
+        public:
+                BlockArena();
+                ~BlockArena();
+
+                static BlockArena *current();
+                ArenaStats stats() const;
+
+                /*
+                  Memory for an object of in_size bytes, from the
+                  current arena, if any, or the heap.  The arena
+                  calls in_destroy on the object if it is still live
+                  when the arena goes.  Release it with release().
+                */
+                static void *allocate(size_t in_size, void (*in_destroy)(void *));
+                // Always from the heap, for a plain new.
+                static void *allocate_heap(size_t in_size);
+                static void release(void *in_memory, size_t in_size);
+
+                // Pieces larger than this come from the heap, even in
+                // an arena, and the arena doesn't destroy them.
+                static const size_t max_piece_size = 4096;
+                static const size_t slab_size = 256 * 1024;
+
+        private:
+                BlockArena(const BlockArena &);
+                BlockArena &operator=(const BlockArena &);
+
+                struct Piece;
+                static const size_t header_size;        /* a Piece, rounded up */
+                void *take(size_t in_size, void (*in_destroy)(void *));
+                void give_back(Piece *in_piece, size_t in_size);
+
+                BlockArena *m_previous;
+                mutable boost::mutex m_mutex;   /* for what follows */
+                std::vector<Piece *> m_free;    /* by size class */
+                std::vector<char *> m_slabs;
+                char *m_cursor;                 /* the unused end of the last slab */
+                char *m_end;
+                Piece *m_live;                  /* what we would destroy */
+                ArenaStats m_stats;
+        };
+
+
+        /*
+          What blocks made outside any arena have cost.  Cf. the
+          arena's own stats().  Resetting leaves the live counts.
+        */
+        ArenaStats heap_block_stats();
+        void reset_heap_block_stats();
+
+
+        template<typename T> void arena_destroy(void *in_object)
+        {
+                static_cast<T *>(in_object)->~T();
+        }
+
+
+        /*
+          new T(in_args...) from the current arena.  T's operator
+          delete must call BlockArena::release() (as Block's does).
+        */
+        template<typename T, typename... Args> T *arena_new(Args &&... in_args)
+        {
+                void *memory = BlockArena::allocate(sizeof(T), &arena_destroy<T>);
+                try {
+                        return ::new(memory) T(std::forward<Args>(in_args)...);
+                }
+                catch(...) {
+                        BlockArena::release(memory, sizeof(T));
+                        throw;
+                }
+        }
+}
+
+#endif  /* __ARENA_H__*/
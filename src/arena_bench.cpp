@@ -0,0 +1,113 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cryptar.h"
+
+
+using namespace cryptar;
+using namespace std;
+
+
+/*
+  Make a lot of blocks, as a backup session does, and free them:
+  from the heap, from a BlockArena one at a time, and from an arena
+  all at once when it goes.  Report blocks per second and what each
+  way asked of the heap.
+*/
+
+
+namespace {
+
+        const unsigned long num_blocks = 1000000;
+        // Blocks alive at once, as many as a directory's worth.
+        const unsigned long batch = 10000;
+
+
+        void report(const string &in_name,
+                    chrono::steady_clock::time_point in_start,
+                    chrono::steady_clock::time_point in_end,
+                    const ArenaStats &in_stats)
+        {
+                const double seconds = chrono::duration<double>(in_end - in_start).count();
+                cout << setw(14) << left << in_name
+                     << setw(10) << right << fixed << setprecision(0) << num_blocks / seconds << " blocks/s"
+                     << setw(10) << in_stats.m_allocations << " blocks"
+                     << setw(12) << in_stats.m_bytes / 1024 << " KB"
+                     << setw(6) << in_stats.m_slabs << " slabs"
+                     << setw(8) << in_stats.m_slab_bytes / 1024 << " KB" << endl;
+        }
+
+
+        void make_blocks(const string &in_key, bool in_delete)
+        {
+                shared_ptr<Transport> no_store;
+                vector<DataBlock *> blocks;
+                for(unsigned long i = 0; i < num_blocks; i++) {
+                        blocks.push_back(block_by_id<DataBlock>(no_store, in_key, BlockId()));
+                        if(blocks.size() == batch) {
+                                if(in_delete)
+                                        for(DataBlock *bp : blocks)
+                                                delete bp;
+                                blocks.clear();
+                        }
+                }
+                if(in_delete)
+                        for(DataBlock *bp : blocks)
+                                delete bp;
+        }
+}
+
+
+int main(int argc, char *argv[])
+{
+        const string key(pseudo_random_string());
+
+        reset_heap_block_stats();
+        auto start = chrono::steady_clock::now();
+        make_blocks(key, true);
+        report("heap", start, chrono::steady_clock::now(), heap_block_stats());
+
+        ArenaStats stats;
+        start = chrono::steady_clock::now();
+        {
+                BlockArena arena;
+                make_blocks(key, true);
+                stats = arena.stats();
+        }
+        report("arena", start, chrono::steady_clock::now(), stats);
+
+        start = chrono::steady_clock::now();
+        {
+                BlockArena arena;
+                make_blocks(key, false);
+                stats = arena.stats();
+        }
+        report("arena, bulk", start, chrono::steady_clock::now(), stats);
+        return 0;
+}
@@ -0,0 +1,172 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE tests
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "cryptar.h"
+
+
+using namespace cryptar;
+using namespace std;
+
+
+namespace {
+
+        // Counts how many of it are destroyed.
+        struct Counted {
+                Counted(int &io_destroyed, bool in_throw = false) : m_destroyed(io_destroyed)
+                {
+                        if(in_throw)
+                                throw(runtime_error("Counted"));
+                }
+                ~Counted() { m_destroyed++; }
+                static void operator delete(void *in_memory, size_t in_size)
+                { BlockArena::release(in_memory, in_size); }
+
+                int &m_destroyed;
+                char m_payload[100];
+        };
+
+
+        /*
+          Blocks come from the heap until there is an arena, and from
+          the arena while there is one.  Deleted blocks go back where
+          they came from, and an arena reuses them.
+        */
+        void test_blocks()
+        {
+                const string key(pseudo_random_string());
+                shared_ptr<Transport> no_store;
+                reset_heap_block_stats();
+                const ArenaStats heap_before(heap_block_stats());
+                BOOST_CHECK(!BlockArena::current());
+                DataBlock *bp = block_empty<DataBlock>(no_store, key);
+                BOOST_CHECK_EQUAL(heap_block_stats().m_allocations, 1UL);
+                BOOST_CHECK_EQUAL(heap_block_stats().m_live, heap_before.m_live + 1);
+                delete bp;
+                BOOST_CHECK_EQUAL(heap_block_stats().m_releases, 1UL);
+                BOOST_CHECK_EQUAL(heap_block_stats().m_live, heap_before.m_live);
+
+                {
+                        BlockArena arena;
+                        BOOST_CHECK(BlockArena::current() == &arena);
+                        vector<DataBlock *> blocks;
+                        for(int i = 0; i < 10000; i++)
+                                blocks.push_back(block_by_id<DataBlock>(no_store, key, BlockId()));
+                        ArenaStats stats(arena.stats());
+                        BOOST_CHECK_EQUAL(stats.m_allocations, 10000UL);
+                        BOOST_CHECK_EQUAL(stats.m_live, 10000UL);
+                        BOOST_CHECK_EQUAL(stats.m_bytes, 10000 * sizeof(DataBlock));
+                        BOOST_CHECK(stats.m_slabs < 100);
+                        BOOST_CHECK_EQUAL(stats.m_slab_bytes, stats.m_slabs * BlockArena::slab_size);
+                        BOOST_CHECK_EQUAL(heap_block_stats().m_allocations, 1UL);
+
+                        // A deleted block's memory is the next one's.
+                        DataBlock *last = blocks.back();
+                        blocks.pop_back();
+                        delete last;
+                        DataBlock *again = block_empty<DataBlock>(no_store, key);
+                        BOOST_CHECK(again == last);
+                        blocks.push_back(again);
+                        BOOST_CHECK_EQUAL(arena.stats().m_releases, 1UL);
+                        BOOST_CHECK_EQUAL(arena.stats().m_slabs, stats.m_slabs);
+
+                        // Deleted on another thread.
+                        boost::thread deleter([&]() {
+                                for(size_t i = 0; i < 5000; i++)
+                                        delete blocks[i];
+                        });
+                        deleter.join();
+                        BOOST_CHECK_EQUAL(arena.stats().m_live, 5000UL);
+                        // The rest go with the arena.
+                }
+                BOOST_CHECK(!BlockArena::current());
+                BOOST_CHECK_EQUAL(heap_block_stats().m_allocations, 1UL);
+        }
+
+
+        /*
+          An arena destroys what is still live when it goes, and the
+          arena it replaced is current again.
+        */
+        void test_bulk()
+        {
+                int destroyed = 0;
+                {
+                        BlockArena outer;
+                        Counted *kept = arena_new<Counted>(destroyed);
+                        {
+                                BlockArena inner;
+                                BOOST_CHECK(BlockArena::current() == &inner);
+                                for(int i = 0; i < 100; i++)
+                                        arena_new<Counted>(destroyed);
+                                delete arena_new<Counted>(destroyed);
+                                BOOST_CHECK_EQUAL(destroyed, 1);
+                                BOOST_CHECK_EQUAL(inner.stats().m_live, 100UL);
+                                BOOST_CHECK_EQUAL(outer.stats().m_live, 1UL);
+                        }
+                        BOOST_CHECK_EQUAL(destroyed, 101);
+                        BOOST_CHECK(BlockArena::current() == &outer);
+                        delete kept;
+                        BOOST_CHECK_EQUAL(destroyed, 102);
+                        BOOST_CHECK_EQUAL(outer.stats().m_live, 0UL);
+                        BOOST_CHECK_EQUAL(outer.stats().m_bulk_releases, 0UL);
+                }
+                BOOST_CHECK_EQUAL(destroyed, 102);
+        }
+
+
+        // A constructor that throws leaves nothing behind.
+        void test_throw()
+        {
+                BlockArena arena;
+                int destroyed = 0;
+                BOOST_CHECK_THROW(arena_new<Counted>(destroyed, true), runtime_error);
+                const ArenaStats stats(arena.stats());
+                BOOST_CHECK_EQUAL(stats.m_allocations, 1UL);
+                BOOST_CHECK_EQUAL(stats.m_releases, 1UL);
+                BOOST_CHECK_EQUAL(stats.m_live, 0UL);
+                BOOST_CHECK_EQUAL(destroyed, 0);
+        }
+}
+
+
+BOOST_AUTO_TEST_CASE(blocks)
+{
+        test_blocks();
+}
+
+BOOST_AUTO_TEST_CASE(bulk)
+{
+        test_bulk();
+}
+
+BOOST_AUTO_TEST_CASE(throws)
+{
+        test_throw();
+}
@@ -20,13 +20,23 @@
 
 
 #include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
+#include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <stdint.h>
 
 #include "block.h"
+#include "checksum.h"
+#include "checksum_index.h"
+#include "chunk.h"
 #include "compress.h"
 #include "config.h"
 #include "crypt.h"
+#include "mode.h"
+#include "stage.h"
 #include "system.h"
 #include "transport.h"
 
@@ -69,9 +79,9 @@ Block::Block(const CreateEmpty,
              const string &in_crypto_key)
         : m_crypto_key(in_crypto_key),
           m_status(BlockStatus::ready | BlockStatus::dirty),
+          m_id_name(m_id.filesystem_name()),
           m_transport(in_transport)
 {
-        m_id = pseudo_random_string();
 }
 
 
@@ -85,6 +95,7 @@ Block::Block(const CreateById,
         : m_crypto_key(in_crypto_key),
           m_id(in_id),
           m_status(BlockStatus::block_status_invalid),
+          m_id_name(m_id.filesystem_name()),
           m_transport(in_transport)
 {
         // Here trigger fetch from remote
@@ -254,8 +265,7 @@ DataBlock::DataBlock(const CreateByContent,
                      const string &in_contents)
         : Block(CreateEmpty(), in_transport, in_crypto_key)
 {
-        string augmented_content = pseudo_random_string(11) + in_contents;
-        m_cipher_text = encrypt(compress(augmented_content), m_crypto_key);
+        set_content(in_contents);
 }
 
 
@@ -277,6 +287,27 @@ DataBlock::DataBlock(const CreateById,
 }
 
 
+namespace {
+        // Pass on all but the salt.
+        class UnsaltSink : public ByteSink {
+        public:
+                explicit UnsaltSink(ByteSink &out_sink) : m_sink(out_sink), m_skip(data_block_salt_length) {};
+                virtual void write(const char *in_buf, size_t in_len)
+                {
+                        const size_t skip = min(in_len, m_skip);
+                        m_skip -= skip;
+                        if(in_len > skip)
+                                m_sink.write(in_buf + skip, in_len - skip);
+                }
+                virtual void close() { m_sink.close(); }
+
+        private:
+                ByteSink &m_sink;
+                size_t m_skip;
+        };
+}
+
+
 /*
   Return plain text of block.
 
@@ -285,18 +316,80 @@ DataBlock::DataBlock(const CreateById,
 */
 string DataBlock::plain_text() const
 {
-        string augmented_text = decompress(decrypt(m_cipher_text, m_crypto_key));
-        return augmented_text.substr(11);
+        string text;
+        StringSink sink(text);
+        write_plain_text(sink);
+        return text;
+}
+
+
+
+/*
+  Decode the cipher text through a pipeline, so the decompressed text
+  is never held whole: the sink gets it a piece at a time.
+*/
+void DataBlock::write_plain_text(ByteSink &out_sink) const
+{
+        UnsaltSink unsalt(out_sink);
+        Decoder decoder(m_crypto_key, unsalt, transport().get());
+        decoder.write(m_cipher_text.data(), m_cipher_text.size());
+        decoder.close();
+}
+
+
+/*
+  How the store compresses blocks.  A block with no store
+  compresses as blocks always have.
+*/
+CompressParams DataBlock::compress_params() const
+{
+        return transport() ? transport()->compress_params() : CompressParams();
+}
+
+
+/*
+  Small texts are what the store trains its dictionary on.
+*/
+CompressParams DataBlock::compress_params(const char *in_text, size_t in_len) const
+{
+        if(transport())
+                transport()->sample(in_text, in_len);
+        return compress_params().for_text(in_text, in_len);
 }
 
 
 /*
   Set the DataBlock's contents (by providing plain text).
+
+  The salt and content go through the pipeline one after the other,
+  and only the cipher text is ever held whole.
 */
 void DataBlock::set_content(const string &in_contents)
 {
-        string augmented_content = pseudo_random_string(11) + in_contents;
-        m_cipher_text = encrypt(compress(augmented_content), m_crypto_key);
+        string cipher_text;
+        StringSink sink(cipher_text);
+        Encoder encoder(m_crypto_key, sink, compress_params(in_contents.data(), in_contents.size()));
+        const string salt(pseudo_random_string(data_block_salt_length));
+        encoder.expect(salt.size() + in_contents.size());
+        encoder.write(salt.data(), salt.size());
+        encoder.write(in_contents.data(), in_contents.size());
+        encoder.close();
+        m_cipher_text = Bytes(move(cipher_text));
+}
+
+
+void DataBlock::set_content(const LocalFile &in_file)
+{
+        string cipher_text;
+        StringSink sink(cipher_text);
+        Encoder encoder(m_crypto_key, sink, compress_params().for_text(in_file));
+        const string salt(pseudo_random_string(data_block_salt_length));
+        encoder.expect(salt.size() + in_file.size());
+        encoder.write(salt.data(), salt.size());
+        pump(in_file, encoder);
+        if(in_file.changed())
+                throw(runtime_error("DataBlock: file changed while we read it"));
+        m_cipher_text = Bytes(move(cipher_text));
 }
 
 
@@ -304,7 +397,11 @@ void DataBlock::set_content(const string &in_contents)
 /* CoverBlock */
 
 
-static const unsigned int m_window_size = 512;
+/*
+  Below this many windows per thread, the parallel scan isn't worth
+  starting threads for.
+*/
+static const unsigned long min_parallel_windows = 64;
 
 
 /*
@@ -314,15 +411,14 @@ CoverBlock::CoverBlock(const CreateByContent,
                        const shared_ptr<Transport> in_transport,
                        const string &in_crypto_key,
                        const string &in_contents)
-        : DataBlock(CreateByContent(), in_transport, in_crypto_key, in_contents),
-          m_base(0), m_base_length(0)
+        : DataBlock(CreateEmpty(), in_transport, in_crypto_key),
+          m_base(0), m_base_offset(0), m_base_length(0),
+          m_levels(0), m_tree_loaded(true), m_scan_threads(0), m_stages(0),
+          m_defer_writes(false)
 {
-        // Steps for creating by contents:
-        // Compute a cover
-        // Create a set of DataBlock's for the cover
-        // Store pointers to the DataBlocks in m_data_blocks
-        // Persist the data blocks in remote store
-        // Populate m_easy_checksums and m_crypto_checksums
+        // With no previous covering, every window becomes a new
+        // DataBlock.
+        set_content(in_contents);
 }
 
 
@@ -333,62 +429,824 @@ CoverBlock::CoverBlock(const CreateById,
                        const shared_ptr<Transport> in_transport,
                        const string &in_crypto_key,
                        const BlockId &in_id)
-        : DataBlock(CreateById(), in_transport, in_crypto_key, in_id), m_base(0), m_base_length(0)
+        : DataBlock(CreateById(), in_transport, in_crypto_key, in_id),
+          m_base(0), m_base_offset(0), m_base_length(0),
+          m_levels(0), m_tree_loaded(true), m_scan_threads(0), m_stages(0),
+          m_defer_writes(false)
+{
+        // The covering arrives with the block (via from_stream()),
+        // which populates m_index.
+        // We don't fetch the DataBlock's themselves: matching needs
+        // only their checksums and ids.
+}
+
+
+/*
+  Set the state of the block from its persisted form, then decode the
+  covering so that the next set_content() can diff against it.
+*/
+void CoverBlock::from_stream(const Bytes &in_stream)
+{
+        DataBlock::from_stream(in_stream);
+        load_cover();
+}
+
+
+/*
+  Decode the covering from our cipher text.  For a tree we decode
+  only the top level here.  The rest waits until we need it.
+*/
+void CoverBlock::load_cover()
+{
+        m_cover.clear();
+        m_roots.clear();
+        m_nodes.clear();
+        m_levels = 0;
+        m_tree_loaded = true;
+        if(!m_cipher_text.empty()) {
+                istringstream cover_stream(plain_text());
+                boost::archive::text_iarchive ia(cover_stream);
+                ia & m_params;
+                ia & m_levels;
+                if(0 == m_levels)
+                        ia & m_cover;
+                else {
+                        ia & m_roots;
+                        m_tree_loaded = false;
+                }
+        }
+        index_cover();
+}
+
+
+/*
+  Fetch every node of the tree, so as to have all the leaves to diff
+  against, and remember each node by its digest.
+*/
+void CoverBlock::load_tree()
+{
+        m_cover.clear();
+        m_nodes.clear();
+        unsigned long offset = 0;
+        for(auto it = m_roots.begin(); it != m_roots.end(); ++it)
+                walk_node(*it, m_levels - 1, offset,
+                          [&](const CoverEntry &in_entry) { m_cover.push_back(in_entry); },
+                          &m_nodes);
+        m_tree_loaded = true;
+        index_cover();
+}
+
+
+/*
+  Visit, in order, the leaves below in_node, which is at in_level
+  (leaf nodes are at level 0) and covers the bytes from io_offset.
+  Only this node is held in memory while we descend.
+*/
+void CoverBlock::walk_node(const CoverNode &in_node,
+                           unsigned int in_level,
+                           unsigned long &io_offset,
+                           const function<void(const CoverEntry &)> &in_leaf,
+                           unordered_map<StrongChecksum, CoverNode> *out_nodes) const
+{
+        DataBlock node(CreateById(), transport(), m_crypto_key, in_node.m_id);
+        node.read();
+        if(out_nodes)
+                (*out_nodes)[in_node.m_digest] = in_node;
+        istringstream node_stream(node.plain_text());
+        boost::archive::text_iarchive ia(node_stream);
+        unsigned int level;
+        ia & level;
+        if(level != in_level)
+                throw(runtime_error("CoverBlock: covering tree node at wrong level"));
+        if(0 == level) {
+                vector<CoverEntry> entries;
+                ia & entries;
+                for(auto it = entries.begin(); it != entries.end(); ++it) {
+                        it->m_offset += io_offset;
+                        in_leaf(*it);
+                }
+                io_offset += in_node.m_length;
+                return;
+        }
+        vector<CoverNode> children;
+        ia & children;
+        for(auto it = children.begin(); it != children.end(); ++it)
+                walk_node(*it, level - 1, io_offset, in_leaf, out_nodes);
+}
+
+
+/*
+  Rebuild the checksum index from m_cover.
+*/
+void CoverBlock::index_cover()
+{
+        m_index.clear();
+        m_index.reserve(m_cover.size());
+        m_filter.reset(m_cover.size());
+        for(unsigned long i = 0; i < m_cover.size(); i++) {
+                m_index.insert(m_cover[i].m_weak, i);
+                if(m_params.m_window == m_cover[i].m_length)
+                        m_filter.insert(m_cover[i].m_weak);
+        }
+}
+
+
+/*
+  The rolling scan's lookup: ask the Bloom filter first, and only go
+  to the index (and then to the strong checksum) if it says maybe.
+*/
+const CoverEntry *CoverBlock::scan_match(WeakChecksum in_weak,
+                                         const char *in_buf,
+                                         CoverStats &io_stats) const
+{
+        io_stats.m_filter_queries++;
+        if(!m_filter.maybe_contains(in_weak))
+                return 0;
+        io_stats.m_filter_passes++;
+        if(!m_index.contains(in_weak)) {
+                io_stats.m_filter_false_positives++;
+                return 0;
+        }
+        return find_match(in_weak, in_buf, m_params.m_window);
+}
+
+
+/*
+  Find a block of the current covering with exactly the in_length
+  bytes at in_buf, or return 0.  We compute the match checksum only
+  if the weak one hits, unless the caller already has it.
+*/
+const CoverEntry *CoverBlock::find_match(WeakChecksum in_weak,
+                                         const char *in_buf,
+                                         unsigned long in_length,
+                                         const MatchChecksum *in_match) const
+{
+        MatchChecksum match_checksum;
+        const CoverEntry *match = 0;
+        m_index.find(in_weak, [&](unsigned long in_block) -> bool {
+                const CoverEntry &entry = m_cover[in_block];
+                if(in_length != entry.m_length)
+                        return false;
+                if(!in_match) {
+                        match_checksum = m_params.match_checksum(in_buf, in_length);
+                        in_match = &match_checksum;
+                }
+                if(*in_match != entry.m_match)
+                        return false;
+                match = &entry;
+                return true;
+        });
+        return match;
+}
+
+
+/*
+  Append a reused block to the covering.
+*/
+void CoverBlock::reuse_block(const CoverEntry &in_entry,
+                             unsigned long in_offset,
+                             vector<CoverEntry> &out_cover)
 {
-        // To create by id, we fetch the block with an ACT that
-        // populates m_easy_checksums and m_crypto_checksums.  It is
-        // surely desirable to make it optional to fetch the the
-        // DataBlock's themselves (so maybe the map should point to
-        // BlockID's).
+        CoverEntry entry(in_entry);
+        entry.m_offset = in_offset;
+        out_cover.push_back(entry);
+        m_stats.m_blocks_reused++;
+        m_stats.m_bytes_reused += entry.m_length;
 }
 
 
 /*
   Set content, which might mean for the first time, in which case
-  m_data_blocks, m_rolling_checksums, and m_crypto_checksums will all
-  be empty.
+  m_cover and m_index will be empty.
+
+  This is the cryptar (rsync) algorithm.  We slide a window across the
+  new content one byte at a time, and wherever it lands on a block of
+  the previous covering we reuse that block.  Only the bytes between
+  matches are cut into new DataBlocks and sent to the store.
+
+  With an adaptive window, a first covering takes its window from the
+  content's size.  Later coverings must scan with the same window to
+  find anything, but if most of the content was new anyway and the
+  changes we saw call for a very different window, we cut all of it
+  afresh with that window.  Until we know we won't, the first pass
+  only notes the blocks it would write, so a re-cut writes nothing
+  twice and leaves nothing in the store that no covering refers to.
+
+  The CoverBlock itself is not written.  As with any DataBlock, that
+  is up to the client.
 */
 void CoverBlock::set_content(const string &in_contents)
 {
-        /* // sketch of function:
-        assert(m_status & BlockStatus::Ready);
-        long i_prev = -1;
-        for(long i = 0; i < m_base_length - m_window_size, i++) {
-                auto rolling_cs = compute_rolling_checksum(rolling_cs, i, i_prev);
-                if(m_rolling_checksums.find(rolling_cs) != m_rolling_checksums.end()) {
-                        // hit on rolling checksum
-                        auto hard_cs = compute_crypto_checksum(i);
-                        auto it = m_crypto_checksums.find(hard_cs);
-                        if(it != m_crypto_checksums.end())
-                                m_data_blocks.push_back(*it);
+        cover_content(in_contents.data(), in_contents.size(), 0);
+}
+
+
+/*
+  If we could map the file, we cover it in place, as if it were in
+  memory.  Otherwise we stream it.
+*/
+void CoverBlock::set_content(const LocalFile &in_file)
+{
+        if(in_file.mapped())
+                cover_content(in_file.data(), in_file.size(), 0);
+        else
+                cover_content(0, in_file.size(), &in_file);
+        if(in_file.changed())
+                throw(runtime_error("CoverBlock: file changed while we covered it"));
+}
+
+
+/*
+  Cover in_length bytes, which are at in_base or, if in_stream is
+  not 0, to be read from in_stream.
+*/
+void CoverBlock::cover_content(const char *in_base,
+                               unsigned long in_length,
+                               const LocalFile *in_stream)
+{
+        if(!m_tree_loaded)
+                load_tree();
+        const bool first = m_cover.empty();
+        if(first) {
+                m_params = transport()->cover_params();
+                m_params.validate();
+        }
+        const bool adaptive = m_params.m_adaptive && cover_fixed == m_params.m_mode;
+        if(first && adaptive)
+                m_params.m_window = m_params.adaptive_window(in_length, 0);
+        m_base = in_base;
+        m_base_offset = 0;
+        m_base_length = in_length;
+        m_stats = CoverStats();
+        m_stats.m_filter_bytes = m_filter.memory_size();
+        m_stats.m_filter_expected_fp_rate = m_filter.false_positive_rate();
+
+        vector<CoverEntry> new_cover;
+        m_defer_writes = !first && adaptive;
+        if(in_stream)
+                compute_cover_streaming(*in_stream, new_cover);
+        else
+                compute_cover(new_cover);
+        m_defer_writes = false;
+        if(!first && adaptive && 2 * m_stats.m_bytes_reused < m_base_length) {
+                const unsigned long window = m_params.adaptive_window(m_base_length,
+                                                                      m_stats.m_changes);
+                if(window >= 4 * m_params.m_window || 4 * window <= m_params.m_window) {
+                        m_params.m_window = window;
+                        m_cover.clear();
+                        index_cover();
+                        new_cover.clear();
+                        m_stats = CoverStats();
+                        m_stats.m_recut = true;
+                        if(in_stream)
+                                compute_cover_streaming(*in_stream, new_cover);
+                        else
+                                compute_cover(new_cover);
                 }
         }
-        // But we need to note the new offsets, so this isn't quite right
+        write_deferred(in_base, in_stream, new_cover);
+        m_base = 0;
+        m_base_offset = 0;
+        m_base_length = 0;
+
+        m_cover.swap(new_cover);
+        index_cover();
+        store_cover();
+        if(m_stages)
+                m_stages->wait();
+}
+
+
+namespace {
+
+        /*
+          Where to end the nodes of the covering's tree.  A node ends
+          after an item whose checksum is 0 mod the fanout, so the
+          boundaries move with the content, but we don't let nodes
+          get smaller than a quarter of the fanout or bigger than
+          four times it.
         */
+        unsigned long node_hash(const StrongChecksum &in_checksum)
+        {
+                return in_checksum.hash();
+        }
+
+        template<class Item>
+        void cut_nodes(const vector<Item> &in_items,
+                       unsigned long in_fanout,
+                       const function<const StrongChecksum &(const Item &)> &in_checksum,
+                       vector<pair<unsigned long, unsigned long> > &out_nodes)
+        {
+                unsigned long begin = 0;
+                for(unsigned long i = 0; i < in_items.size(); i++) {
+                        const unsigned long count = i + 1 - begin;
+                        if(count == 4 * in_fanout
+                           || (count >= in_fanout / 4
+                               && 0 == (node_hash(in_checksum(in_items[i])) & (in_fanout - 1)))) {
+                                out_nodes.push_back(make_pair(begin, i + 1));
+                                begin = i + 1;
+                        }
+                }
+                if(begin < in_items.size())
+                        out_nodes.push_back(make_pair(begin, in_items.size()));
+        }
+}
+
+
+/*
+  Persist m_cover.  A small covering goes in this block.  A large one
+  goes in a tree of DataBlocks: leaf nodes first, then a level of
+  interior nodes over them, and so on until a level is small enough
+  to go in this block.
+*/
+void CoverBlock::store_cover()
+{
+        m_levels = 0;
+        m_roots.clear();
+        unordered_map<StrongChecksum, CoverNode> nodes;
+        if(m_cover.size() > m_params.m_fanout) {
+                vector<pair<unsigned long, unsigned long> > cuts;
+                cut_nodes<CoverEntry>(m_cover, m_params.m_fanout,
+                                      [](const CoverEntry &in_entry) -> const StrongChecksum & {
+                                              return in_entry.m_strong;
+                                      },
+                                      cuts);
+                for(auto it = cuts.begin(); it != cuts.end(); ++it) {
+                        // Offsets within the node, so that moving the
+                        // node's bytes doesn't change the node.
+                        const unsigned long node_offset = m_cover[it->first].m_offset;
+                        vector<CoverEntry> entries(m_cover.begin() + it->first,
+                                                   m_cover.begin() + it->second);
+                        for(auto e = entries.begin(); e != entries.end(); ++e)
+                                e->m_offset -= node_offset;
+                        const CoverEntry &last = entries.back();
+                        ostringstream node_stream;
+                        boost::archive::text_oarchive oa(node_stream);
+                        oa & m_levels;
+                        oa & entries;
+                        m_roots.push_back(store_node(node_stream.str(),
+                                                     last.m_offset + last.m_length,
+                                                     entries.size(), nodes));
+                }
+                m_levels++;
+        }
+        while(m_roots.size() > m_params.m_fanout) {
+                vector<pair<unsigned long, unsigned long> > cuts;
+                cut_nodes<CoverNode>(m_roots, m_params.m_fanout,
+                                     [](const CoverNode &in_node) -> const StrongChecksum & {
+                                             return in_node.m_digest;
+                                     },
+                                     cuts);
+                vector<CoverNode> parents;
+                for(auto it = cuts.begin(); it != cuts.end(); ++it) {
+                        vector<CoverNode> children(m_roots.begin() + it->first,
+                                                   m_roots.begin() + it->second);
+                        unsigned long length = 0, leaves = 0;
+                        for(auto c = children.begin(); c != children.end(); ++c) {
+                                length += c->m_length;
+                                leaves += c->m_leaves;
+                        }
+                        ostringstream node_stream;
+                        boost::archive::text_oarchive oa(node_stream);
+                        oa & m_levels;
+                        oa & children;
+                        parents.push_back(store_node(node_stream.str(),
+                                                     length, leaves, nodes));
+                }
+                m_roots.swap(parents);
+                m_levels++;
+        }
+        m_nodes.swap(nodes);
+
+        ostringstream cover_stream;
+        boost::archive::text_oarchive oa(cover_stream);
+        oa & m_params;
+        oa & m_levels;
+        if(0 == m_levels)
+                oa & m_cover;
+        else
+                oa & m_roots;
+        DataBlock::set_content(cover_stream.str());
+}
+
+
+/*
+  Persist one node of the tree, unless the previous tree had one just
+  like it, and add it to io_nodes.  A node starts with its level, so
+  nodes of different levels never share a digest.
+*/
+CoverNode CoverBlock::store_node(const string &in_node,
+                                 unsigned long in_length,
+                                 unsigned long in_leaves,
+                                 unordered_map<StrongChecksum, CoverNode> &io_nodes)
+{
+        const StrongChecksum digest = strong_checksum(in_node.data(), in_node.size());
+        auto found = m_nodes.find(digest);
+        if(found != m_nodes.end()) {
+                m_stats.m_nodes_reused++;
+                io_nodes[digest] = found->second;
+                return found->second;
+        }
+        string content(in_node);
+        CoverNode node;
+        node.m_id = write_block(content);
+        node.m_length = in_length;
+        node.m_leaves = in_leaves;
+        node.m_digest = digest;
+        m_stats.m_nodes_written++;
+        io_nodes[digest] = node;
+        return node;
+}
+
+
+/*
+  Scan m_base against the checksums of the current covering and fill
+  out_cover with the new covering.
+
+  With content-defined chunking there is nothing to scan: the chunk
+  boundaries already follow the content, so we cut it into chunks
+  and look each one up.
+*/
+void CoverBlock::compute_cover(vector<CoverEntry> &out_cover)
+{
+        if(cover_cdc == m_params.m_mode) {
+                emit_gap(0, m_base_length, out_cover);
+                return;
+        }
+        const unsigned long window = m_params.m_window;
+        unsigned int threads = m_scan_threads;
+        if(0 == threads)
+                threads = mode(Threads) ? max(1U, boost::thread::hardware_concurrency()) : 1;
+        if(threads > 1 && m_base_length >= threads * min_parallel_windows * window) {
+                compute_cover_parallel(threads, out_cover);
+                return;
+        }
+        unsigned long gap_start = 0;
+        for_each_weak_checksum(m_base, m_base_length, window,
+                               [&](unsigned long in_offset, WeakChecksum in_weak) -> unsigned long {
+                const CoverEntry *match = scan_match(in_weak, m_base + in_offset, m_stats);
+                if(!match)
+                        return 1;
+                emit_gap(gap_start, in_offset, out_cover);
+                reuse_block(*match, in_offset, out_cover);
+                gap_start = in_offset + window;
+                return window;
+        });
+        emit_gap(gap_start, m_base_length, out_cover);
 }
 
+
 /*
-CoverBlock::compute_rolling_checksum(...);
+  The parallel scan.
+
+  The serial scan is greedy: it takes the first offset at which a
+  window matches, skips past that window, and continues.  Which
+  offsets match doesn't depend on what came before, so we split the
+  offsets into ranges, have a pool of threads find every match in
+  each range (each range reads window - 1 bytes past its end, so the
+  ranges overlap), then make the same greedy pass over the sorted
+  matches.  The result is exactly the serial covering.
+
+  The price is that we confirm matches the serial scan would have
+  skipped over, which only costs much on very repetitive content.
+*/
+void CoverBlock::compute_cover_parallel(unsigned int in_threads,
+                                        vector<CoverEntry> &out_cover)
+{
+        const unsigned long window = m_params.m_window;
+        const unsigned long num_offsets = m_base_length - window + 1;
+        const unsigned long num_ranges = 4 * in_threads;
+        const unsigned long range_length = (num_offsets + num_ranges - 1) / num_ranges;
+        vector<vector<CoverMatch> > matches(num_ranges);
+        vector<CoverStats> range_stats(num_ranges);
+
+        unsigned long next_range = 0;
+        boost::mutex next_range_access;
+        boost::thread_group workers;
+        for(unsigned int i = 0; i < in_threads; i++)
+                workers.create_thread([&]() {
+                        while(true) {
+                                unsigned long range;
+                                {
+                                        boost::lock_guard<boost::mutex> lock(next_range_access);
+                                        range = next_range++;
+                                }
+                                const unsigned long begin = range * range_length;
+                                if(begin >= num_offsets)
+                                        return;
+                                find_all_matches(begin,
+                                                 min(begin + range_length, num_offsets),
+                                                 matches[range],
+                                                 range_stats[range]);
+                        }
+                });
+        workers.join_all();
+        for(auto it = range_stats.begin(); it != range_stats.end(); ++it) {
+                m_stats.m_filter_queries += it->m_filter_queries;
+                m_stats.m_filter_passes += it->m_filter_passes;
+                m_stats.m_filter_false_positives += it->m_filter_false_positives;
+        }
+
+        unsigned long gap_start = 0;
+        for(auto range = matches.begin(); range != matches.end(); ++range)
+                for(auto it = range->begin(); it != range->end(); ++it) {
+                        if(it->first < gap_start)
+                                continue;
+                        emit_gap(gap_start, it->first, out_cover);
+                        reuse_block(*it->second, it->first, out_cover);
+                        gap_start = it->first + window;
+                }
+        emit_gap(gap_start, m_base_length, out_cover);
+}
 
-CoverBlock::compute_crypto_checksum(...);
+
+/*
+  Find every offset in [in_begin, in_end) at which a full window
+  matches a block of the current covering.  Only reads m_base and the
+  index, so any number of threads may call this at once.
 */
+void CoverBlock::find_all_matches(unsigned long in_begin,
+                                  unsigned long in_end,
+                                  vector<CoverMatch> &out_matches,
+                                  CoverStats &io_stats) const
+{
+        const unsigned long window = m_params.m_window;
+        const unsigned long stop = min(in_end + window - 1, m_base_length);
+        const char *base = m_base + in_begin;
+        for_each_weak_checksum(base, stop - in_begin, window,
+                               [&](unsigned long in_offset, WeakChecksum in_weak) -> unsigned long {
+                const CoverEntry *match = scan_match(in_weak, base + in_offset, io_stats);
+                if(match)
+                        out_matches.push_back(CoverMatch(in_begin + in_offset, match));
+                return 1;
+        });
+}
+
 
 /*
-CoverBlock::rsync_algo_sketch()
+  The streaming scan, for a file we couldn't map.
+
+  We read the file a piece at a time and keep only the bytes from the
+  start of the current gap.  A gap's blocks are cut from its start a
+  window at a time, so we can cut the whole windows that end before
+  the next offset we'll try without waiting for the gap to end.  That
+  leaves less than two windows to carry into the next piece.  Chunks
+  likewise: any chunk that starts at least m_max_chunk bytes before
+  the end of what we've read is a chunk of the whole content.
+
+  The covering is exactly that of the in-memory scan.  We don't
+  stream in parallel.
+*/
+namespace {
+        const unsigned long stream_piece_length = 8 * 1024 * 1024;
+}
+
+
+void CoverBlock::compute_cover_streaming(const LocalFile &in_file,
+                                         vector<CoverEntry> &out_cover)
 {
-        DataBlock *dbp = 0;
-        long file_offset = 0;
-        DataBlock *B[]; *B_new[];
-        if(file_offset < B[dbp].start) {
-                DataBlock *bp = make_block(offset);
-                B_new.append(bp);
-                file_offset += m_window_size;
-        } else if(B[dbp + 1].start > file_offset) {
-                B_new.append(B[dbp]);
+        const unsigned long window = m_params.m_window;
+        const unsigned long piece = max(stream_piece_length,
+                                        2 * max(window, m_params.m_max_chunk));
+        const bool cdc = cover_cdc == m_params.m_mode;
+        string buf;
+        unsigned long read_to = 0;      /* content offset of the end of buf */
+        unsigned long gap_start = 0;
+        unsigned long scan = 0;         /* the next offset to try */
+        bool in_gap = false;            /* we've cut some of the gap already */
+        if(cdc && m_base_length)
+                m_stats.m_changes++;
+        m_base_offset = 0;
+        bool eof = false;
+        while(!eof) {
+                buf.erase(0, gap_start - m_base_offset);
+                m_base_offset = gap_start;
+                const unsigned long kept = buf.size();
+                buf.resize(kept + piece);
+                const unsigned long n = in_file.read(read_to, &buf[kept], piece);
+                buf.resize(kept + n);
+                read_to += n;
+                eof = n < piece;
+                m_base = buf.data();
+
+                if(cdc) {
+                        // Cut what we can of this piece, then hash the
+                        // chunks together.
+                        const unsigned long cut_from = gap_start;
+                        vector<BlockSignature> chunks;
+                        while(gap_start < read_to
+                              && (eof || read_to - gap_start >= m_params.m_max_chunk)) {
+                                const char *chunk = content_at(gap_start);
+                                const unsigned long length
+                                        = cdc_chunk_length(chunk, read_to - gap_start, m_params);
+                                chunks.push_back(BlockSignature(gap_start - cut_from, length,
+                                                                weak_checksum(chunk, length),
+                                                                StrongChecksum()));
+                                gap_start += length;
+                        }
+                        strong_checksums(content_at(cut_from), chunks);
+                        for(auto it = chunks.begin(); it != chunks.end(); ++it) {
+                                it->m_offset += cut_from;
+                                emit_block(*it, out_cover);
+                        }
+                        continue;
+                }
+
+                const unsigned long scan_from = scan;
+                if(read_to - scan_from >= window)
+                        for_each_weak_checksum(content_at(scan_from), read_to - scan_from, window,
+                                               [&](unsigned long in_offset, WeakChecksum in_weak) -> unsigned long {
+                                const unsigned long offset = scan_from + in_offset;
+                                const CoverEntry *match = scan_match(in_weak, content_at(offset), m_stats);
+                                if(!match) {
+                                        scan = offset + 1;
+                                        return 1;
+                                }
+                                if(in_gap)
+                                        cut_gap(gap_start, offset, out_cover);
+                                else
+                                        emit_gap(gap_start, offset, out_cover);
+                                in_gap = false;
+                                reuse_block(*match, offset, out_cover);
+                                gap_start = offset + window;
+                                scan = gap_start;
+                                return window;
+                        });
+                const unsigned long cut_to = gap_start + (scan - gap_start) / window * window;
+                if(!eof && cut_to > gap_start) {
+                        if(!in_gap)
+                                m_stats.m_changes++;
+                        in_gap = true;
+                        cut_gap(gap_start, cut_to, out_cover);
+                        gap_start = cut_to;
+                }
+        }
+        if(!cdc) {
+                if(in_gap)
+                        cut_gap(gap_start, read_to, out_cover);
+                else
+                        emit_gap(gap_start, read_to, out_cover);
         }
-        return B_new;
+        m_base_length = read_to;
 }
+
+
+/*
+  Cover the bytes [in_begin, in_end), a run of new bytes.
 */
+void CoverBlock::emit_gap(unsigned long in_begin,
+                          unsigned long in_end,
+                          vector<CoverEntry> &out_cover)
+{
+        if(in_begin >= in_end)
+                return;
+        m_stats.m_changes++;
+        cut_gap(in_begin, in_end, out_cover);
+}
+
+
+/*
+  Cover the bytes [in_begin, in_end) with blocks of at most one
+  window each, or with content-defined chunks.
+*/
+void CoverBlock::cut_gap(unsigned long in_begin,
+                         unsigned long in_end,
+                         vector<CoverEntry> &out_cover)
+{
+        if(in_begin >= in_end)
+                return;
+        vector<BlockSignature> signatures;
+        if(cover_cdc == m_params.m_mode)
+                chunk_signatures(content_at(in_begin), in_end - in_begin, m_params, signatures);
+        else
+                block_signatures(content_at(in_begin), in_end - in_begin, m_params.m_window, signatures);
+        for(auto it = signatures.begin(); it != signatures.end(); ++it) {
+                it->m_offset += in_begin;
+                emit_block(*it, out_cover);
+        }
+}
+
+
+/*
+  Cover the bytes described by in_signature with one block.  If the
+  previous covering already has a block with exactly these bytes
+  (notably a short tail block), reuse it.  Otherwise persist a new
+  DataBlock.
+*/
+void CoverBlock::emit_block(const BlockSignature &in_signature,
+                            vector<CoverEntry> &out_cover)
+{
+        const MatchChecksum match_checksum
+                = (match_sha256 == m_params.m_match_hash
+                   ? MatchChecksum(in_signature.m_strong)
+                   : m_params.match_checksum(content_at(in_signature.m_offset),
+                                             in_signature.m_length));
+        const CoverEntry *match = find_match(in_signature.m_weak,
+                                             content_at(in_signature.m_offset),
+                                             in_signature.m_length,
+                                             &match_checksum);
+        if(match) {
+                reuse_block(*match, in_signature.m_offset, out_cover);
+                return;
+        }
+
+        m_stats.m_blocks_written++;
+        m_stats.m_bytes_written += in_signature.m_length;
+        if(m_defer_writes) {
+                out_cover.push_back(CoverEntry(BlockId(string()), in_signature, match_checksum));
+                return;
+        }
+        string content(content_at(in_signature.m_offset), in_signature.m_length);
+        out_cover.push_back(CoverEntry(write_block(content), in_signature, match_checksum));
+}
+
+
+/*
+  Write the new blocks of io_cover that emit_block() only noted (they
+  have no id yet), from the content at in_base or in in_stream.  A
+  file that changed since we scanned it no longer has the bytes we
+  noted, so we check.
+*/
+void CoverBlock::write_deferred(const char *in_base,
+                                const LocalFile *in_stream,
+                                vector<CoverEntry> &io_cover)
+{
+        for(auto it = io_cover.begin(); it != io_cover.end(); ++it) {
+                if(!it->m_id.empty())
+                        continue;
+                if(!in_stream) {
+                        string content(in_base + it->m_offset, it->m_length);
+                        it->m_id = write_block(content);
+                        continue;
+                }
+                string content(it->m_length, '\0');
+                if(in_stream->read(it->m_offset, &content[0], it->m_length) != it->m_length
+                   || strong_checksum(content.data(), content.size()) != it->m_strong)
+                        throw(runtime_error("CoverBlock: file changed while we covered it"));
+                it->m_id = write_block(content);
+        }
+}
+
+
+/*
+  Persist a new DataBlock with io_content (which we may take) and
+  return its id.  With a stage pipeline, the block is only queued:
+  its id is known at once, but it is in the store after wait().
+*/
+BlockId CoverBlock::write_block(string &io_content)
+{
+        if(m_stages) {
+                DataBlock *bp = block_empty<DataBlock>(transport(), m_crypto_key);
+                const BlockId id = bp->id();
+                m_stages->push(bp, io_content);
+                return id;
+        }
+        DataBlock *bp = block_by_content<DataBlock>(transport(), m_crypto_key, io_content);
+        bp->write();
+        const BlockId id = bp->id();
+        delete bp;
+        return id;
+}
+
+
+/*
+  Return the covered content, fetching each DataBlock of the covering
+  from the store.
+*/
+string CoverBlock::contents() const
+{
+        ostringstream content;
+        write_contents(content);
+        return content.str();
+}
+
+
+/*
+  Write the covered content to out_stream a block at a time.  If we
+  haven't fetched the covering's tree, we walk it rather than fetch
+  all of it.
+
+  Matching may use a cheaper keyed hash, so here we check each block
+  against its SHA-256.
+*/
+void CoverBlock::write_contents(ostream &out_stream) const
+{
+        auto write_block = [&](const CoverEntry &in_entry) {
+                DataBlock block(CreateById(), transport(), m_crypto_key, in_entry.m_id);
+                block.read();
+                const string &plain = block.plain_text();
+                if(strong_checksum(plain.data(), plain.size()) != in_entry.m_strong)
+                        throw(runtime_error("CoverBlock: block does not match its checksum"));
+                out_stream.write(plain.data(), plain.size());
+        };
+        if(m_tree_loaded) {
+                for_each(m_cover.begin(), m_cover.end(), write_block);
+                return;
+        }
+        unsigned long offset = 0;
+        for(auto it = m_roots.begin(); it != m_roots.end(); ++it)
+                walk_node(*it, m_levels - 1, offset, write_block, 0);
+}
 
 
 #ifdef LATER
@@ -436,7 +1294,7 @@ FileHeadBlock::~FileHeadBlock()
 
 
 TimelineBlock::HeadBlockPointer::HeadBlockPointer()
-  : m_id(pseudo_random_string()),
+  : m_id(),
     m_crypto_key(pseudo_random_string())
 {
 }
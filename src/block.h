@@ -25,16 +25,33 @@
 
 #include <boost/archive/text_iarchive.hpp>
 #include <boost/archive/text_oarchive.hpp>
+#include <boost/serialization/split_member.hpp>
 #include <boost/serialization/string.hpp>
+#include <boost/serialization/vector.hpp>
+#include <boost/serialization/version.hpp>
+#include <functional>
+#include <list>
 #include <map>
 #include <memory>
+#include <ostream>
 #include <set>
 #include <stdexcept>
 #include <string>
 #include <queue>
+#include <unordered_map>
 #include <vector>
 
+#include "arena.h"
+#include "bloom.h"
+#include "bytes.h"
+#include "checksum.h"
+#include "checksum_index.h"
+#include "chunk.h"
+#include "compress.h"
 #include "crypt.h"
+#include "digest.h"
+#include "local_file.h"
+#include "pipeline.h"
 
 
 namespace cryptar {
@@ -53,11 +70,29 @@ namespace cryptar {
           (collections of pieces), or timelines (sequences of images).
         */
 
+        /*
+          A block's id is 32 random bytes, held as a Digest, so ids
+          copy, compare and hash without allocating.  Ids from before
+          were strings of 40 random bytes, whose filename was the
+          SHA-256 of the string; we take such an id as that digest, so
+          it names the same file.
+        */
         class BlockId {
         public:
-                BlockId() { m_id = pseudo_random_string(); }
-                BlockId(const std::string in_id)
-                        : m_id(in_id) {};
+                BlockId()
+                {
+                        char bytes[Digest::length];
+                        pseudo_random_bytes(bytes, Digest::length);
+                        m_id = Digest(bytes);
+                }
+                // The bytes of as_string(), or an old id (cf. above).
+                explicit BlockId(const std::string &in_id)
+                {
+                        if(Digest::length == in_id.size())
+                                m_id = Digest(in_id.data());
+                        else if(!in_id.empty())
+                                m_id = sha256(in_id.data(), in_id.size());
+                }
                 ~BlockId() {};
 
                 bool operator==(const BlockId &in_id) const
@@ -68,21 +103,36 @@ namespace cryptar {
                 {
                         return !operator==(in_id);
                 }
+                bool operator<(const BlockId &in_id) const
+                {
+                        return m_id < in_id.id();
+                }
 
                 // Don't permit accidental conversion to string.
-                const std::string &as_string() const { return m_id; };
+                const std::string as_string() const { return empty() ? std::string() : m_id.as_string(); };
                 const bool empty() const { return m_id.empty(); };
+                const Digest &digest() const { return m_id; };
+                // A name for the block's file.  Cf. Block::id_name().
+                std::string filesystem_name() const { return m_id.encode(true); }
 
         private:
-                const std::string &id() const { return m_id; };
+                const Digest &id() const { return m_id; };
 
-                std::string m_id;
+                Digest m_id;
                 
                 friend class boost::serialization::access;
                 template<class Archive>
-                        void serialize(Archive &in_ar, const unsigned int in_version) {
-                        in_ar & m_id;
+                        void save(Archive &out_ar, const unsigned int in_version) const {
+                        const std::string id(as_string());
+                        out_ar & id;
                 }
+                template<class Archive>
+                        void load(Archive &in_ar, const unsigned int in_version) {
+                        std::string id;
+                        in_ar & id;
+                        *this = BlockId(id);
+                }
+                BOOST_SERIALIZATION_SPLIT_MEMBER()
         };
 
         
@@ -154,6 +204,14 @@ namespace cryptar {
                       const BlockId &in_id);
                 virtual ~Block();
 
+                // A plain new is from the heap; the factory functions
+                // below allocate from the current BlockArena.  Either
+                // way, delete gives the memory back.
+                static void *operator new(size_t in_size)
+                { return BlockArena::allocate_heap(in_size); }
+                static void operator delete(void *in_memory, size_t in_size)
+                { BlockArena::release(in_memory, in_size); }
+
         public:                 /* most should be protected? */
                 bool action_pending() const { return !m_act_queue.empty(); }
                 void completion_action(ACT_Base *);
@@ -162,21 +220,31 @@ namespace cryptar {
                 void write() const;
                 void read();
 
-                /* to_string() serializes the block and returns the string */
-                virtual const std::string to_stream() const = 0;
-                /* from_string() sets the state of the block given a serialized version */
-                virtual void from_stream(const std::string &in_string) = 0;
+                /* to_stream() serializes the block and returns the bytes */
+                virtual Bytes to_stream() const = 0;
+                /* from_stream() sets the state of the block given a serialized version */
+                virtual void from_stream(const Bytes &in_stream) = 0;
+                /* write_stream() writes what to_stream() returns to a sink */
+                virtual void write_stream(ByteSink &out_sink) const
+                { const Bytes stream(to_stream()); out_sink.write(stream.data(), stream.size()); }
 
                 const BlockId &id() const { return m_id; }
+                // id().filesystem_name(), made once.
+                const std::string &id_name() const { return m_id_name; }
                 
         protected:
-                std::string m_cipher_text;      /* encrypted contents of this block */
+                const std::shared_ptr<Transport> transport() const { return m_transport; }
+
+                Bytes m_cipher_text;            /* encrypted contents of this block */
                 const std::string m_crypto_key; /* cryptographic key for this block */
                 BlockId m_id;                   /* identifier (in filesystem) for this block */
                 BlockStatus m_status;           /* status of this block */
 
         private:
-                std::queue<ACT_Base *> m_act_queue;
+                std::string m_id_name;
+                // A list, unlike a deque, allocates nothing while empty,
+                // as it nearly always is.
+                std::queue<ACT_Base *, std::list<ACT_Base *> > m_act_queue;
                 std::shared_ptr<Transport> m_transport;
         };
         typedef Block::BlockStatus BlockStatus;
@@ -193,26 +261,37 @@ namespace cryptar {
           functions to hide some notation.
           FIXME  (This is no longer true.  But probably still want factory functions.)
           FIXME  (Should blocks be shared_ptr's?)
+
+          They allocate from the current BlockArena, if there is one.
         */
         template<typename T> T *block_empty(const std::shared_ptr<Transport> in_transport,
                                             const std::string &in_crypto)
                 {
-                        return new T(Block::CreateEmpty(), in_transport, in_crypto);
+                        return arena_new<T>(Block::CreateEmpty(), in_transport, in_crypto);
                 }
 
         template<typename T> T *block_by_content(const std::shared_ptr<Transport> in_transport,
                                                  const std::string &in_crypto,
                                                  const std::string &in_content)
                 {
-                        return new T(Block::CreateByContent(), in_transport, in_crypto, in_content);
+                        return arena_new<T>(Block::CreateByContent(), in_transport, in_crypto, in_content);
                 }
         template<typename T> T *block_by_id(const std::shared_ptr<Transport> in_transport,
                                             const std::string &in_crypto,
                                             const BlockId &in_id)
                 {
-                        return new T(Block::CreateById(), in_transport, in_crypto, in_id);
+                        return arena_new<T>(Block::CreateById(), in_transport, in_crypto, in_id);
                 }
 
+        /*
+          The plain text of a DataBlock is salted with this many random
+          bytes before it is compressed and encrypted, so that equal
+          contents don't give equal cipher text.
+        */
+        const size_t data_block_salt_length = 11;
+
+        class StagePipeline;
+
         /*
           A block that simply persists and restores itself (with encryption).
           It has no idea of internal structure.  It is a leaf node in the tree.
@@ -234,19 +313,119 @@ namespace cryptar {
 
                 std::string plain_text() const;
                 void set_content(const std::string &in_contents);
+                // As set_content(), but read the content from a local file.
+                void set_content(const LocalFile &in_file);
+                // Decrypt to a sink, a piece at a time (cf. pipeline.h).
+                void write_plain_text(ByteSink &out_sink) const;
 
-                /* to_stream() serializes the block and returns the string */
-                virtual const std::string to_stream() const
+                /* to_stream() and from_stream() share the cipher text, not copy it */
+                virtual Bytes to_stream() const
                 { return m_cipher_text; }
-                /* from_stream() sets the state of the block given a serialized version */
-                virtual void from_stream(const std::string &in_stream)
-                { m_cipher_text =in_stream; }
+                virtual void from_stream(const Bytes &in_stream)
+                { m_cipher_text = in_stream; }
+                virtual void write_stream(ByteSink &out_sink) const
+                { out_sink.write(m_cipher_text.data(), m_cipher_text.size()); }
 
         private:
+                CompressParams compress_params() const;
+                // The params for this text, which the store may sample.
+                CompressParams compress_params(const char *in_text, size_t in_len) const;
+
+                // Sets the content on its own threads (cf. stage.h).
+                friend class StagePipeline;
         };
         
 
 
+        /*
+          One piece of a covering: the DataBlock that holds the bytes,
+          where those bytes sit in the covered content, and the
+          checksums by which a later scan recognises them.
+        */
+        struct CoverEntry {
+                CoverEntry() : m_id(std::string()), m_offset(0), m_length(0), m_weak(0) {};
+                CoverEntry(const BlockId &in_id,
+                           unsigned long in_offset,
+                           unsigned long in_length,
+                           WeakChecksum in_weak,
+                           const StrongChecksum &in_strong,
+                           const MatchChecksum &in_match)
+                        : m_id(in_id), m_offset(in_offset), m_length(in_length),
+                          m_weak(in_weak), m_strong(in_strong), m_match(in_match) {};
+                CoverEntry(const BlockId &in_id,
+                           const BlockSignature &in_signature,
+                           const MatchChecksum &in_match)
+                        : m_id(in_id), m_offset(in_signature.m_offset),
+                          m_length(in_signature.m_length), m_weak(in_signature.m_weak),
+                          m_strong(in_signature.m_strong), m_match(in_match) {};
+
+                BlockId m_id;
+                unsigned long m_offset;
+                unsigned long m_length;
+                WeakChecksum m_weak;
+                StrongChecksum m_strong;     /* SHA-256, checked on restore */
+                MatchChecksum m_match;       /* CoverParams::match_checksum() */
+
+        private:
+                friend class boost::serialization::access;
+                template<class Archive>
+                        void serialize(Archive &in_ar, const unsigned int in_version) {
+                        in_ar & m_id;
+                        in_ar & m_offset;
+                        in_ar & m_length;
+                        in_ar & m_weak;
+                        if(in_version > 0) {
+                                in_ar & m_strong;
+                                in_ar & m_match;
+                                return;
+                        }
+                        // Version 0 held the checksums as strings:
+                        // SHA-256's base64, and a keyed_hash()'s 16
+                        // bytes.  We only ever load version 0.
+                        std::string strong, match;
+                        in_ar & strong;
+                        in_ar & match;
+                        m_strong = Digest::decode(strong);
+                        m_match = (MatchChecksum::length == match.size()
+                                   ? MatchChecksum(match.data())
+                                   : MatchChecksum(Digest::decode(match)));
+                }
+        };
+
+
+        /*
+          A node of a large covering's tree, as its parent sees it:
+          the DataBlock that holds the node, how many bytes and
+          leaves (CoverEntry's) lie below it, and a digest of the
+          node, by which we recognise an unchanged node and don't
+          write it again.
+        */
+        struct CoverNode {
+                CoverNode() : m_id(std::string()), m_length(0), m_leaves(0) {};
+
+                BlockId m_id;
+                unsigned long m_length;
+                unsigned long m_leaves;
+                StrongChecksum m_digest;
+
+        private:
+                friend class boost::serialization::access;
+                template<class Archive>
+                        void serialize(Archive &in_ar, const unsigned int in_version) {
+                        in_ar & m_id;
+                        in_ar & m_length;
+                        in_ar & m_leaves;
+                        if(in_version > 0) {
+                                in_ar & m_digest;
+                                return;
+                        }
+                        std::string digest;     // cf. CoverEntry
+                        in_ar & digest;
+                        m_digest = Digest::decode(digest);
+                }
+        };
+
+
         /*
           A block whose data is too big to push as a single chunk, so
           it computes a covering of smaller blocks.  This block's data
@@ -254,9 +433,13 @@ namespace cryptar {
           offsets that form the covering.  This block is what
           implements the cryptar algorithm.
 
-          Not implemented yet: If the covering is itself too large, we
-          could store the covering in another CoverBlock and here
-          store only a pointer to the secondary CoverBlock.
+          If the covering is itself large (more than
+          CoverParams::m_fanout entries), it is stored as a tree of
+          DataBlocks.  Leaf nodes hold runs of CoverEntry's, interior
+          nodes hold CoverNode's, and this block holds only the top
+          level.  Nodes are cut where the entries' checksums say, so
+          a change to one region of the content changes only the
+          nodes above it.
         */
         class CoverBlock : public DataBlock {
         public:
@@ -271,26 +454,155 @@ namespace cryptar {
                 //virtual ~CoverBlock();
 
                 void set_content(const std::string &in_contents);
+                // As set_content(), but read the content from a local file.
+                void set_content(const LocalFile &in_file);
+                // Fetch the covering DataBlocks and reassemble the content.
+                std::string contents() const;
+                // As contents(), but hold only a node per level in memory.
+                void write_contents(std::ostream &out_stream) const;
+
+                /* from_stream() also rebuilds the checksum indices */
+                virtual void from_stream(const Bytes &in_stream);
+
+                // What the most recent set_content() did.
+                struct CoverStats {
+                        CoverStats() : m_blocks_reused(0), m_blocks_written(0),
+                                       m_bytes_reused(0), m_bytes_written(0),
+                                       m_changes(0), m_recut(false),
+                                       m_nodes_reused(0), m_nodes_written(0),
+                                       m_filter_queries(0), m_filter_passes(0),
+                                       m_filter_false_positives(0),
+                                       m_filter_bytes(0), m_filter_expected_fp_rate(0.0) {};
+                        unsigned long m_blocks_reused;
+                        unsigned long m_blocks_written;
+                        unsigned long m_bytes_reused;
+                        unsigned long m_bytes_written;
+                        unsigned long m_changes;     /* runs of new bytes */
+                        bool m_recut;                /* window changed, all cut afresh */
+                        unsigned long m_nodes_reused;  /* of the covering's tree */
+                        unsigned long m_nodes_written;
+
+                        // The Bloom filter in front of the rolling scan's
+                        // index lookups.  A false positive passed the
+                        // filter but found nothing in the index.
+                        unsigned long m_filter_queries;
+                        unsigned long m_filter_passes;
+                        unsigned long m_filter_false_positives;
+                        unsigned long m_filter_bytes;
+                        double m_filter_expected_fp_rate;
+                };
+                const CoverStats &stats() const { return m_stats; }
+                // For a tree read from the store, empty until set_content().
+                const std::vector<CoverEntry> &cover() const { return m_cover; }
+                const CoverParams &cover_params() const { return m_params; }
+                // Levels of the covering's tree, 0 if held in this block.
+                unsigned int cover_levels() const { return m_levels; }
+
+                /*
+                  Threads to use for the rolling scan of large
+                  content.  Zero (the default) means one per core if
+                  mode(Threads), else one.  The covering is the same
+                  either way.
+                */
+                void scan_threads(unsigned int in_threads) { m_scan_threads = in_threads; }
+
+                /*
+                  Make and write new blocks on in_stages's threads
+                  rather than on ours.  set_content() waits for them
+                  before it returns.  The pipeline is not ours, and
+                  may serve other blocks too.  0 (the default) means
+                  we write each block ourselves.
+                */
+                void stage_pipeline(StagePipeline *in_stages) { m_stages = in_stages; }
 
         private:
-                // Should window size really be compiled into the program?
-                static const unsigned int m_window_size; /* rsync window size, in bytes */
-                
-                // Point ourselves at local data.  To provide or
-                // consume the local data, derive from CoverBlock.
-                char *m_base;
+                // A full window at this offset matches this block.
+                typedef std::pair<unsigned long, const CoverEntry *> CoverMatch;
+
+                void cover_content(const char *in_base,
+                                   unsigned long in_length,
+                                   const LocalFile *in_stream);
+                const char *content_at(unsigned long in_offset) const
+                        { return m_base + (in_offset - m_base_offset); }
+                void load_cover();
+                void load_tree();
+                void walk_node(const CoverNode &in_node,
+                               unsigned int in_level,
+                               unsigned long &io_offset,
+                               const std::function<void(const CoverEntry &)> &in_leaf,
+                               std::unordered_map<StrongChecksum, CoverNode> *out_nodes) const;
+                void store_cover();
+                CoverNode store_node(const std::string &in_node,
+                                     unsigned long in_length,
+                                     unsigned long in_leaves,
+                                     std::unordered_map<StrongChecksum, CoverNode> &io_nodes);
+                void index_cover();
+                void compute_cover(std::vector<CoverEntry> &out_cover);
+                void compute_cover_parallel(unsigned int in_threads,
+                                            std::vector<CoverEntry> &out_cover);
+                void compute_cover_streaming(const LocalFile &in_file,
+                                             std::vector<CoverEntry> &out_cover);
+                void find_all_matches(unsigned long in_begin,
+                                      unsigned long in_end,
+                                      std::vector<CoverMatch> &out_matches,
+                                      CoverStats &io_stats) const;
+                const CoverEntry *scan_match(WeakChecksum in_weak,
+                                             const char *in_buf,
+                                             CoverStats &io_stats) const;
+                void emit_gap(unsigned long in_begin,
+                              unsigned long in_end,
+                              std::vector<CoverEntry> &out_cover);
+                void cut_gap(unsigned long in_begin,
+                             unsigned long in_end,
+                             std::vector<CoverEntry> &out_cover);
+                void emit_block(const BlockSignature &in_signature,
+                                std::vector<CoverEntry> &out_cover);
+                BlockId write_block(std::string &io_content);
+                void write_deferred(const char *in_base,
+                                    const LocalFile *in_stream,
+                                    std::vector<CoverEntry> &io_cover);
+                void reuse_block(const CoverEntry &in_entry,
+                                 unsigned long in_offset,
+                                 std::vector<CoverEntry> &out_cover);
+                const CoverEntry *find_match(WeakChecksum in_weak,
+                                             const char *in_buf,
+                                             unsigned long in_length,
+                                             const MatchChecksum *in_match = 0) const;
+
+                // How we cut content into blocks.  Taken from the
+                // store (the Transport) for a first covering, then
+                // persisted with the covering so later diffs match.
+                CoverParams m_params;
+
+                // The local data, while we cover it.  m_base holds
+                // the content from offset m_base_offset: all of it
+                // when we have it in memory or mapped, a piece at a
+                // time when we stream it.  m_base_length is the
+                // length of the whole content.
+                const char *m_base;
+                unsigned long m_base_offset;
                 unsigned long m_base_length;
 
-                // Remote data
-                std::vector<DataBlock *> m_data_blocks;
-                std::set<unsigned long> m_easy_checksums;
-                std::map<unsigned long, DataBlock *> m_crypto_checksums;
+                // Remote data.  For a tree, m_cover holds the leaves
+                // once load_tree() has fetched them.
+                unsigned int m_levels;
+                std::vector<CoverNode> m_roots;
+                bool m_tree_loaded;
+                std::unordered_map<StrongChecksum, CoverNode> m_nodes;  /* digest -> node of the tree */
+                std::vector<CoverEntry> m_cover;
+                ChecksumIndex m_index;  /* weak checksum -> index into m_cover */
+                BloomFilter m_filter;   /* full-window weak checksums in m_index */
+
+                CoverStats m_stats;
+                unsigned int m_scan_threads;
+                StagePipeline *m_stages;
+                // Note new blocks but don't write them yet (cf.
+                // write_deferred()), while a re-cut may discard the
+                // covering.
+                bool m_defer_writes;
         };
         
 
-        typedef unsigned long WeakChecksum;
-        typedef std::string StrongChecksum;
-
 #ifdef LATER
         /*
           Describe a file.  Contains file meta-information and
@@ -401,4 +713,14 @@ namespace cryptar {
 #endif  /* LATER */
 }
 
+BOOST_CLASS_VERSION(cryptar::CoverEntry, 1)
+BOOST_CLASS_VERSION(cryptar::CoverNode, 1)
+
+namespace std {
+        template<> struct hash<cryptar::BlockId> {
+                size_t operator()(const cryptar::BlockId &in_id) const
+                { return in_id.digest().hash(); }
+        };
+}
+
 #endif  /* __BLOCK_H__*/
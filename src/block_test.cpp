@@ -22,9 +22,13 @@
 #define BOOST_TEST_DYN_LINK
 #define BOOST_TEST_MODULE tests
 //#include <algorithm>
+#include <boost/filesystem.hpp>
 #include <boost/test/unit_test.hpp>
+#include <fstream>
 #include <map>
+#include <sstream>
 #include <string>
+#include <unordered_set>
 #include <utility>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -40,6 +44,17 @@ using namespace std;
 
 namespace {
 
+        // How many blocks a TransportFS store holds.
+        unsigned long count_files(const string &in_dir)
+        {
+                unsigned long count = 0;
+                for(boost::filesystem::directory_iterator it(in_dir);
+                    it != boost::filesystem::directory_iterator(); ++it)
+                        count++;
+                return count;
+        }
+
+
         /*
           Check that BlockId's behave as we expect.
 
@@ -60,6 +75,31 @@ namespace {
                 BlockId b3(b1);
                 BOOST_CHECK(b1 == b3);
                 BOOST_CHECK(!(b1 != b3));
+
+                // Round trips through its bytes and an archive.
+                BOOST_CHECK_EQUAL(b1.as_string().size(), Digest::length);
+                BOOST_CHECK(BlockId(b1.as_string()) == b1);
+                ostringstream out;
+                {
+                        boost::archive::text_oarchive oa(out);
+                        oa & b1;
+                }
+                istringstream in(out.str());
+                boost::archive::text_iarchive ia(in);
+                ia & b3;
+                BOOST_CHECK(b1 == b3);
+
+                // An old, 40 byte id names the file it always did.
+                const string old_id(pseudo_random_string(40));
+                BOOST_CHECK_EQUAL(BlockId(old_id).filesystem_name(), message_digest(old_id, true));
+                BOOST_CHECK(BlockId(string()).empty());
+                BOOST_CHECK(!b1.empty());
+
+                unordered_set<BlockId> ids;
+                for(int i = 0; i < 1000; i++)
+                        ids.insert(BlockId());
+                ids.insert(*ids.begin());
+                BOOST_CHECK_EQUAL(ids.size(), 1000);
         }
 
         
@@ -83,6 +123,101 @@ namespace {
         }
 
 
+        void write_file(const string &in_filename, const string &in_content)
+        {
+                ofstream out(in_filename, ios_base::binary | ios_base::trunc);
+                out.write(in_content.data(), in_content.size());
+        }
+
+
+        /*
+          A data block made from a file, mapped or read piecewise,
+          holds what the file holds.
+        */
+        void check_data_block_file()
+        {
+                cout << "check_data_block_file()" << endl;
+                mode(Verbose, true);
+                mode(Testing, true);
+                mode(Threads, false);
+
+                ConfigParam params(no_transport);
+                params.m_passphrase = pseudo_random_string();
+                string dir_name = temp_dir_name();
+                const string filename = dir_name + "file";
+                const string content(pseudo_random_string(300000));
+                write_file(filename, content);
+                for(int map = 0; map < 2; map++) {
+                        DataBlock *bp = block_empty<DataBlock>(params.transport(),
+                                                               params.m_passphrase);
+                        bp->set_content(LocalFile(filename, map));
+                        BOOST_CHECK(content == bp->plain_text());
+                        delete bp;
+                }
+                clean_temp_dir(dir_name);
+        }
+
+
+        /*
+          Small blocks sample themselves into the store, which
+          trains a dictionary from them, against which later small
+          blocks compress.  Blocks compressed against an older
+          dictionary still read once there is a newer.
+        */
+        void check_data_block_dictionary()
+        {
+                cout << "check_data_block_dictionary()" << endl;
+                mode(Verbose, true);
+                mode(Testing, true);
+                mode(Threads, false);
+
+                ConfigParam params(fs);
+                params.m_passphrase = pseudo_random_string();
+                params.m_local_dir = temp_dir_name();
+                shared_ptr<Transport> transport(params.transport());
+                vector<string> contents;
+                for(unsigned int i = 0; i < 1500; i++) {
+                        ostringstream content;
+                        content << "owner=jeff group=users mode=0644 size=" << i * 7919 % 100000
+                                << " name=" << filename_from_random_bits(pseudo_random_string(9))
+                                << " modified=2013-0" << 1 + i % 9 << "-1" << i % 10;
+                        contents.push_back(content.str());
+                        delete block_by_content<DataBlock>(transport, params.m_passphrase, content.str());
+                }
+                BOOST_CHECK_EQUAL(0UL, transport->current_dictionary());
+                BOOST_CHECK_EQUAL(1UL, transport->train_dictionary());
+                BOOST_CHECK_EQUAL(1UL, transport->current_dictionary());
+                BOOST_CHECK(transport->dictionary(1));
+                BOOST_CHECK(!transport->dictionary(2));
+
+                shared_ptr<Transport> no_store;
+                DataBlock *bp = block_by_content<DataBlock>(transport, params.m_passphrase, contents[7]);
+                DataBlock *plain = block_by_content<DataBlock>(no_store, params.m_passphrase, contents[7]);
+                BOOST_CHECK(bp->to_stream().size() < plain->to_stream().size());
+                bp->write();
+                DataBlock *bp2 = block_by_id<DataBlock>(transport, params.m_passphrase, bp->id());
+                bp2->read();
+                BOOST_CHECK_EQUAL(contents[7], bp2->plain_text());
+
+                // Without the store, there is no dictionary.
+                DataBlock *bp3 = block_by_id<DataBlock>(no_store, params.m_passphrase, bp->id());
+                transport->read(bp3);
+                BOOST_CHECK_THROW(bp3->plain_text(), domain_error);
+
+                BOOST_CHECK_EQUAL(2UL, transport->train_dictionary(contents));
+                BOOST_CHECK_EQUAL(contents[7], bp2->plain_text());
+                DataBlock *bp4 = block_by_content<DataBlock>(transport, params.m_passphrase, contents[8]);
+                BOOST_CHECK_EQUAL(contents[8], bp4->plain_text());
+
+                delete bp;
+                delete plain;
+                delete bp2;
+                delete bp3;
+                delete bp4;
+                clean_temp_dir(params.m_local_dir);
+        }
+
+
         /*
           Serialisation test.
         */
@@ -105,6 +240,430 @@ namespace {
                                                         params.m_passphrase);
                 bp2->from_stream(bp->to_stream());
                 BOOST_CHECK_EQUAL(content, bp2->plain_text());
+                // The blocks share the cipher text.
+                BOOST_CHECK(bp2->to_stream().data() == bp->to_stream().data());
+        }
+
+
+        /*
+          Cover some content, then change it in the middle and cover
+          again.  The second covering should reuse what didn't change.
+        */
+        void check_cover_block()
+        {
+                cout << "check_cover_block()" << endl;
+                mode(Verbose, true);
+                mode(Testing, true);
+                mode(Threads, false);
+
+                ConfigParam params(fs);
+                params.m_passphrase = pseudo_random_string();
+                params.m_local_dir = temp_dir_name();
+
+                const string content(pseudo_random_string(10000));
+                CoverBlock *cbp = block_by_content<CoverBlock>(params.transport(),
+                                                               params.m_passphrase,
+                                                               content);
+                BOOST_CHECK_EQUAL(content, cbp->contents());
+                BOOST_CHECK_EQUAL(0UL, cbp->stats().m_blocks_reused);
+                BOOST_CHECK_EQUAL(content.size(), cbp->stats().m_bytes_written);
+
+                // Insert a few bytes at an offset that is not a
+                // multiple of the window size.
+                string new_content(content);
+                new_content.insert(3000, pseudo_random_string(37));
+                cbp->set_content(new_content);
+                BOOST_CHECK_EQUAL(new_content, cbp->contents());
+                BOOST_CHECK(cbp->stats().m_blocks_reused > 0);
+                BOOST_CHECK(cbp->stats().m_bytes_written < 2 * 512 + 37);
+                BOOST_CHECK_EQUAL(new_content.size(),
+                                  cbp->stats().m_bytes_written + cbp->stats().m_bytes_reused);
+
+                // Most of the rolling scan's lookups stop at the filter.
+                const CoverBlock::CoverStats &stats = cbp->stats();
+                BOOST_CHECK(stats.m_filter_bytes > 0);
+                BOOST_CHECK(stats.m_filter_queries > stats.m_blocks_reused);
+                BOOST_CHECK(stats.m_filter_passes > 0);
+                BOOST_CHECK(stats.m_filter_passes < stats.m_filter_queries / 10);
+                BOOST_CHECK(stats.m_filter_false_positives <= stats.m_filter_passes);
+
+                // The covering survives a round trip through the store.
+                cbp->write();
+                CoverBlock *cbp2 = block_by_id<CoverBlock>(params.transport(),
+                                                           params.m_passphrase,
+                                                           cbp->id());
+                cbp2->read();
+                BOOST_CHECK_EQUAL(new_content, cbp2->contents());
+
+                // The store matches blocks with its own keyed hash.
+                BOOST_CHECK_EQUAL(cbp2->cover_params().m_match_hash, match_keyed);
+                BOOST_CHECK(cbp2->cover_params().m_match_key == params.m_cover_params.m_match_key);
+                cbp2->set_content(new_content);
+                BOOST_CHECK_EQUAL(0UL, cbp2->stats().m_blocks_written);
+
+                delete cbp;
+                delete cbp2;
+                clean_temp_dir(params.m_local_dir);
+        }
+
+
+        /*
+          As check_cover_block(), but with content-defined chunking
+          chosen for the store.
+        */
+        void check_cover_block_cdc()
+        {
+                cout << "check_cover_block_cdc()" << endl;
+                mode(Verbose, true);
+                mode(Testing, true);
+                mode(Threads, false);
+
+                ConfigParam params(fs);
+                params.m_passphrase = pseudo_random_string();
+                params.m_local_dir = temp_dir_name();
+                params.m_cover_params.m_mode = cover_cdc;
+                params.m_cover_params.m_min_chunk = 256;
+                params.m_cover_params.m_avg_chunk = 1024;
+                params.m_cover_params.m_max_chunk = 4096;
+
+                const string content(pseudo_random_string(50000));
+                CoverBlock *cbp = block_by_content<CoverBlock>(params.transport(),
+                                                               params.m_passphrase,
+                                                               content);
+                BOOST_CHECK_EQUAL(content, cbp->contents());
+                BOOST_CHECK(cbp->cover().size() < content.size() / 256);
+
+                string new_content(content);
+                new_content.insert(20000, pseudo_random_string(37));
+                cbp->set_content(new_content);
+                BOOST_CHECK_EQUAL(new_content, cbp->contents());
+                BOOST_CHECK(cbp->stats().m_bytes_written < 3 * 4096 + 37);
+
+                // The chunking parameters travel with the covering.
+                cbp->write();
+                CoverBlock *cbp2 = block_by_id<CoverBlock>(params.transport(),
+                                                           params.m_passphrase,
+                                                           cbp->id());
+                cbp2->read();
+                BOOST_CHECK_EQUAL(cbp2->cover_params().m_mode, cover_cdc);
+                BOOST_CHECK_EQUAL(cbp2->cover_params().m_avg_chunk, 1024UL);
+
+                delete cbp;
+                delete cbp2;
+                clean_temp_dir(params.m_local_dir);
+        }
+
+
+        /*
+          The parallel rolling scan must produce exactly the serial
+          covering.
+        */
+        void check_cover_block_parallel()
+        {
+                cout << "check_cover_block_parallel()" << endl;
+                mode(Verbose, true);
+                mode(Testing, true);
+                mode(Threads, false);
+
+                ConfigParam params(fs);
+                params.m_passphrase = pseudo_random_string();
+                params.m_local_dir = temp_dir_name();
+
+                const string content(pseudo_random_string(300000));
+                CoverBlock *cbp = block_by_content<CoverBlock>(params.transport(),
+                                                               params.m_passphrase,
+                                                               content);
+                cbp->write();
+
+                // Insertions, a deletion, and an overwrite.
+                string new_content(content);
+                new_content.insert(250000, pseudo_random_string(3));
+                new_content.erase(150000, 1000);
+                new_content.replace(70000, 10, pseudo_random_string(10));
+                new_content.insert(1, pseudo_random_string(1));
+
+                CoverBlock *serial = block_by_id<CoverBlock>(params.transport(),
+                                                             params.m_passphrase,
+                                                             cbp->id());
+                serial->read();
+                serial->scan_threads(1);
+                serial->set_content(new_content);
+
+                CoverBlock *parallel = block_by_id<CoverBlock>(params.transport(),
+                                                               params.m_passphrase,
+                                                               cbp->id());
+                parallel->read();
+                parallel->scan_threads(4);
+                parallel->set_content(new_content);
+
+                BOOST_CHECK_EQUAL(new_content, parallel->contents());
+                BOOST_CHECK_EQUAL(serial->stats().m_blocks_reused, parallel->stats().m_blocks_reused);
+                BOOST_REQUIRE_EQUAL(serial->cover().size(), parallel->cover().size());
+                for(unsigned long i = 0; i < serial->cover().size(); i++) {
+                        const CoverEntry &s = serial->cover()[i];
+                        const CoverEntry &p = parallel->cover()[i];
+                        BOOST_CHECK_EQUAL(s.m_offset, p.m_offset);
+                        BOOST_CHECK_EQUAL(s.m_length, p.m_length);
+                        BOOST_CHECK(s.m_strong == p.m_strong);
+                }
+
+                delete cbp;
+                delete serial;
+                delete parallel;
+                clean_temp_dir(params.m_local_dir);
+        }
+
+
+        /*
+          Covering through a stage pipeline gives a covering that
+          reads back, and a later covering still finds the blocks.
+        */
+        void check_cover_block_stages()
+        {
+                cout << "check_cover_block_stages()" << endl;
+                mode(Verbose, true);
+                mode(Testing, true);
+                mode(Threads, false);
+
+                ConfigParam params(fs);
+                params.m_passphrase = pseudo_random_string();
+                params.m_local_dir = temp_dir_name();
+
+                StagePipeline stages(StageThreads(2, 2, 2));
+                const string content(pseudo_random_string(300000));
+                CoverBlock *cbp = block_by_content<CoverBlock>(params.transport(),
+                                                               params.m_passphrase,
+                                                               string());
+                cbp->stage_pipeline(&stages);
+                cbp->set_content(content);
+                cbp->write();
+                BOOST_CHECK_EQUAL(content, cbp->contents());
+
+                string new_content(content);
+                new_content.replace(70000, 10, pseudo_random_string(10));
+                CoverBlock *next = block_by_id<CoverBlock>(params.transport(),
+                                                           params.m_passphrase,
+                                                           cbp->id());
+                next->read();
+                next->stage_pipeline(&stages);
+                next->set_content(new_content);
+                BOOST_CHECK_EQUAL(new_content, next->contents());
+                BOOST_CHECK(next->stats().m_blocks_reused > 0);
+                const CoverBlock::CoverStats &first = cbp->stats();
+                const CoverBlock::CoverStats &second = next->stats();
+                BOOST_CHECK_EQUAL(first.m_blocks_written + first.m_nodes_written
+                                  + second.m_blocks_written + second.m_nodes_written,
+                                  stages.stats()[0].m_items);
+
+                delete cbp;
+                delete next;
+                clean_temp_dir(params.m_local_dir);
+        }
+
+
+        /*
+          With an adaptive window, the block size follows the file's
+          size and is kept with the covering.  Replacing all of the
+          content calls for bigger blocks, so it is cut afresh.
+        */
+        void check_cover_block_adaptive(bool in_stream)
+        {
+                cout << "check_cover_block_adaptive()" << endl;
+                mode(Verbose, true);
+                mode(Testing, true);
+                mode(Threads, false);
+
+                ConfigParam params(fs);
+                params.m_passphrase = pseudo_random_string();
+                params.m_local_dir = temp_dir_name();
+
+                // sqrt(1 MB) is 1 KB.
+                const string content(pseudo_random_string(1024 * 1024));
+                CoverBlock *cbp = block_by_content<CoverBlock>(params.transport(),
+                                                               params.m_passphrase,
+                                                               content);
+                BOOST_CHECK_EQUAL(cbp->cover_params().m_window, 1024UL);
+                BOOST_CHECK_EQUAL(cbp->cover().size(), 1024UL);
+                cbp->write();
+
+                // A small change keeps the window.
+                string new_content(content);
+                new_content.insert(5000, pseudo_random_string(3));
+                CoverBlock *cbp2 = block_by_id<CoverBlock>(params.transport(),
+                                                           params.m_passphrase,
+                                                           cbp->id());
+                cbp2->read();
+                BOOST_CHECK_EQUAL(cbp2->cover_params().m_window, 1024UL);
+                cbp2->set_content(new_content);
+                BOOST_CHECK(!cbp2->stats().m_recut);
+                BOOST_CHECK_EQUAL(cbp2->stats().m_changes, 1UL);
+                BOOST_CHECK_EQUAL(cbp2->cover_params().m_window, 1024UL);
+                BOOST_CHECK(cbp2->stats().m_bytes_written < 2 * 1024 + 3);
+
+                // One run of all new bytes: sqrt(1 MB * 128) rounds down to 8 KB.
+                // The store gets only the blocks of the new covering.
+                const string other_content(pseudo_random_string(1024 * 1024));
+                const unsigned long stored = count_files(params.m_local_dir);
+                if(in_stream) {
+                        const string filename(temp_file_name(params.m_local_dir));
+                        ofstream(filename, ios_base::binary) << other_content;
+                        cbp2->set_content(LocalFile(filename, false));
+                        unlink(filename.c_str());
+                } else
+                        cbp2->set_content(other_content);
+                BOOST_CHECK(cbp2->stats().m_recut);
+                BOOST_CHECK_EQUAL(cbp2->cover_params().m_window, 8192UL);
+                BOOST_CHECK_EQUAL(cbp2->cover().size(), 128UL);
+                BOOST_CHECK_EQUAL(count_files(params.m_local_dir), stored + 128);
+                BOOST_CHECK_EQUAL(other_content, cbp2->contents());
+
+                // Small files get the smallest window.
+                cbp2->set_content("");
+                CoverBlock *cbp3 = block_by_content<CoverBlock>(params.transport(),
+                                                                params.m_passphrase,
+                                                                pseudo_random_string(100));
+                BOOST_CHECK_EQUAL(cbp3->cover_params().m_window,
+                                  params.m_cover_params.m_min_window);
+
+                delete cbp;
+                delete cbp2;
+                delete cbp3;
+                clean_temp_dir(params.m_local_dir);
+        }
+
+
+        /*
+          A covering with many entries goes in a tree.  A restore walks
+          the tree, and a small change rewrites only the nodes above it.
+        */
+        void check_cover_block_tree()
+        {
+                cout << "check_cover_block_tree()" << endl;
+                mode(Verbose, true);
+                mode(Testing, true);
+                mode(Threads, false);
+
+                ConfigParam params(fs);
+                params.m_passphrase = pseudo_random_string();
+                params.m_local_dir = temp_dir_name();
+                params.m_cover_params.m_adaptive = false;
+                params.m_cover_params.m_window = 512;
+                params.m_cover_params.m_fanout = 16;
+
+                const string content(pseudo_random_string(1024 * 1024));
+                CoverBlock *cbp = block_by_content<CoverBlock>(params.transport(),
+                                                               params.m_passphrase,
+                                                               content);
+                BOOST_CHECK_EQUAL(cbp->cover().size(), 2048UL);
+                BOOST_CHECK(cbp->cover_levels() >= 2);
+                BOOST_CHECK(cbp->stats().m_nodes_written > 2048 / 64);
+                cbp->write();
+
+                // Read back, the tree is walked rather than fetched.
+                CoverBlock *cbp2 = block_by_id<CoverBlock>(params.transport(),
+                                                           params.m_passphrase,
+                                                           cbp->id());
+                cbp2->read();
+                BOOST_CHECK_EQUAL(cbp2->cover_levels(), cbp->cover_levels());
+                BOOST_CHECK(cbp2->cover().empty());
+                BOOST_CHECK_EQUAL(content, cbp2->contents());
+
+                string new_content(content);
+                new_content.insert(500000, pseudo_random_string(3));
+                cbp2->set_content(new_content);
+                BOOST_CHECK_EQUAL(cbp2->cover().size(), 2049UL);
+                BOOST_CHECK_EQUAL(new_content, cbp2->contents());
+                const CoverBlock::CoverStats &stats = cbp2->stats();
+                BOOST_CHECK(stats.m_nodes_written <= 2 * cbp2->cover_levels());
+                BOOST_CHECK(stats.m_nodes_reused > 2048 / 64);
+                cbp2->write();
+
+                CoverBlock *cbp3 = block_by_id<CoverBlock>(params.transport(),
+                                                           params.m_passphrase,
+                                                           cbp2->id());
+                cbp3->read();
+                BOOST_CHECK_EQUAL(new_content, cbp3->contents());
+                cbp3->set_content(new_content);
+                BOOST_CHECK_EQUAL(0UL, cbp3->stats().m_nodes_written);
+                BOOST_CHECK_EQUAL(0UL, cbp3->stats().m_blocks_written);
+
+                delete cbp;
+                delete cbp2;
+                delete cbp3;
+                clean_temp_dir(params.m_local_dir);
+        }
+
+
+        /*
+          Covering a file, mapped or streamed, gives just the covering
+          of the same content in memory.  The streamed scan reads 8 MB
+          pieces, so we make changes on either side of the first
+          boundary.
+        */
+        void check_cover_block_file(CoverMode in_mode)
+        {
+                cout << "check_cover_block_file(" << in_mode << ")" << endl;
+                mode(Verbose, true);
+                mode(Testing, true);
+                mode(Threads, false);
+
+                ConfigParam params(fs);
+                params.m_passphrase = pseudo_random_string();
+                params.m_local_dir = temp_dir_name();
+                params.m_cover_params.m_mode = in_mode;
+                params.m_cover_params.m_adaptive = false;
+                params.m_cover_params.m_window = 4096;
+
+                const unsigned long piece = 8 * 1024 * 1024;
+                const string content(pseudo_random_string(piece + 1024 * 1024));
+                const string filename = params.m_local_dir + "file";
+                write_file(filename, content);
+                CoverBlock *cbp = block_by_content<CoverBlock>(params.transport(),
+                                                               params.m_passphrase,
+                                                               string());
+                cbp->set_content(LocalFile(filename, false));
+                BOOST_CHECK_EQUAL(content, cbp->contents());
+                cbp->write();
+
+                string new_content(content);
+                new_content.insert(piece + 10, pseudo_random_string(5));
+                new_content.insert(piece - 10000, pseudo_random_string(5));
+                new_content.erase(5000000, 777);
+                new_content.insert(1000, pseudo_random_string(1));
+                write_file(filename, new_content);
+
+                vector<CoverBlock *> blocks;
+                for(int i = 0; i < 3; i++) {
+                        blocks.push_back(block_by_id<CoverBlock>(params.transport(),
+                                                                 params.m_passphrase,
+                                                                 cbp->id()));
+                        blocks.back()->read();
+                }
+                blocks[0]->set_content(new_content);
+                LocalFile mapped(filename);
+                BOOST_CHECK(mapped.mapped());
+                blocks[1]->set_content(mapped);
+                blocks[2]->set_content(LocalFile(filename, false));
+
+                const vector<CoverEntry> &expected = blocks[0]->cover();
+                BOOST_CHECK(blocks[0]->stats().m_blocks_reused > 0);
+                for(int i = 1; i < 3; i++) {
+                        BOOST_CHECK_EQUAL(new_content, blocks[i]->contents());
+                        BOOST_CHECK_EQUAL(blocks[0]->stats().m_blocks_reused,
+                                          blocks[i]->stats().m_blocks_reused);
+                        BOOST_CHECK_EQUAL(blocks[0]->stats().m_changes, blocks[i]->stats().m_changes);
+                        BOOST_REQUIRE_EQUAL(expected.size(), blocks[i]->cover().size());
+                        for(unsigned long j = 0; j < expected.size(); j++) {
+                                BOOST_CHECK_EQUAL(expected[j].m_offset, blocks[i]->cover()[j].m_offset);
+                                BOOST_CHECK_EQUAL(expected[j].m_length, blocks[i]->cover()[j].m_length);
+                                BOOST_CHECK(expected[j].m_strong == blocks[i]->cover()[j].m_strong);
+                        }
+                }
+
+                delete cbp;
+                for(auto it = blocks.begin(); it != blocks.end(); ++it)
+                        delete *it;
+                clean_temp_dir(params.m_local_dir);
         }
 
                 
@@ -259,11 +818,58 @@ BOOST_AUTO_TEST_CASE(case_data_block)
         check_data_block();
 }
 
+BOOST_AUTO_TEST_CASE(case_data_block_file)
+{
+        check_data_block_file();
+}
+
+BOOST_AUTO_TEST_CASE(case_data_block_dictionary)
+{
+        check_data_block_dictionary();
+}
+
 BOOST_AUTO_TEST_CASE(case_serialisation)
 {
         check_serialise();
 }
 
+BOOST_AUTO_TEST_CASE(case_cover_block)
+{
+        check_cover_block();
+}
+
+BOOST_AUTO_TEST_CASE(case_cover_block_cdc)
+{
+        check_cover_block_cdc();
+}
+
+BOOST_AUTO_TEST_CASE(case_cover_block_parallel)
+{
+        check_cover_block_parallel();
+}
+
+BOOST_AUTO_TEST_CASE(case_cover_block_stages)
+{
+        check_cover_block_stages();
+}
+
+BOOST_AUTO_TEST_CASE(case_cover_block_adaptive)
+{
+        check_cover_block_adaptive(false);
+        check_cover_block_adaptive(true);
+}
+
+BOOST_AUTO_TEST_CASE(case_cover_block_tree)
+{
+        check_cover_block_tree();
+}
+
+BOOST_AUTO_TEST_CASE(case_cover_block_file)
+{
+        check_cover_block_file(cover_fixed);
+        check_cover_block_file(cover_cdc);
+}
+
 BOOST_AUTO_TEST_CASE(case_print_completion_one)
 {
         check_completion(false);
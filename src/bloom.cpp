@@ -0,0 +1,77 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "bloom.h"
+
+
+using namespace cryptar;
+using namespace std;
+
+
+/*
+  About 16 bits per key.  With eight bits set per key in one block,
+  that gives a false positive rate of a fraction of a percent.
+*/
+static const unsigned long bits_per_key = 16;
+
+
+void BloomFilter::reset(unsigned long in_expected)
+{
+        const unsigned long bits_per_block = 64 * words_per_block;
+        const unsigned long num_blocks = (in_expected * bits_per_key + bits_per_block - 1) / bits_per_block;
+        Block empty = { { 0 } };
+        m_blocks.assign(max(1UL, num_blocks), empty);
+        m_size = 0;
+}
+
+
+void BloomFilter::insert(WeakChecksum in_weak)
+{
+        if(m_blocks.empty())
+                reset(1);
+        const uint64_t hash = mix(in_weak);
+        Block &block = m_blocks[block_of(hash)];
+        for(int i = 0; i < words_per_block; i++)
+                block.m_words[i] |= bit_of(hash, i);
+        m_size++;
+}
+
+
+/*
+  A query passes if its bit is set in each of the eight words, so if
+  a fraction f of the bits are set, about f^8 of queries for absent
+  keys pass.
+*/
+double BloomFilter::false_positive_rate() const
+{
+        if(m_blocks.empty())
+                return 0.0;
+        unsigned long bits_set = 0;
+        for(auto it = m_blocks.begin(); it != m_blocks.end(); ++it)
+                for(int i = 0; i < words_per_block; i++)
+                        bits_set += __builtin_popcountll(it->m_words[i]);
+        const double fill = static_cast<double>(bits_set) / (m_blocks.size() * 64 * words_per_block);
+        return pow(fill, words_per_block);
+}
@@ -0,0 +1,101 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+#ifndef __BLOOM_H__
+#define __BLOOM_H__ 1
+
+
+#include <stdint.h>
+#include <vector>
+
+#include "checksum.h"
+
+
+namespace cryptar {
+
+        /*
+          A blocked Bloom filter of weak checksums, consulted by the
+          rolling scan before the ChecksumIndex.
+
+          Nearly every byte offset of a scan misses.  The index is
+          large (several words per block of the covering) and for a
+          big file doesn't fit in cache, so each miss costs a cache
+          miss.  The filter is about 2 bytes per block and answers
+          "certainly not" with one cache line: each key lives in a
+          single 512 bit block, one bit in each of its eight words.
+
+          A "maybe" is confirmed in the index as before.
+        */
+        class BloomFilter {
+        public:
+                BloomFilter() : m_size(0) {};
+
+                // Empty the filter and size it for in_expected keys.
+                void reset(unsigned long in_expected);
+                void insert(WeakChecksum in_weak);
+
+                bool maybe_contains(WeakChecksum in_weak) const
+                {
+                        if(m_blocks.empty())
+                                return false;
+                        const uint64_t hash = mix(in_weak);
+                        const Block &block = m_blocks[block_of(hash)];
+                        for(int i = 0; i < words_per_block; i++)
+                                if(!(block.m_words[i] & bit_of(hash, i)))
+                                        return false;
+                        return true;
+                }
+
+                unsigned long size() const { return m_size; }
+                unsigned long memory_size() const { return m_blocks.size() * sizeof(Block); }
+                // Expected false positive rate, estimated from how full the filter is.
+                double false_positive_rate() const;
+
+        private:
+                static const int words_per_block = 8;
+                struct Block {
+                        uint64_t m_words[words_per_block];
+                };
+
+                static uint64_t mix(WeakChecksum in_weak)
+                {
+                        return (static_cast<uint64_t>(in_weak) + 1) * 0x9e3779b97f4a7c15ULL;
+                }
+                unsigned long block_of(uint64_t in_hash) const
+                {
+                        // Map the high 32 bits onto [0, number of blocks) without a divide.
+                        return ((in_hash >> 32) * m_blocks.size()) >> 32;
+                }
+                static uint64_t bit_of(uint64_t in_hash, int in_word)
+                {
+                        static const uint32_t salt[words_per_block] = {
+                                0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+                                0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U };
+                        return 1ULL << ((static_cast<uint32_t>(in_hash) * salt[in_word]) >> 26);
+                }
+
+                std::vector<Block> m_blocks;
+                unsigned long m_size;
+        };
+}
+
+#endif  /* __BLOOM_H__*/
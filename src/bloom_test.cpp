@@ -0,0 +1,100 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE tests
+#include <boost/test/unit_test.hpp>
+#include <cstdlib>
+#include <set>
+
+#include "cryptar.h"
+
+
+using namespace cryptar;
+using namespace std;
+
+
+namespace {
+
+        /*
+          Everything inserted is reported as maybe present, and the
+          false positive rate is about what the filter predicts.
+        */
+        void test_filter(unsigned long in_count)
+        {
+                BloomFilter filter;
+                filter.reset(in_count);
+                set<WeakChecksum> keys;
+                srand(in_count);
+                while(keys.size() < in_count)
+                        keys.insert(rand() & 0xffffffff);
+                for(auto it = keys.begin(); it != keys.end(); ++it)
+                        filter.insert(*it);
+                BOOST_CHECK_EQUAL(filter.size(), in_count);
+                BOOST_CHECK(filter.memory_size() <= in_count * 2 + 64);
+
+                for(auto it = keys.begin(); it != keys.end(); ++it)
+                        BOOST_CHECK(filter.maybe_contains(*it));
+
+                const unsigned long num_queries = 200000;
+                unsigned long false_positives = 0;
+                unsigned long absent = 0;
+                for(unsigned long i = 0; i < num_queries; i++) {
+                        WeakChecksum weak = rand() & 0xffffffff;
+                        if(keys.count(weak))
+                                continue;
+                        absent++;
+                        if(filter.maybe_contains(weak))
+                                false_positives++;
+                }
+                const double measured = static_cast<double>(false_positives) / absent;
+                cout << in_count << " keys, " << filter.memory_size() << " bytes, "
+                     << "false positive rate " << measured
+                     << " (expected " << filter.false_positive_rate() << ")" << endl;
+                BOOST_CHECK(measured < 0.02);
+                BOOST_CHECK(filter.false_positive_rate() < 0.02);
+        }
+
+
+        void test_empty()
+        {
+                BloomFilter filter;
+                BOOST_CHECK(!filter.maybe_contains(0));
+                BOOST_CHECK_EQUAL(filter.memory_size(), 0UL);
+                filter.reset(0);
+                BOOST_CHECK(!filter.maybe_contains(0));
+                filter.insert(0);
+                BOOST_CHECK(filter.maybe_contains(0));
+        }
+}
+
+
+BOOST_AUTO_TEST_CASE(filter)
+{
+        test_filter(1);
+        test_filter(1000);
+        test_filter(100000);
+}
+
+BOOST_AUTO_TEST_CASE(empty)
+{
+        test_empty();
+}
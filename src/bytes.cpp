@@ -0,0 +1,98 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+#include <algorithm>
+#include <stdexcept>
+#include <string.h>
+
+#include "bytes.h"
+#include "pipeline.h"
+
+
+using namespace cryptar;
+using namespace std;
+
+
+Bytes::Bytes(string &&in_string)
+        : m_offset(0), m_length(in_string.size())
+{
+        if(m_length)
+                m_buffer = make_shared<const string>(move(in_string));
+}
+
+
+
+Bytes::Bytes(const char *in_buf, size_t in_len)
+        : m_offset(0), m_length(in_len)
+{
+        if(m_length)
+                m_buffer = make_shared<const string>(in_buf, in_len);
+}
+
+
+
+Bytes Bytes::slice(size_t in_offset, size_t in_len) const
+{
+        if(in_offset > m_length)
+                throw(out_of_range("Bytes::slice()"));
+        Bytes bytes(*this);
+        bytes.m_offset += in_offset;
+        bytes.m_length = min(in_len, m_length - in_offset);
+        return bytes;
+}
+
+
+
+bool Bytes::operator==(const Bytes &in_bytes) const
+{
+        return m_length == in_bytes.m_length
+                && (data() == in_bytes.data() || 0 == memcmp(data(), in_bytes.data(), m_length));
+}
+
+
+
+/*
+  A stream that can't seek (a pipe, say) we read a piece at a time
+  instead.
+*/
+Bytes cryptar::read_bytes(istream &in_stream)
+{
+        const istream::pos_type start = in_stream.tellg();
+        if(istream::pos_type(-1) != start && in_stream.seekg(0, ios::end)) {
+                const istream::pos_type end = in_stream.tellg();
+                in_stream.seekg(start);
+                if(istream::pos_type(-1) != end && in_stream) {
+                        string buffer(static_cast<size_t>(end - start), '\0');
+                        if(!buffer.empty() && !in_stream.read(&buffer[0], buffer.size()))
+                                throw(runtime_error("read_bytes(): read failed"));
+                        // Anything since we measured it.
+                        StringSink sink(buffer);
+                        pump(in_stream, sink);
+                        return Bytes(move(buffer));
+                }
+        }
+        in_stream.clear();
+        string buffer;
+        StringSink sink(buffer);
+        pump(in_stream, sink);
+        return Bytes(move(buffer));
+}
@@ -0,0 +1,79 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+#ifndef __BYTES_H__
+#define __BYTES_H__ 1
+
+
+#include <istream>
+#include <memory>
+#include <string>
+
+
+namespace cryptar {
+
+        /*
+          An immutable run of bytes that copies by reference: a slice
+          of a buffer that every copy and every slice shares, and
+          that goes when the last of them does.  A block's payload is
+          read or made once and then passed about as Bytes, never
+          copied again.
+
+          Bytes made from a string rvalue take its buffer as is.
+        */
+        class Bytes {
+        public:
+                Bytes() : m_offset(0), m_length(0) {};
+                explicit Bytes(std::string &&in_string);
+                Bytes(const char *in_buf, size_t in_len);
+
+                const char *data() const { return m_buffer ? m_buffer->data() + m_offset : ""; }
+                size_t size() const { return m_length; }
+                bool empty() const { return 0 == m_length; }
+
+                // in_len bytes from in_offset (or all that there are),
+                // sharing our buffer.
+                Bytes slice(size_t in_offset, size_t in_len = std::string::npos) const;
+                // A copy, for what must have a string.
+                std::string str() const { return std::string(data(), m_length); }
+
+                bool operator==(const Bytes &in_bytes) const;
+                bool operator!=(const Bytes &in_bytes) const { return !operator==(in_bytes); }
+
+                // How many Bytes share our buffer (for tests).
+                long use_count() const { return m_buffer.use_count(); }
+
+        private:
+                std::shared_ptr<const std::string> m_buffer;
+                size_t m_offset;
+                size_t m_length;
+        };
+
+
+        /*
+          All of a stream, read once.  If the stream can say how long
+          it is, the bytes go straight into a buffer of that size.
+        */
+        Bytes read_bytes(std::istream &in_stream);
+}
+
+#endif  /* __BYTES_H__*/
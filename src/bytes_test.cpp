@@ -0,0 +1,110 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE tests
+#include <boost/test/unit_test.hpp>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "cryptar.h"
+#include "test_text.h"
+
+
+using namespace cryptar;
+using namespace std;
+
+
+namespace {
+
+        /*
+          Bytes made from a string keep its buffer, and copies and
+          slices share it.
+        */
+        void test_share()
+        {
+                string text(pseudo_random_string(100000));
+                const string expected(text);
+                const char *buffer = text.data();
+                const Bytes bytes(move(text));
+                BOOST_CHECK(bytes.data() == buffer);
+                BOOST_CHECK_EQUAL(bytes.size(), expected.size());
+                BOOST_CHECK(bytes.str() == expected);
+                BOOST_CHECK_EQUAL(bytes.use_count(), 1);
+
+                const Bytes copy(bytes);
+                BOOST_CHECK(copy.data() == buffer);
+                BOOST_CHECK(copy == bytes);
+                const Bytes slice(bytes.slice(1000, 500));
+                BOOST_CHECK(slice.data() == buffer + 1000);
+                BOOST_CHECK(slice.str() == expected.substr(1000, 500));
+                BOOST_CHECK_EQUAL(bytes.use_count(), 3);
+                BOOST_CHECK(slice.slice(100).str() == expected.substr(1100, 400));
+                BOOST_CHECK(bytes.slice(expected.size()).empty());
+                BOOST_CHECK_THROW(bytes.slice(expected.size() + 1), out_of_range);
+
+                // Equal bytes in different buffers.
+                const Bytes other(expected.data() + 1000, 500);
+                BOOST_CHECK(other == slice);
+                BOOST_CHECK(other != bytes);
+                BOOST_CHECK(Bytes() == Bytes(string()));
+                BOOST_CHECK_EQUAL(Bytes().data()[0], '\0');
+        }
+
+
+        // A file, or any stream, is read whole.
+        void test_read()
+        {
+                const string text(pseudo_random_string(300000));
+                istringstream stream(text);
+                BOOST_CHECK(read_bytes(stream).str() == text);
+
+                istringstream rest(text);
+                rest.seekg(1000);
+                BOOST_CHECK(read_bytes(rest).str() == text.substr(1000));
+
+                const string filename("/tmp/cryptar-bytes-test");
+                {
+                        ofstream file(filename, ios_base::binary | ios_base::trunc);
+                        file.write(text.data(), text.size());
+                }
+                ifstream file(filename, ios_base::binary);
+                BOOST_CHECK(read_bytes(file).str() == text);
+                remove(filename.c_str());
+
+                istringstream empty;
+                BOOST_CHECK(read_bytes(empty).empty());
+        }
+}
+
+
+BOOST_AUTO_TEST_CASE(share)
+{
+        test_share();
+}
+
+BOOST_AUTO_TEST_CASE(read_whole)
+{
+        test_read();
+}
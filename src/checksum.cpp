@@ -0,0 +1,324 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <algorithm>
+#include <cassert>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CRYPTAR_X86_KERNELS 1
+#include <immintrin.h>
+#else
+#define CRYPTAR_X86_KERNELS 0
+#endif
+
+#include "checksum.h"
+#include "crypt.h"
+
+
+using namespace cryptar;
+using namespace std;
+
+
+/*
+  The weak checksum kernels.
+
+  s2 accumulates the running value of s1, which is the same as
+  weighting byte i by (in_len - i).  The vector kernels take the
+  bytes a vector at a time: for a vector of B bytes,
+
+      s2 += B * s1 + sum_j (B - j) x_j
+      s1 += sum_j x_j
+
+  We only keep 16 bits of each sum, so 32 bit lanes may wrap freely.
+*/
+namespace {
+
+        typedef WeakChecksum (*WeakChecksumKernel)(const unsigned char *, unsigned long);
+
+        WeakChecksum weak_checksum_scalar(const unsigned char *in_buf, unsigned long in_len)
+        {
+                WeakChecksum s1 = 0;
+                WeakChecksum s2 = 0;
+                for(unsigned long i = 0; i < in_len; i++) {
+                        s1 += in_buf[i];
+                        s2 += s1;
+                }
+                return ((s2 & 0xffff) << 16) | (s1 & 0xffff);
+        }
+
+
+#if CRYPTAR_X86_KERNELS
+        __attribute__((target("sse4.1")))
+        WeakChecksum weak_checksum_sse4(const unsigned char *in_buf, unsigned long in_len)
+        {
+                const __m128i zero = _mm_setzero_si128();
+                const __m128i ones = _mm_set1_epi16(1);
+                const __m128i weights = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9,
+                                                      8, 7, 6, 5, 4, 3, 2, 1);
+                __m128i v_s1 = zero;
+                __m128i v_s1_before = zero;
+                __m128i v_s2 = zero;
+                unsigned long i = 0;
+                for(; i + 16 <= in_len; i += 16) {
+                        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in_buf + i));
+                        v_s1_before = _mm_add_epi32(v_s1_before, v_s1);
+                        v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(v, zero));
+                        v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(v, weights), ones));
+                }
+                uint32_t lanes[4];
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), v_s1);
+                uint32_t s1 = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), v_s1_before);
+                uint32_t s2 = 16 * (lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), v_s2);
+                s2 += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+                for(; i < in_len; i++) {
+                        s1 += in_buf[i];
+                        s2 += s1;
+                }
+                return (static_cast<WeakChecksum>(s2 & 0xffff) << 16) | (s1 & 0xffff);
+        }
+
+
+        __attribute__((target("avx2")))
+        WeakChecksum weak_checksum_avx2(const unsigned char *in_buf, unsigned long in_len)
+        {
+                const __m256i zero = _mm256_setzero_si256();
+                const __m256i ones = _mm256_set1_epi16(1);
+                const __m256i weights = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25,
+                                                         24, 23, 22, 21, 20, 19, 18, 17,
+                                                         16, 15, 14, 13, 12, 11, 10, 9,
+                                                         8, 7, 6, 5, 4, 3, 2, 1);
+                __m256i v_s1 = zero;
+                __m256i v_s1_before = zero;
+                __m256i v_s2 = zero;
+                unsigned long i = 0;
+                for(; i + 32 <= in_len; i += 32) {
+                        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in_buf + i));
+                        v_s1_before = _mm256_add_epi32(v_s1_before, v_s1);
+                        v_s1 = _mm256_add_epi32(v_s1, _mm256_sad_epu8(v, zero));
+                        v_s2 = _mm256_add_epi32(v_s2,
+                                                _mm256_madd_epi16(_mm256_maddubs_epi16(v, weights), ones));
+                }
+                uint32_t lanes[8];
+                uint32_t s1 = 0;
+                uint32_t s2 = 0;
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), v_s1);
+                for(int j = 0; j < 8; j++)
+                        s1 += lanes[j];
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), v_s1_before);
+                for(int j = 0; j < 8; j++)
+                        s2 += 32 * lanes[j];
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), v_s2);
+                for(int j = 0; j < 8; j++)
+                        s2 += lanes[j];
+                for(; i < in_len; i++) {
+                        s1 += in_buf[i];
+                        s2 += s1;
+                }
+                return (static_cast<WeakChecksum>(s2 & 0xffff) << 16) | (s1 & 0xffff);
+        }
+#endif  /* CRYPTAR_X86_KERNELS */
+
+
+        /*
+          Pick the best kernel this CPU supports.
+        */
+        WeakChecksumKernel select_kernel(const char *&out_name)
+        {
+#if CRYPTAR_X86_KERNELS
+                __builtin_cpu_init();
+                if(__builtin_cpu_supports("avx2")) {
+                        out_name = "avx2";
+                        return weak_checksum_avx2;
+                }
+                if(__builtin_cpu_supports("sse4.1")) {
+                        out_name = "sse4.1";
+                        return weak_checksum_sse4;
+                }
+#endif
+                out_name = "scalar";
+                return weak_checksum_scalar;
+        }
+
+        WeakChecksumKernel active_kernel(const char **out_name = 0)
+        {
+                static const char *name = 0;
+                static const WeakChecksumKernel kernel = select_kernel(name);
+                if(out_name)
+                        *out_name = name;
+                return kernel;
+        }
+}
+
+
+
+/*
+  Compute the weak checksum of in_len bytes from scratch.
+*/
+WeakChecksum cryptar::weak_checksum(const char *in_buf, unsigned long in_len)
+{
+        return active_kernel()(reinterpret_cast<const unsigned char *>(in_buf), in_len);
+}
+
+
+
+/*
+  Name the weak checksum kernel chosen for this CPU.
+*/
+const char *cryptar::weak_checksum_kernel()
+{
+        const char *name;
+        active_kernel(&name);
+        return name;
+}
+
+
+
+const size_t MatchChecksum::length;
+
+
+
+/*
+  Compute the strong checksum of in_len bytes.  Currently SHA-256.
+*/
+StrongChecksum cryptar::strong_checksum(const char *in_buf, unsigned long in_len)
+{
+        return sha256(in_buf, in_len);
+}
+
+
+
+/*
+  The signature builders make many small blocks at once, which is
+  where hashing them side by side pays.
+*/
+void cryptar::strong_checksums(const char *in_buf,
+                               vector<BlockSignature> &io_signatures,
+                               size_t in_first)
+{
+        if(in_first >= io_signatures.size())
+                return;
+        const size_t count = io_signatures.size() - in_first;
+        vector<const char *> bufs(count);
+        vector<size_t> lens(count);
+        for(size_t i = 0; i < count; i++) {
+                bufs[i] = in_buf + io_signatures[in_first + i].m_offset;
+                lens[i] = io_signatures[in_first + i].m_length;
+        }
+        vector<Digest> digests(count);
+        sha256_batch(bufs.data(), lens.data(), count, digests.data());
+        for(size_t i = 0; i < count; i++)
+                io_signatures[in_first + i].m_strong = digests[i];
+}
+
+
+
+
+/*
+  The keyed hash.
+
+  Two 64 bit lanes, each folding in 16 bytes per step with a 64x64 to
+  128 bit multiply whose halves are xor'd together (as in wyhash).
+  The key enters every multiply, so the input alone can't zero a
+  multiplicand.  The length and the tail are folded in last, and the
+  two lanes are crossed to give 128 bits.
+*/
+namespace {
+
+        const uint64_t p0 = 0xa0761d6478bd642fULL;
+        const uint64_t p1 = 0xe7037ed1a0b428dbULL;
+        const uint64_t p2 = 0x8ebc6af09c88c6e3ULL;
+        const uint64_t p3 = 0x589965cc75374cc3ULL;
+
+        inline uint64_t mum(uint64_t in_a, uint64_t in_b)
+        {
+                __uint128_t r = static_cast<__uint128_t>(in_a) * in_b;
+                return static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64);
+        }
+
+        inline uint64_t read64(const char *in_p)
+        {
+                uint64_t v;
+                memcpy(&v, in_p, sizeof(v));
+                return v;
+        }
+}
+
+
+
+MatchChecksum cryptar::keyed_hash(const char *in_buf, unsigned long in_len, const string &in_key)
+{
+        assert(keyed_hash_key_length == in_key.size());
+        const uint64_t k0 = read64(in_key.data());
+        const uint64_t k1 = read64(in_key.data() + 8);
+        uint64_t s1 = k0 ^ p0;
+        uint64_t s2 = k1 ^ p1;
+        unsigned long i = 0;
+        for(; i + 32 <= in_len; i += 32) {
+                s1 = mum(read64(in_buf + i) ^ k0, read64(in_buf + i + 8) ^ s1 ^ p2);
+                s2 = mum(read64(in_buf + i + 16) ^ k1, read64(in_buf + i + 24) ^ s2 ^ p3);
+        }
+        char tail[32] = { 0 };
+        memcpy(tail, in_buf + i, in_len - i);
+        s1 = mum(read64(tail) ^ k0, read64(tail + 8) ^ s1 ^ p2);
+        s2 = mum(read64(tail + 16) ^ k1, read64(tail + 24) ^ s2 ^ p3);
+
+        const uint64_t lo = mum(s1 ^ p0 ^ k1, s2 ^ in_len ^ p1);
+        const uint64_t hi = mum(s2 ^ p2 ^ k0, lo ^ s1 ^ p3);
+        char out[16];
+        memcpy(out, &lo, 8);
+        memcpy(out + 8, &hi, 8);
+        return MatchChecksum(out);
+}
+
+
+
+/*
+  Compute the signature of a buffer: the (offset, length, weak,
+  strong) tuple of each successive window.  The last window may be
+  short.
+
+  This is how we describe new content that matched nothing, so it is
+  what CoverBlock persists for each new DataBlock.
+*/
+void cryptar::block_signatures(const char *in_buf,
+                               unsigned long in_len,
+                               unsigned long in_window,
+                               vector<BlockSignature> &out_signatures)
+{
+        const WeakChecksumKernel kernel = active_kernel();
+        const size_t first = out_signatures.size();
+        out_signatures.reserve(first + (in_len + in_window - 1) / in_window);
+        for(unsigned long offset = 0; offset < in_len; offset += in_window) {
+                const unsigned long length = min(in_window, in_len - offset);
+                out_signatures.push_back(BlockSignature(offset,
+                                                        length,
+                                                        kernel(reinterpret_cast<const unsigned char *>(in_buf + offset),
+                                                               length),
+                                                        StrongChecksum()));
+        }
+        strong_checksums(in_buf, out_signatures, first);
+}
@@ -0,0 +1,202 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef __CHECKSUM_H__
+#define __CHECKSUM_H__ 1
+
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "digest.h"
+
+
+namespace cryptar {
+
+        /*
+          Weak (rolling) and strong checksums for the cryptar
+          algorithm.  Cf. CoverBlock in block.h.
+
+          The weak checksum is the one from Tridgell's PhD thesis
+          (also rsync's), computed a byte at a time: s1 is the sum of
+          the bytes in the window, s2 the sum of the running values of
+          s1, each modulo 2^16.  The checksum is (s2 << 16) | s1.
+
+          Unlike version-1's WCsum, which rolled by 32 bit words and
+          so had to scan a file four times (once per alignment), this
+          rolls by one byte and so scans once.
+        */
+        typedef unsigned long WeakChecksum;
+        typedef Digest StrongChecksum;
+
+        // Compute the weak checksum of in_len bytes from scratch.
+        // Uses SIMD where the CPU has it, cf. weak_checksum_kernel().
+        WeakChecksum weak_checksum(const char *in_buf, unsigned long in_len);
+        const char *weak_checksum_kernel();
+
+        // Compute the strong checksum of in_len bytes.
+        StrongChecksum strong_checksum(const char *in_buf, unsigned long in_len);
+
+        /*
+          A fast 128 bit keyed hash, for confirming weak checksum
+          hits.  It is not cryptographic, but without the key one
+          can't easily predict its value or aim content at a
+          collision.  The key is keyed_hash_key_length bytes.
+        */
+        const unsigned int keyed_hash_key_length = 16;
+        class MatchChecksum;
+        MatchChecksum keyed_hash(const char *in_buf, unsigned long in_len, const std::string &in_key);
+
+
+        /*
+          The 16 bytes by which we confirm a match (cf.
+          CoverParams::match_checksum()): a keyed_hash(), or the first
+          half of a strong checksum.  Like Digest, just the bytes.
+        */
+        class MatchChecksum {
+        public:
+                static const size_t length = 16;
+
+                MatchChecksum() { std::memset(m_bytes, 0, length); }
+                // The first length bytes at in_bytes.
+                explicit MatchChecksum(const char *in_bytes) { std::memcpy(m_bytes, in_bytes, length); }
+                explicit MatchChecksum(const Digest &in_digest) { std::memcpy(m_bytes, in_digest.data(), length); }
+
+                bool operator==(const MatchChecksum &in_match) const
+                { return 0 == std::memcmp(m_bytes, in_match.m_bytes, length); }
+                bool operator!=(const MatchChecksum &in_match) const
+                { return !operator==(in_match); }
+
+                const char *data() const { return reinterpret_cast<const char *>(m_bytes); }
+
+        private:
+                unsigned char m_bytes[length];
+
+                friend class boost::serialization::access;
+                template<class Archive>
+                        void serialize(Archive &in_ar, const unsigned int in_version) {
+                        in_ar & boost::serialization::make_binary_object(m_bytes, length);
+                }
+        };
+
+
+        /*
+          What we know about one block of content.
+        */
+        struct BlockSignature {
+                BlockSignature(unsigned long in_offset,
+                               unsigned long in_length,
+                               WeakChecksum in_weak,
+                               const StrongChecksum &in_strong)
+                        : m_offset(in_offset), m_length(in_length),
+                          m_weak(in_weak), m_strong(in_strong) {};
+
+                unsigned long m_offset;
+                unsigned long m_length;
+                WeakChecksum m_weak;
+                StrongChecksum m_strong;
+        };
+
+        // Fill in m_strong for the signatures from in_first on, whose
+        // offsets are into in_buf, hashing them all at once (cf.
+        // sha256_batch()).
+        void strong_checksums(const char *in_buf,
+                              std::vector<BlockSignature> &io_signatures,
+                              size_t in_first = 0);
+
+        // Signatures of successive in_window byte blocks (the last may be short).
+        void block_signatures(const char *in_buf,
+                              unsigned long in_len,
+                              unsigned long in_window,
+                              std::vector<BlockSignature> &out_signatures);
+
+        
+        /*
+          A weak checksum over a window of fixed length that slides
+          along a buffer one byte at a time.
+        */
+        class RollingChecksum {
+        public:
+                RollingChecksum(unsigned long in_window)
+                        : m_window(in_window), m_s1(0), m_s2(0) {};
+
+                // Start over on the window beginning at in_buf.
+                void init(const char *in_buf)
+                {
+                        WeakChecksum sum = weak_checksum(in_buf, m_window);
+                        m_s1 = sum & m16;
+                        m_s2 = sum >> 16;
+                }
+
+                /*
+                  Slide the window one byte: in_out leaves at the
+                  left, in_in enters at the right.  The arithmetic is
+                  unsigned, so wrapping below zero is harmless once
+                  we mask.
+                */
+                void roll(unsigned char in_out, unsigned char in_in)
+                {
+                        m_s1 = (m_s1 - in_out + in_in) & m16;
+                        m_s2 = (m_s2 - m_window * in_out + m_s1) & m16;
+                }
+
+                WeakChecksum value() const { return (m_s2 << 16) | m_s1; }
+                unsigned long window() const { return m_window; }
+
+        private:
+                static const WeakChecksum m16 = 0xffff;
+
+                const unsigned long m_window;
+                WeakChecksum m_s1;
+                WeakChecksum m_s2;
+        };
+
+
+        /*
+          Call in_func(offset, weak_checksum) for every window of
+          in_window bytes in the buffer, in a single pass.  in_func
+          returns the number of bytes to advance: 1 to keep rolling,
+          or more to skip ahead (say, past a matched block), in which
+          case we start the checksum over at the new offset.
+        */
+        template<typename Func>
+        void for_each_weak_checksum(const char *in_buf,
+                                    unsigned long in_len,
+                                    unsigned long in_window,
+                                    Func in_func)
+        {
+                RollingChecksum sum(in_window);
+                bool fresh = true;
+                unsigned long offset = 0;
+                while(offset + in_window <= in_len) {
+                        if(fresh)
+                                sum.init(in_buf + offset);
+                        unsigned long step = in_func(offset, sum.value());
+                        fresh = (1 != step);
+                        if(!fresh && offset + in_window < in_len)
+                                sum.roll(in_buf[offset], in_buf[offset + in_window]);
+                        offset += step;
+                }
+        }
+}
+
+#endif  /* __CHECKSUM_H__*/
@@ -0,0 +1,210 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "checksum.h"
+
+
+using namespace cryptar;
+using namespace std;
+
+
+/*
+  Compare the single-pass, byte-granular rolling checksum with
+  version-1's four-pass, word-aligned WCsum on the same input.
+
+  The input is in memory, so this measures arithmetic and memory
+  bandwidth only.  On disk, version-1 also read the file four times.
+*/
+
+
+namespace {
+
+        const unsigned long window = 512;
+        const unsigned long buffer_size = 64 * 1024 * 1024;
+
+        
+        /*
+          Version-1's WCsum_get() and WCsum_update() (checksum.c),
+          which sum 32 bit words rather than bytes.
+        */
+        inline WeakChecksum char4_to_int32(const signed char *b)
+        {
+                return (b[0] << 24) + (b[1] << 16) + (b[2] << 8) + (b[3]);
+        }
+
+        WeakChecksum v1_wcsum_get(const signed char *buf, unsigned long len)
+        {
+                unsigned int s1 = 0, s2 = 0;
+                unsigned int len4 = len >> 2;
+                for(unsigned long i = 0; i < len; i += 4) {
+                        unsigned int s = char4_to_int32(&buf[i]);
+                        s1 += s;
+                        s2 += (len4 - (i >> 2)) * s;
+                }
+                s2 = (s2 & 0xffff);
+                return (s2 << 16) + (s1 & 0xffff);
+        }
+
+        WeakChecksum v1_wcsum_update(const signed char *old4,
+                                     const signed char *new4,
+                                     unsigned int old_sum,
+                                     unsigned int len)
+        {
+                unsigned int s_old = char4_to_int32(old4);
+                unsigned int s_new = char4_to_int32(new4);
+                unsigned int s1 = (old_sum & 0xffff) - s_old + s_new;
+                unsigned int s2 = ((old_sum >> 16) & 0xffff);
+                s2 = ((s2 - (len >> 2) * s_old) & 0xffff) + s1;
+                s2 = (s2 & 0xffff);
+                return (s2 << 16) + (s1 & 0xffff);
+        }
+
+
+        /*
+          Version-1's WCsum_make_hash(): one pass per alignment.
+          Return the number of checksums produced, folding them into
+          io_sink so the compiler can't discard the work.
+        */
+        unsigned long four_pass(const string &in_buf, unsigned long &out_bytes_read,
+                                WeakChecksum &io_sink)
+        {
+                const signed char *buf = reinterpret_cast<const signed char *>(in_buf.data());
+                const unsigned long len = in_buf.size();
+                unsigned long count = 0;
+                out_bytes_read = 0;
+                for(unsigned long init_offset = 0; init_offset < 4; init_offset++) {
+                        WeakChecksum csum = v1_wcsum_get(buf + init_offset, window);
+                        unsigned long offset = init_offset;
+                        while(true) {
+                                io_sink ^= csum + offset;
+                                count++;
+                                if(offset + 4 + window > len)
+                                        break;
+                                csum = v1_wcsum_update(buf + offset, buf + offset + window,
+                                                       csum, window);
+                                offset += 4;
+                        }
+                        out_bytes_read += len - init_offset;
+                }
+                return count;
+        }
+
+
+        /*
+          The new scheme: every offset, one pass.
+        */
+        unsigned long single_pass(const string &in_buf, unsigned long &out_bytes_read,
+                                  WeakChecksum &io_sink)
+        {
+                unsigned long count = 0;
+                for_each_weak_checksum(in_buf.data(), in_buf.size(), window,
+                                       [&](unsigned long in_offset, WeakChecksum in_weak) -> unsigned long {
+                        io_sink ^= in_weak + in_offset;
+                        count++;
+                        return 1;
+                });
+                out_bytes_read = in_buf.size();
+                return count;
+        }
+
+
+        /*
+          Weak checksums of successive windows, as when building a
+          signature: first a byte at a time, then with whatever SIMD
+          kernel weak_checksum() selected.
+        */
+        unsigned long blocks_scalar(const string &in_buf, unsigned long &out_bytes_read,
+                                    WeakChecksum &io_sink)
+        {
+                const unsigned char *buf = reinterpret_cast<const unsigned char *>(in_buf.data());
+                unsigned long count = 0;
+                for(unsigned long offset = 0; offset + window <= in_buf.size(); offset += window) {
+                        WeakChecksum s1 = 0, s2 = 0;
+                        for(unsigned long i = offset; i < offset + window; i++) {
+                                s1 += buf[i];
+                                s2 += s1;
+                        }
+                        io_sink ^= ((s2 & 0xffff) << 16) | (s1 & 0xffff);
+                        count++;
+                }
+                out_bytes_read = in_buf.size();
+                return count;
+        }
+
+        unsigned long blocks_kernel(const string &in_buf, unsigned long &out_bytes_read,
+                                    WeakChecksum &io_sink)
+        {
+                unsigned long count = 0;
+                for(unsigned long offset = 0; offset + window <= in_buf.size(); offset += window) {
+                        io_sink ^= weak_checksum(in_buf.data() + offset, window);
+                        count++;
+                }
+                out_bytes_read = in_buf.size();
+                return count;
+        }
+
+
+        void report(const string &in_name,
+                    unsigned long (*in_func)(const string &, unsigned long &, WeakChecksum &),
+                    const string &in_buf)
+        {
+                unsigned long bytes_read = 0;
+                WeakChecksum sink = 0;
+                auto start = chrono::steady_clock::now();
+                unsigned long count = in_func(in_buf, bytes_read, sink);
+                auto end = chrono::steady_clock::now();
+                double seconds = chrono::duration<double>(end - start).count();
+                double mb = static_cast<double>(in_buf.size()) / (1024 * 1024);
+                cout << setw(24) << left << in_name
+                     << setw(8) << right << fixed << setprecision(1) << mb / seconds << " MB/s  "
+                     << setw(6) << bytes_read / (1024 * 1024) << " MB read  "
+                     << setw(10) << count << " checksums  "
+                     << "(" << hex << sink << dec << ")"
+                     << endl;
+        }
+}
+
+
+int main(int argc, char *argv[])
+{
+        string buf(buffer_size, '\0');
+        srand(1);
+        for(unsigned long i = 0; i < buf.size(); i++)
+                buf[i] = rand();
+
+        cout << "Rolling weak checksum, " << window << " byte window, "
+             << buffer_size / (1024 * 1024) << " MB input" << endl;
+        report("four-pass word WCsum", four_pass, buf);
+        report("single-pass byte roll", single_pass, buf);
+
+        cout << endl << "Block weak checksums (signature), kernel "
+             << weak_checksum_kernel() << endl;
+        report("scalar", blocks_scalar, buf);
+        report(weak_checksum_kernel(), blocks_kernel, buf);
+        return 0;
+}
@@ -0,0 +1,115 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <cassert>
+#include <vector>
+
+#include "checksum_index.h"
+
+
+using namespace cryptar;
+using namespace std;
+
+
+/*
+  Keep the table at most half full, so that probe sequences stay
+  short even when misses dominate.
+*/
+namespace {
+        const unsigned long min_capacity = 16;
+
+        unsigned long capacity_for(unsigned long in_expected)
+        {
+                unsigned long capacity = min_capacity;
+                while(capacity < 2 * in_expected)
+                        capacity <<= 1;
+                return capacity;
+        }
+}
+
+
+ChecksumIndex::ChecksumIndex(unsigned long in_expected)
+        : m_mask(0), m_shift(32), m_size(0)
+{
+        if(in_expected)
+                resize(capacity_for(in_expected));
+}
+
+
+void ChecksumIndex::clear()
+{
+        m_slots.clear();
+        m_mask = 0;
+        m_shift = 32;
+        m_size = 0;
+}
+
+
+/*
+  Make room for in_expected entries without further rehashing.
+*/
+void ChecksumIndex::reserve(unsigned long in_expected)
+{
+        const unsigned long capacity = capacity_for(in_expected);
+        if(capacity > m_slots.size())
+                resize(capacity);
+}
+
+
+void ChecksumIndex::insert(WeakChecksum in_weak, unsigned long in_block)
+{
+        assert(in_block < empty_block);
+        if(2 * (m_size + 1) > m_slots.size())
+                resize(capacity_for(m_size + 1));
+        const uint32_t weak = static_cast<uint32_t>(in_weak);
+        unsigned long i = slot_of(weak);
+        while(empty_block != m_slots[i].m_block)
+                i = (i + 1) & m_mask;
+        m_slots[i].m_weak = weak;
+        m_slots[i].m_block = static_cast<uint32_t>(in_block);
+        m_size++;
+}
+
+
+bool ChecksumIndex::contains(WeakChecksum in_weak) const
+{
+        return find(in_weak, [](unsigned long) { return true; });
+}
+
+
+/*
+  Rehash into a table of in_capacity slots (a power of two).
+*/
+void ChecksumIndex::resize(unsigned long in_capacity)
+{
+        vector<Slot> old_slots;
+        old_slots.swap(m_slots);
+        Slot empty = { 0, empty_block };
+        m_slots.assign(in_capacity, empty);
+        m_mask = in_capacity - 1;
+        m_shift = 32;
+        for(unsigned long c = in_capacity; c > 1; c >>= 1)
+                m_shift--;
+        m_size = 0;
+        for(auto it = old_slots.begin(); it != old_slots.end(); ++it)
+                if(empty_block != it->m_block)
+                        insert(it->m_weak, it->m_block);
+}
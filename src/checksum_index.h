@@ -0,0 +1,106 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+#ifndef __CHECKSUM_INDEX_H__
+#define __CHECKSUM_INDEX_H__ 1
+
+
+#include <stdint.h>
+#include <vector>
+
+#include "checksum.h"
+
+
+namespace cryptar {
+
+        /*
+          Map weak checksums to the blocks that have them, for the
+          rolling scan in CoverBlock.
+
+          The scan probes at every byte of the content and nearly
+          always misses, so the table is flat: one power-of-two sized
+          array of (weak, block) pairs with linear probing and no
+          pointers to chase.  A miss usually costs one cache line.
+
+          Several blocks may share a weak checksum; find() visits
+          them all.  There is no static state, so any number of
+          indices may exist at once, and concurrent find()'s on a
+          given index are safe as long as no one inserts.
+        */
+        class ChecksumIndex {
+        public:
+                // Size for in_expected entries up front, if known.
+                ChecksumIndex(unsigned long in_expected = 0);
+
+                void clear();
+                void reserve(unsigned long in_expected);
+                void insert(WeakChecksum in_weak, unsigned long in_block);
+
+                bool contains(WeakChecksum in_weak) const;
+
+                /*
+                  Call in_func(block) for each block with weak
+                  checksum in_weak until in_func returns true.
+                  Return true if it did.
+                */
+                template<typename Func>
+                bool find(WeakChecksum in_weak, Func in_func) const
+                {
+                        if(m_slots.empty())
+                                return false;
+                        const uint32_t weak = static_cast<uint32_t>(in_weak);
+                        for(unsigned long i = slot_of(weak); ; i = (i + 1) & m_mask) {
+                                const Slot &slot = m_slots[i];
+                                if(empty_block == slot.m_block)
+                                        return false;
+                                if(weak == slot.m_weak && in_func(static_cast<unsigned long>(slot.m_block)))
+                                        return true;
+                        }
+                }
+
+                unsigned long size() const { return m_size; }
+                unsigned long capacity() const { return m_slots.size(); }
+                unsigned long memory_size() const { return m_slots.size() * sizeof(Slot); }
+
+        private:
+                struct Slot {
+                        uint32_t m_weak;
+                        uint32_t m_block;
+                };
+                static const uint32_t empty_block = 0xffffffff;
+
+                unsigned long slot_of(uint32_t in_weak) const
+                {
+                        // Fibonacci hashing: s1 sits in the low bits and
+                        // is poorly distributed, so mix before masking.
+                        return (in_weak * 0x9e3779b1U) >> m_shift;
+                }
+                void resize(unsigned long in_capacity);
+
+                std::vector<Slot> m_slots;
+                unsigned long m_mask;
+                unsigned int m_shift;
+                unsigned long m_size;
+        };
+}
+
+#endif  /* __CHECKSUM_INDEX_H__*/
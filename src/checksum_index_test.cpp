@@ -0,0 +1,108 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE tests
+#include <boost/test/unit_test.hpp>
+#include <cstdlib>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "cryptar.h"
+
+
+using namespace cryptar;
+using namespace std;
+
+
+namespace {
+
+        /*
+          Every inserted (weak, block) pair can be found again, and
+          weak checksums we didn't insert are not found.
+        */
+        void test_find(unsigned long in_expected, unsigned long in_count)
+        {
+                ChecksumIndex index(in_expected);
+                multimap<WeakChecksum, unsigned long> reference;
+                srand(in_count);
+                for(unsigned long i = 0; i < in_count; i++) {
+                        // Force some collisions on the weak checksum.
+                        WeakChecksum weak = (i % 7) ? (rand() & 0xffffffff) : 42;
+                        index.insert(weak, i);
+                        reference.insert(make_pair(weak, i));
+                }
+                BOOST_CHECK_EQUAL(index.size(), in_count);
+                BOOST_CHECK(index.capacity() >= 2 * in_count);
+                BOOST_CHECK_EQUAL(index.capacity() & (index.capacity() - 1), 0UL);
+
+                for(auto it = reference.begin(); it != reference.end(); ++it) {
+                        set<unsigned long> found;
+                        index.find(it->first, [&](unsigned long in_block) -> bool {
+                                found.insert(in_block);
+                                return false;
+                        });
+                        BOOST_CHECK_EQUAL(found.size(), reference.count(it->first));
+                        BOOST_CHECK(found.count(it->second));
+                        BOOST_CHECK(index.contains(it->first));
+                }
+
+                unsigned long false_hits = 0;
+                for(WeakChecksum weak = 0x10000; weak < 0x20000; weak++)
+                        if(!reference.count(weak) && index.contains(weak))
+                                false_hits++;
+                BOOST_CHECK_EQUAL(false_hits, 0UL);
+        }
+
+
+        /*
+          find() stops as soon as the callback accepts a block.
+        */
+        void test_stop()
+        {
+                ChecksumIndex index;
+                for(unsigned long i = 0; i < 10; i++)
+                        index.insert(7, i);
+                unsigned long visited = 0;
+                BOOST_CHECK(index.find(7, [&](unsigned long) -> bool { return ++visited == 3; }));
+                BOOST_CHECK_EQUAL(visited, 3UL);
+                BOOST_CHECK(!index.find(8, [](unsigned long) -> bool { return true; }));
+
+                index.clear();
+                BOOST_CHECK_EQUAL(index.size(), 0UL);
+                BOOST_CHECK(!index.contains(7));
+        }
+}
+
+
+BOOST_AUTO_TEST_CASE(insert_find)
+{
+        test_find(0, 0);
+        test_find(0, 1000);
+        test_find(1000, 1000);
+        test_find(10, 100000);
+}
+
+BOOST_AUTO_TEST_CASE(find_stop)
+{
+        test_stop();
+}
@@ -0,0 +1,200 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE tests
+#include <boost/test/unit_test.hpp>
+#include <string>
+#include <vector>
+
+#include "cryptar.h"
+
+
+using namespace cryptar;
+using namespace std;
+
+
+namespace {
+
+        /*
+          Check the weak checksum against a value computed by hand.
+        */
+        void test_known_value()
+        {
+                // s1 = 97 + 98 + 99 = 294, s2 = 97 + 195 + 294 = 586
+                BOOST_CHECK_EQUAL(weak_checksum("abc", 3), (586UL << 16) | 294UL);
+                BOOST_CHECK_EQUAL(weak_checksum("", 0), 0UL);
+        }
+
+
+        /*
+          Whatever kernel this CPU selected (cf. weak_checksum_kernel())
+          should agree with the plain byte-at-a-time definition, at
+          every length and alignment.
+        */
+        void test_kernel()
+        {
+                cout << "weak checksum kernel: " << weak_checksum_kernel() << endl;
+                const string buf(pseudo_random_string(1100));
+                for(unsigned long start = 0; start < 40; start += 3)
+                        for(unsigned long len = 0; start + len <= buf.size(); len += 7) {
+                                const unsigned char *p
+                                        = reinterpret_cast<const unsigned char *>(buf.data() + start);
+                                WeakChecksum s1 = 0, s2 = 0;
+                                for(unsigned long i = 0; i < len; i++) {
+                                        s1 += p[i];
+                                        s2 += s1;
+                                }
+                                BOOST_CHECK_EQUAL(weak_checksum(buf.data() + start, len),
+                                                  ((s2 & 0xffff) << 16) | (s1 & 0xffff));
+                        }
+        }
+
+
+        /*
+          Signatures tile the buffer with windows, the last possibly short.
+        */
+        void test_signatures()
+        {
+                const unsigned long window = 512;
+                const string buf(pseudo_random_string(3 * window + 100));
+                vector<BlockSignature> sigs;
+                block_signatures(buf.data(), buf.size(), window, sigs);
+                BOOST_REQUIRE_EQUAL(sigs.size(), 4UL);
+                for(unsigned long i = 0; i < sigs.size(); i++) {
+                        BOOST_CHECK_EQUAL(sigs[i].m_offset, i * window);
+                        BOOST_CHECK_EQUAL(sigs[i].m_length, i < 3 ? window : 100UL);
+                        BOOST_CHECK_EQUAL(sigs[i].m_weak,
+                                          weak_checksum(buf.data() + sigs[i].m_offset, sigs[i].m_length));
+                        BOOST_CHECK(sigs[i].m_strong
+                                    == strong_checksum(buf.data() + sigs[i].m_offset, sigs[i].m_length));
+                }
+        }
+
+        
+        /*
+          Rolling the checksum a byte at a time should agree with
+          computing it from scratch at every offset.
+        */
+        void test_rolling(unsigned long in_window)
+        {
+                const string buf(pseudo_random_string(4000));
+                unsigned long num_checked = 0;
+                for_each_weak_checksum(buf.data(), buf.size(), in_window,
+                                       [&](unsigned long in_offset, WeakChecksum in_weak) -> unsigned long {
+                        BOOST_CHECK_EQUAL(in_weak, weak_checksum(buf.data() + in_offset, in_window));
+                        num_checked++;
+                        return 1;
+                });
+                BOOST_CHECK_EQUAL(num_checked, buf.size() - in_window + 1);
+        }
+
+
+        /*
+          Skipping ahead restarts the checksum at the new offset.
+        */
+        void test_skip()
+        {
+                const unsigned long window = 64;
+                const string buf(pseudo_random_string(1000));
+                vector<unsigned long> offsets;
+                for_each_weak_checksum(buf.data(), buf.size(), window,
+                                       [&](unsigned long in_offset, WeakChecksum in_weak) -> unsigned long {
+                        BOOST_CHECK_EQUAL(in_weak, weak_checksum(buf.data() + in_offset, window));
+                        offsets.push_back(in_offset);
+                        return (in_offset % 3) ? 1 : window;
+                });
+                BOOST_REQUIRE(offsets.size() > 2);
+                BOOST_CHECK_EQUAL(offsets[0], 0UL);
+                BOOST_CHECK_EQUAL(offsets[1], window);
+                BOOST_CHECK(offsets.back() + window <= buf.size());
+        }
+
+
+        /*
+          The keyed hash depends on the key, the bytes, and the
+          length, and nothing else.
+        */
+        void test_keyed_hash()
+        {
+                const string key(pseudo_random_string(keyed_hash_key_length));
+                const string other_key(pseudo_random_string(keyed_hash_key_length));
+                const string buf(pseudo_random_string(1000));
+                for(unsigned long len = 0; len < 100; len += 13) {
+                        const MatchChecksum hash = keyed_hash(buf.data(), len, key);
+                        BOOST_CHECK(hash == keyed_hash(buf.data(), len, key));
+                        BOOST_CHECK(hash != keyed_hash(buf.data(), len, other_key));
+                        BOOST_CHECK(hash != keyed_hash(buf.data(), len + 1, key));
+                        if(len)
+                                BOOST_CHECK(hash != keyed_hash(buf.data() + 1, len, key));
+                }
+
+                // A zero byte in the tail is not the same as no byte.
+                const string zeros(40, '\0');
+                for(unsigned long len = 0; len < zeros.size(); len++)
+                        BOOST_CHECK(keyed_hash(zeros.data(), len, key)
+                                    != keyed_hash(zeros.data(), len + 1, key));
+
+                // Flipping any one bit changes the hash.
+                string flipped(buf.substr(0, 200));
+                const MatchChecksum hash = keyed_hash(flipped.data(), flipped.size(), key);
+                for(unsigned long i = 0; i < flipped.size(); i += 7) {
+                        flipped[i] ^= 1;
+                        BOOST_CHECK(hash != keyed_hash(flipped.data(), flipped.size(), key));
+                        flipped[i] ^= 1;
+                }
+        }
+}
+
+
+BOOST_AUTO_TEST_CASE(known_value)
+{
+        test_known_value();
+}
+
+BOOST_AUTO_TEST_CASE(kernel)
+{
+        test_kernel();
+}
+
+BOOST_AUTO_TEST_CASE(signatures)
+{
+        test_signatures();
+}
+
+BOOST_AUTO_TEST_CASE(rolling)
+{
+        test_rolling(1);
+        test_rolling(4);
+        test_rolling(511);
+        test_rolling(512);
+        test_rolling(4000);
+}
+
+BOOST_AUTO_TEST_CASE(skip)
+{
+        test_skip();
+}
+
+BOOST_AUTO_TEST_CASE(keyed)
+{
+        test_keyed_hash();
+}
@@ -0,0 +1,204 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <stdint.h>
+#include <vector>
+
+#include "chunk.h"
+
+
+using namespace cryptar;
+using namespace std;
+
+
+/*
+  The gear hash rolls by shifting left one bit and adding a random
+  value for each byte, so bit k of the hash depends only on the last
+  k + 1 bytes.  We therefore test the high bits.
+
+  Normalized chunking (FastCDC): below the average size we require
+  two more zero bits than log2(average), above it two fewer.  That
+  pulls chunk sizes in towards the average.
+
+  The gear table must never change: it determines where chunks are
+  cut, and so whether a later backup finds the same chunks.  It is
+  generated from a fixed seed (splitmix64) rather than written out.
+*/
+namespace {
+
+        struct GearTable {
+                GearTable()
+                {
+                        uint64_t state = 0x6372797074617221ULL; // "cryptar!"
+                        for(int i = 0; i < 256; i++) {
+                                uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+                                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+                                z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+                                m_gear[i] = z ^ (z >> 31);
+                        }
+                }
+                uint64_t m_gear[256];
+        };
+
+        const uint64_t *gear()
+        {
+                static const GearTable table;
+                return table.m_gear;
+        }
+
+        unsigned int log2_floor(unsigned long in_n)
+        {
+                unsigned int bits = 0;
+                while(in_n >>= 1)
+                        bits++;
+                return bits;
+        }
+
+        uint64_t high_mask(unsigned int in_bits)
+        {
+                return in_bits ? ~0ULL << (64 - in_bits) : 0;
+        }
+}
+
+
+
+void CoverParams::validate() const
+{
+        if(match_sha256 != m_match_hash && match_keyed != m_match_hash)
+                throw(invalid_argument("CoverParams: unknown match hash"));
+        if(match_keyed == m_match_hash && keyed_hash_key_length != m_match_key.size())
+                throw(invalid_argument("CoverParams: bad match key"));
+        if(m_fanout < 4 || (m_fanout & (m_fanout - 1)))
+                throw(invalid_argument("CoverParams: fanout must be a power of two, at least 4"));
+        if(cover_fixed == m_mode) {
+                if(0 == m_window)
+                        throw(invalid_argument("CoverParams: zero window"));
+                if(m_adaptive && !(0 < m_min_window && m_min_window <= m_max_window))
+                        throw(invalid_argument("CoverParams: need 0 < min <= max window"));
+                return;
+        }
+        if(cover_cdc != m_mode)
+                throw(invalid_argument("CoverParams: unknown cover mode"));
+        if(!(0 < m_min_chunk && m_min_chunk < m_avg_chunk && m_avg_chunk < m_max_chunk))
+                throw(invalid_argument("CoverParams: need 0 < min < avg < max chunk size"));
+        if(m_avg_chunk & (m_avg_chunk - 1))
+                throw(invalid_argument("CoverParams: average chunk size must be a power of two"));
+        if(log2_floor(m_avg_chunk) < 4)
+                throw(invalid_argument("CoverParams: average chunk size too small"));
+}
+
+
+
+
+MatchChecksum CoverParams::match_checksum(const char *in_buf, unsigned long in_len) const
+{
+        if(match_keyed == m_match_hash)
+                return keyed_hash(in_buf, in_len, m_match_key);
+        return MatchChecksum(strong_checksum(in_buf, in_len));
+}
+
+
+
+/*
+  Each block costs an entry in the covering, about
+  cover_entry_cost bytes once stored, and each run of changed bytes
+  costs about a block's worth of rewriting.  For k runs in n bytes
+  with block size b that is n h / b + k b, which is least at
+  b = sqrt(n h / k).  Before we know k, we use the plain sqrt(n).
+
+  We round down to a power of two so that small changes in size don't
+  change the window.
+*/
+namespace {
+        const unsigned long cover_entry_cost = 128;
+}
+
+
+unsigned long CoverParams::adaptive_window(unsigned long in_len, unsigned long in_changes) const
+{
+        double ideal = in_changes
+                ? sqrt(static_cast<double>(in_len) * cover_entry_cost / in_changes)
+                : sqrt(static_cast<double>(in_len));
+        unsigned long window = 1UL << log2_floor(max(1UL, static_cast<unsigned long>(ideal)));
+        return min(max(window, m_min_window), m_max_window);
+}
+
+
+
+/*
+  Return the length of the first content-defined chunk of the buffer.
+  Never less than m_min_chunk (unless the buffer is shorter) nor more
+  than m_max_chunk.
+*/
+unsigned long cryptar::cdc_chunk_length(const char *in_buf,
+                                        unsigned long in_len,
+                                        const CoverParams &in_params)
+{
+        if(in_len <= in_params.m_min_chunk)
+                return in_len;
+        const unsigned long len = min(in_len, in_params.m_max_chunk);
+        const unsigned long normal = min(len, in_params.m_avg_chunk);
+        const unsigned int bits = log2_floor(in_params.m_avg_chunk);
+        const uint64_t mask_small = high_mask(bits + 2);
+        const uint64_t mask_large = high_mask(bits - 2);
+        const uint64_t *g = gear();
+        const unsigned char *buf = reinterpret_cast<const unsigned char *>(in_buf);
+
+        uint64_t hash = 0;
+        unsigned long i = in_params.m_min_chunk;
+        for(; i < normal; i++) {
+                hash = (hash << 1) + g[buf[i]];
+                if(!(hash & mask_small))
+                        return i + 1;
+        }
+        for(; i < len; i++) {
+                hash = (hash << 1) + g[buf[i]];
+                if(!(hash & mask_large))
+                        return i + 1;
+        }
+        return len;
+}
+
+
+
+/*
+  Cut the buffer into content-defined chunks and compute the
+  signature of each.
+*/
+void cryptar::chunk_signatures(const char *in_buf,
+                               unsigned long in_len,
+                               const CoverParams &in_params,
+                               vector<BlockSignature> &out_signatures)
+{
+        const size_t first = out_signatures.size();
+        for(unsigned long offset = 0; offset < in_len; ) {
+                const unsigned long length = cdc_chunk_length(in_buf + offset, in_len - offset, in_params);
+                out_signatures.push_back(BlockSignature(offset,
+                                                        length,
+                                                        weak_checksum(in_buf + offset, length),
+                                                        StrongChecksum()));
+                offset += length;
+        }
+        strong_checksums(in_buf, out_signatures, first);
+}
@@ -0,0 +1,141 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+#ifndef __CHUNK_H__
+#define __CHUNK_H__ 1
+
+
+#include <boost/serialization/access.hpp>
+#include <boost/serialization/string.hpp>
+#include <string>
+#include <vector>
+
+#include "checksum.h"
+
+
+namespace cryptar {
+
+        /*
+          How CoverBlock cuts content into blocks.
+
+          cover_fixed is the classic rsync covering: blocks of
+          m_window bytes, found again after an insertion by rolling
+          the weak checksum across every byte offset.
+
+          cover_cdc is content-defined chunking (a gear hash in the
+          style of FastCDC): block boundaries are chosen by the bytes
+          themselves, so they move with the content after an
+          insertion and no rolling search is needed.  Chunks are
+          bigger and fewer, at some cost in dedupe granularity.
+        */
+        // Do not renumber members of this enum.  Values are persisted.
+        enum CoverMode {
+                cover_fixed = 0,
+                cover_cdc = 1,
+        };
+
+        /*
+          How CoverBlock confirms that a block whose weak checksum
+          hit really is the same block.
+
+          match_sha256 uses the strong checksum (SHA-256) itself.
+          match_keyed uses keyed_hash() (cf. checksum.h) with a key
+          chosen per store, which is much cheaper on content with many
+          weak hits.  Either way, each block's SHA-256 is kept, and
+          checked on restore.
+        */
+        // Do not renumber members of this enum.  Values are persisted.
+        enum MatchHash {
+                match_sha256 = 0,
+                match_keyed = 1,
+        };
+
+        struct CoverParams {
+                CoverParams()
+                        : m_mode(cover_fixed), m_window(512),
+                          m_min_chunk(2048), m_avg_chunk(8192), m_max_chunk(65536),
+                          m_match_hash(match_sha256),
+                          m_adaptive(false), m_min_window(512), m_max_window(1024 * 1024),
+                          m_fanout(1024) {};
+
+                CoverMode m_mode;
+                unsigned long m_window;      /* cover_fixed: block size */
+                unsigned long m_min_chunk;   /* cover_cdc: chunk size bounds */
+                unsigned long m_avg_chunk;   /*   (m_avg_chunk must be a power of two) */
+                unsigned long m_max_chunk;
+                MatchHash m_match_hash;
+                std::string m_match_key;     /* match_keyed: the key */
+
+                // cover_fixed: choose m_window per file, within these
+                // bounds (cf. adaptive_window()).  Once chosen, the
+                // window is persisted with the file's covering.
+                bool m_adaptive;
+                unsigned long m_min_window;
+                unsigned long m_max_window;
+
+                // The window to use for in_len bytes with in_changes
+                // runs of changed bytes since the last covering (0 if
+                // we don't know).
+                unsigned long adaptive_window(unsigned long in_len, unsigned long in_changes) const;
+
+                // A covering of more entries than this is stored as a
+                // tree with nodes of about this many entries.  A power
+                // of two.
+                unsigned long m_fanout;
+
+                // The checksum by which we confirm a match.
+                MatchChecksum match_checksum(const char *in_buf, unsigned long in_len) const;
+
+                // Throw std::invalid_argument if the parameters make no sense.
+                void validate() const;
+
+        private:
+                friend class boost::serialization::access;
+                template<class Archive>
+                        void serialize(Archive &in_ar, const unsigned int in_version) {
+                        in_ar & m_mode;
+                        in_ar & m_window;
+                        in_ar & m_min_chunk;
+                        in_ar & m_avg_chunk;
+                        in_ar & m_max_chunk;
+                        in_ar & m_match_hash;
+                        in_ar & m_match_key;
+                        in_ar & m_adaptive;
+                        in_ar & m_min_window;
+                        in_ar & m_max_window;
+                        in_ar & m_fanout;
+                }
+        };
+
+        // Return the length of the first content-defined chunk of the buffer.
+        unsigned long cdc_chunk_length(const char *in_buf,
+                                       unsigned long in_len,
+                                       const CoverParams &in_params);
+
+        // Signatures of the successive content-defined chunks of the buffer.
+        void chunk_signatures(const char *in_buf,
+                              unsigned long in_len,
+                              const CoverParams &in_params,
+                              std::vector<BlockSignature> &out_signatures);
+}
+
+#endif  /* __CHUNK_H__*/
@@ -0,0 +1,169 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE tests
+#include <boost/test/unit_test.hpp>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "cryptar.h"
+
+
+using namespace cryptar;
+using namespace std;
+
+
+namespace {
+
+        CoverParams cdc_params()
+        {
+                CoverParams params;
+                params.m_mode = cover_cdc;
+                params.m_min_chunk = 512;
+                params.m_avg_chunk = 2048;
+                params.m_max_chunk = 8192;
+                return params;
+        }
+
+        
+        /*
+          Chunks tile the buffer and respect the size bounds.
+        */
+        void test_bounds()
+        {
+                const CoverParams params = cdc_params();
+                const string buf(pseudo_random_string(200000));
+                vector<BlockSignature> sigs;
+                chunk_signatures(buf.data(), buf.size(), params, sigs);
+                BOOST_REQUIRE(!sigs.empty());
+                unsigned long offset = 0;
+                for(unsigned long i = 0; i < sigs.size(); i++) {
+                        BOOST_CHECK_EQUAL(sigs[i].m_offset, offset);
+                        BOOST_CHECK(sigs[i].m_length <= params.m_max_chunk);
+                        if(i + 1 < sigs.size())
+                                BOOST_CHECK(sigs[i].m_length > params.m_min_chunk);
+                        offset += sigs[i].m_length;
+                }
+                BOOST_CHECK_EQUAL(offset, buf.size());
+
+                // The average should be in the neighbourhood of m_avg_chunk.
+                const unsigned long average = buf.size() / sigs.size();
+                BOOST_CHECK(average > params.m_avg_chunk / 2);
+                BOOST_CHECK(average < 2 * params.m_avg_chunk);
+        }
+
+
+        /*
+          After an insertion near the front, chunk boundaries resync
+          and nearly all later chunks are unchanged.
+        */
+        void test_resync()
+        {
+                const CoverParams params = cdc_params();
+                const string buf(pseudo_random_string(200000));
+                string changed(buf);
+                changed.insert(1000, "a few new bytes");
+
+                vector<BlockSignature> before, after;
+                chunk_signatures(buf.data(), buf.size(), params, before);
+                chunk_signatures(changed.data(), changed.size(), params, after);
+                set<StrongChecksum> old_chunks;
+                for(auto it = before.begin(); it != before.end(); ++it)
+                        old_chunks.insert(it->m_strong);
+                unsigned long unchanged = 0;
+                for(auto it = after.begin(); it != after.end(); ++it)
+                        unchanged += old_chunks.count(it->m_strong);
+                BOOST_CHECK(unchanged + 3 >= after.size());
+        }
+
+
+        void test_validate()
+        {
+                CoverParams params = cdc_params();
+                params.validate();
+                params.m_avg_chunk = 3000;
+                BOOST_CHECK_THROW(params.validate(), invalid_argument);
+                params = cdc_params();
+                params.m_min_chunk = params.m_max_chunk;
+                BOOST_CHECK_THROW(params.validate(), invalid_argument);
+                params = CoverParams();
+                params.m_window = 0;
+                BOOST_CHECK_THROW(params.validate(), invalid_argument);
+
+                // Keyed matching needs a key of the right length.
+                params = CoverParams();
+                params.m_match_hash = match_keyed;
+                BOOST_CHECK_THROW(params.validate(), invalid_argument);
+                params.m_match_key = pseudo_random_string(keyed_hash_key_length);
+                params.validate();
+                BOOST_CHECK(params.match_checksum("abc", 3) == keyed_hash("abc", 3, params.m_match_key));
+                params.m_match_hash = match_sha256;
+                BOOST_CHECK(params.match_checksum("abc", 3) == MatchChecksum(strong_checksum("abc", 3)));
+
+                params = CoverParams();
+                params.m_adaptive = true;
+                params.m_min_window = 0;
+                BOOST_CHECK_THROW(params.validate(), invalid_argument);
+        }
+
+
+        /*
+          The adaptive window grows as the square root of the size,
+          shrinks as changes get more frequent, and stays in bounds.
+        */
+        void test_adaptive_window()
+        {
+                CoverParams params;
+                BOOST_CHECK_EQUAL(params.adaptive_window(0, 0), params.m_min_window);
+                BOOST_CHECK_EQUAL(params.adaptive_window(4096, 0), params.m_min_window);
+                BOOST_CHECK_EQUAL(params.adaptive_window(1UL << 24, 0), 4096UL);
+                BOOST_CHECK_EQUAL(params.adaptive_window(5000000, 0), 2048UL);
+                BOOST_CHECK_EQUAL(params.adaptive_window(50UL << 30, 0), 131072UL);
+                BOOST_CHECK_EQUAL(params.adaptive_window(1UL << 40, 0), params.m_max_window);
+                BOOST_CHECK(params.adaptive_window(1UL << 30, 1)
+                            > params.adaptive_window(1UL << 30, 1000));
+                BOOST_CHECK_EQUAL(params.adaptive_window(1UL << 30, 1UL << 30), params.m_min_window);
+        }
+}
+
+
+BOOST_AUTO_TEST_CASE(bounds)
+{
+        test_bounds();
+}
+
+BOOST_AUTO_TEST_CASE(resync)
+{
+        test_resync();
+}
+
+BOOST_AUTO_TEST_CASE(validate)
+{
+        test_validate();
+}
+
+BOOST_AUTO_TEST_CASE(adaptive)
+{
+        test_adaptive_window();
+}
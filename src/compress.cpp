@@ -18,12 +18,27 @@
 */
 
 
+#include <algorithm>
+#include <atomic>
+#include <boost/thread.hpp>
 #include <bzlib.h>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <functional>
 #include <iostream>
+#include <lz4.h>
+#include <lz4frame.h>
+#include <lz4hc.h>
 #include <stdexcept>
 #include <string>
+#include <zdict.h>
+#include <zstd.h>
 
 #include "compress.h"
+#include "local_file.h"
 #include "mode.h"
 
 
@@ -35,134 +50,1663 @@ using namespace std;
   The bzip2 package is documented at
 
   http://www.bzip.org/1.0.3/html/index.html
+
+  zstd at http://facebook.github.io/zstd/zstd_manual.html, and the lz4
+  frame format (which we use, rather than bare lz4 blocks) in
+  lz4frame.h.
 */
 
 
 /*
-  Compress a string.
+  A compressed payload is a frame: a header, then the codec's stream.
+
+      byte 0    frame_tag
+      byte 1    the Codec, with dictionary_flag if a dictionary id
+                follows the length
+      byte 2..  the length of the text, 7 bits a byte, low bits
+                first, the high bit set on all but the last byte
+                then the dictionary id, if any, the same way
+
+  If we don't know the length when we start (CompressSink without
+  expect()), the header is codec_tag and the Codec, with no length.
+
+  Long texts (cf. CompressParams::m_frame_size) are a container of
+  frames instead, each compressed on its own:
+
+      byte 0    container_tag
+      byte 1    the Codec
+      byte 2..  the length of the text
+                then the length of each frame's text (all but the
+                last are this long)
+                then each frame: the length of the compressed frame,
+                then the codec's stream for its text
+                then the index: the length of each compressed frame
+                again, one number for each frame
+                then the footer: the length of the index, in
+                footer_length bytes, low byte first
+
+  So the writer writes each frame as soon as it is compressed, a
+  reader of the stream finds each frame from the length before it,
+  and a reader of the whole finds any frame from the index, which
+  the footer finds from the end.
+
+  The oldest payloads have no header at all.  They are bare bzip2
+  streams, which always start "BZh", so never with any tag.
 */
-string cryptar::compress(const string &in_buf)
-{
-        // As documented at http://www.bzip.org/1.0.3/html/util-fns.html
-        unsigned int output_max_size = static_cast<double>(in_buf.size()) * 1.06 + 600.5;
-        char out_buf_raw[output_max_size];
-
-        // For argument definitions, cf.
-        //   http://www.bzip.org/1.0.3/html/util-fns.html#bzbufftobuffdecompress
-        // and also
-        //   http://www.bzip.org/1.0.3/html/low-level.html#bzcompress-init
-        //
-        // Source string is not changed, one understands, but the C origin means
-        // a char * rather than a const char *.  So const_cast.
-        int ret = BZ2_bzBuffToBuffCompress(out_buf_raw,
-                                           &output_max_size,
-                                           const_cast<char *>(in_buf.c_str()),
-                                           in_buf.size(),
-                                           1, // blockSize100k, in the range 1..9
-                                           (const bool)mode(Verbose),
-                                           0  // workFactor
-                                           );
-        string the_error;
-        switch(ret) {
-        case BZ_CONFIG_ERROR:
-                the_error = "The bzip2 library has been mis-compiled.";
-                cerr << the_error << endl;
-                throw(runtime_error(the_error));
-        case BZ_PARAM_ERROR:
-                the_error = "Parameter error in BZ2_bzBuffToBuffCompress";
-                cerr << the_error << endl;
-                cerr << "Cf. http://www.bzip.org/1.0.3/html/util-fns.html#bzbufftobuffcompress"
-                     << endl;
-                throw(invalid_argument(the_error));
-        case BZ_MEM_ERROR:
-                the_error = "Insufficient memory available for compression";
+namespace {
+
+        const char codec_tag = '\xcc';
+        const char frame_tag = '\xcd';
+        const char container_tag = '\xce';
+        const unsigned char dictionary_flag = 0x80;
+        const size_t max_number_bytes = 10;
+        const size_t max_header_length = 2 + 2 * max_number_bytes;
+        const size_t footer_length = 8;
+
+
+        void put_number(string &io_header, unsigned long long in_number)
+        {
+                while(in_number >= 0x80) {
+                        io_header += static_cast<char>(0x80 | (in_number & 0x7f));
+                        in_number >>= 7;
+                }
+                io_header += static_cast<char>(in_number);
+        }
+
+
+        void bad_header()
+        {
+                string the_error("Compressed data has a bad header.");
                 cerr << the_error << endl;
-                throw(length_error(the_error));
-        case BZ_OUTBUFF_FULL:
-                the_error = "The size of the compressed data exceeds *destLen";
+                throw(domain_error(the_error));
+        }
+
+
+        void ends_unexpectedly()
+        {
+                string the_error("Compressed data ends unexpectedly.");
                 cerr << the_error << endl;
-                throw(length_error(the_error));
-        case BZ_OK:
+                throw(domain_error(the_error));
+        }
+
+
+        /*
+          Read the number at in_buf[io_pos] and move io_pos past it.
+          Return false if in_len bytes don't reach its end.
+        */
+        bool get_number(const char *in_buf,
+                        size_t in_len,
+                        size_t &io_pos,
+                        unsigned long long &out_number)
+        {
+                out_number = 0;
+                for(size_t i = 0; i < max_number_bytes; i++) {
+                        if(io_pos + i >= in_len)
+                                return false;
+                        const unsigned char byte = in_buf[io_pos + i];
+                        out_number |= static_cast<unsigned long long>(byte & 0x7f) << (7 * i);
+                        if(!(byte & 0x80)) {
+                                io_pos += i + 1;
+                                return true;
+                        }
+                }
+                bad_header();
+                return false;
+        }
+
+
+        // What a header says.
+        struct Header {
+                size_t m_header_length;
+                Codec m_codec;
+                bool m_length_known;
+                unsigned long long m_length;
+                unsigned long m_dictionary;     /* its id, or 0 for none */
+                bool m_container;               /* the index follows */
+        };
+
+
+        /*
+          Read the header at in_buf.  Return false if in_len bytes
+          aren't enough to tell what it says.  For the oldest
+          payloads, the header is 0 bytes long.  A container's header
+          ends before its index.
+        */
+        bool parse_header(const char *in_buf, size_t in_len, Header &out_header)
+        {
+                if(0 == in_len)
+                        return false;
+                out_header.m_length_known = false;
+                out_header.m_length = 0;
+                out_header.m_dictionary = 0;
+                out_header.m_container = container_tag == in_buf[0];
+                if(codec_tag != in_buf[0] && frame_tag != in_buf[0] && !out_header.m_container) {
+                        out_header.m_header_length = 0;
+                        out_header.m_codec = codec_bzip2;
+                        return true;
+                }
+                if(in_len < 2)
+                        return false;
+                const unsigned char codec = in_buf[1];
+                out_header.m_codec = static_cast<Codec>(codec & ~dictionary_flag);
+                size_t pos = 2;
+                if(codec_tag != in_buf[0]) {
+                        if(!get_number(in_buf, in_len, pos, out_header.m_length))
+                                return false;
+                        out_header.m_length_known = true;
+                }
+                if(codec & dictionary_flag) {
+                        unsigned long long id;
+                        if(!get_number(in_buf, in_len, pos, id))
+                                return false;
+                        if(0 == id || out_header.m_container)
+                                bad_header();
+                        out_header.m_dictionary = id;
+                }
+                out_header.m_header_length = pos;
+                return true;
+        }
+
+
+        // One frame of a container.
+        struct Frame {
+                size_t m_offset;                /* of the codec's stream */
+                size_t m_length;
+                unsigned long long m_text_offset;
+                size_t m_text_length;
+        };
+
+
+        /*
+          Read the frame size, which starts a container's body (what
+          follows its header), at io_pos.  Return false if in_len
+          bytes don't reach its end.
+        */
+        bool get_frame_size(const char *in_buf,
+                            size_t in_len,
+                            size_t &io_pos,
+                            unsigned long long &out_frame_size)
+        {
+                if(!get_number(in_buf, in_len, io_pos, out_frame_size))
+                        return false;
+                if(0 == out_frame_size || out_frame_size > max_frame_size)
+                        bad_header();
+                return true;
+        }
+
+
+        /*
+          Find the frames of a container of in_text_length bytes of
+          text from the index the footer points to, and check each
+          against the length before it.  in_buf is all of the
+          container's body, and the frames' offsets are into it.
+        */
+        void read_index(const char *in_buf,
+                        size_t in_len,
+                        unsigned long long in_text_length,
+                        vector<Frame> &out_frames)
+        {
+                size_t pos = 0;
+                unsigned long long frame_size;
+                if(!get_frame_size(in_buf, in_len, pos, frame_size) || in_len - pos < footer_length)
+                        ends_unexpectedly();
+                const size_t index_end = in_len - footer_length;
+                unsigned long long index_length = 0;
+                for(size_t i = 0; i < footer_length; i++)
+                        index_length |= static_cast<unsigned long long>(
+                                static_cast<unsigned char>(in_buf[index_end + i])) << (8 * i);
+                if(index_length > index_end - pos)
+                        bad_header();
+                size_t index_pos = index_end - index_length;
+                const size_t frames_end = index_pos;
+                out_frames.clear();
+                for(unsigned long long text_offset = 0; text_offset < in_text_length; text_offset += frame_size) {
+                        unsigned long long length, prefix;
+                        if(!get_number(in_buf, index_end, index_pos, length)
+                           || !get_number(in_buf, frames_end, pos, prefix)
+                           || prefix != length || length > frames_end - pos)
+                                bad_header();
+                        Frame frame;
+                        frame.m_offset = pos;
+                        frame.m_length = length;
+                        frame.m_text_offset = text_offset;
+                        frame.m_text_length = min(frame_size, in_text_length - text_offset);
+                        out_frames.push_back(frame);
+                        pos += length;
+                }
+                if(index_pos != index_end || pos != frames_end)
+                        bad_header();
+        }
+}
+
+
+
+const char *cryptar::codec_name(Codec in_codec)
+{
+        switch(in_codec) {
+        case codec_bzip2:
+                return "bzip2";
+        case codec_zstd:
+                return "zstd";
+        case codec_lz4:
+                return "lz4";
+        case codec_stored:
+                return "stored";
+        }
+        return "unknown";
+}
+
+
+void CompressParams::validate() const
+{
+        int min_level = 0;
+        int max_level = 0;
+        switch(m_codec) {
+        case codec_bzip2:
+                max_level = 9;
+                break;
+        case codec_zstd:
+                min_level = ZSTD_minCLevel();
+                max_level = ZSTD_maxCLevel();
+                break;
+        case codec_lz4:
+                max_level = LZ4HC_CLEVEL_MAX;
+                break;
+        case codec_stored:
                 break;
         default:
-                the_error = "Unexpected return from BZ2_bzBuffToBuffCompress";
-                cerr << the_error << endl;
-                throw(logic_error(the_error));
-        };
-        
-        string out_buf(out_buf_raw, output_max_size);
-        return(out_buf);
+                throw(invalid_argument("CompressParams: unknown codec"));
+        }
+        if(m_level < min_level || m_level > max_level)
+                throw(invalid_argument(string("CompressParams: bad level for ") + codec_name(m_codec)));
+        if(m_frame_size > max_frame_size)
+                throw(invalid_argument("CompressParams: frames too long"));
 }
 
 
+namespace {
+
+        // Probe this many samples of this length, spread over the text.
+        const size_t probe_samples = 4;
+        const size_t probe_sample_length = 4096;
+
+        // Text is incompressible if lz4 saves less than this fraction
+        // of it, and its bytes have at least this many bits of
+        // entropy each.
+        const double probe_min_saving = 1.0 / 32;
+        const double probe_max_entropy = 7.5;
+
+        atomic<unsigned long> texts_probed(0);
+        atomic<unsigned long> texts_stored(0);
+        atomic<unsigned long long> bytes_probed(0);
+        atomic<unsigned long long> bytes_stored(0);
+}
+
 
 /*
-  Decompress a string.
+  The entropy is of the bytes' frequencies in the samples, with the
+  Miller-Madow correction for the bias of small samples (a sample of
+  512 random bytes can't show all 256 values evenly).
 */
-string cryptar::decompress(const string &in_buf,
-                  unsigned int uncompressed_size_hint)
-{
-        if(0 == uncompressed_size_hint)
-                uncompressed_size_hint = 5 * in_buf.size();
-        char out_buf_raw[uncompressed_size_hint];
-
-        // For argument definitions, cf.
-        //   http://www.bzip.org/1.0.3/html/util-fns.html#bzbufftobuffdecompress
-        // and also
-        //   http://www.bzip.org/1.0.3/html/low-level.html#bzDecompress-init
-        //
-        // Source string is not changed, one understands, but the C origin means
-        // a char * rather than a const char *.  So const_cast.
-        int ret = BZ2_bzBuffToBuffDecompress(out_buf_raw,
-                                             &uncompressed_size_hint,
-                                             const_cast<char *>(in_buf.c_str()),
-                                             in_buf.size(),
-                                             false, // small is false: else slower
-                                             mode(Verbose)
-                                             );
-
-        string the_error;
-        switch(ret) {
-        case BZ_CONFIG_ERROR:
-                the_error = "The bzip2 library has been mis-compiled.";
-                cerr << the_error << endl;
-                throw(runtime_error(the_error));
-        case BZ_PARAM_ERROR:
-                the_error = "Parameter error in BZ2_bzBuffToBuffDecompress";
-                cerr << the_error << endl;
-                cerr << "Cf. http://www.bzip.org/1.0.3/html/util-fns.html#bzbufftobuffdecompress"
-                     << endl;
-                throw(invalid_argument(the_error));
-        case BZ_MEM_ERROR:
-                the_error = "Insufficient memory available for decompression";
+bool cryptar::looks_compressible(const char *in_buf, size_t in_len)
+{
+        if(0 == in_len)
+                return true;
+        const size_t samples = in_len <= probe_samples * probe_sample_length ? 1 : probe_samples;
+        const size_t length = 1 == samples ? in_len : probe_sample_length;
+        string out(LZ4_compressBound(length), '\0');
+        unsigned long counts[256] = { 0 };
+        size_t compressed = 0;
+        for(size_t i = 0; i < samples; i++) {
+                const char *sample = in_buf + (1 == samples ? 0 : i * (in_len - length) / (samples - 1));
+                const int ret = LZ4_compress_default(sample, &out[0], length, out.size());
+                compressed += ret > 0 ? ret : length;
+                for(size_t j = 0; j < length; j++)
+                        counts[static_cast<unsigned char>(sample[j])]++;
+        }
+        const double total = samples * length;
+        if(compressed < (1 - probe_min_saving) * total)
+                return true;
+        double entropy = 0;
+        unsigned int seen = 0;
+        for(unsigned long count : counts)
+                if(count) {
+                        const double p = count / total;
+                        entropy -= p * log2(p);
+                        seen++;
+                }
+        entropy += (seen - 1) / (2 * total * log(2.0));
+        return entropy < probe_max_entropy;
+}
+
+
+CompressParams CompressParams::for_text(const char *in_buf, size_t in_len) const
+{
+        const CompressParams params(sized(in_len));
+        if(!params.m_probe || codec_stored == params.m_codec)
+                return params;
+        return params.probed(looks_compressible(in_buf, in_len), in_len);
+}
+
+
+/*
+  If the file isn't mapped, we read just the samples.
+*/
+CompressParams CompressParams::for_text(const LocalFile &in_file) const
+{
+        const unsigned long size = in_file.size();
+        const CompressParams params(sized(size));
+        if(!params.m_probe || codec_stored == params.m_codec)
+                return params;
+        if(in_file.mapped())
+                return params.probed(looks_compressible(in_file.data(), size), size);
+        if(size <= probe_samples * probe_sample_length) {
+                string text(size, '\0');
+                text.resize(in_file.read(0, &text[0], size));
+                return params.probed(looks_compressible(text.data(), text.size()), size);
+        }
+        // Samples at the same offsets as looks_compressible() would
+        // take from the whole file.
+        string text(probe_samples * probe_sample_length, '\0');
+        for(size_t i = 0; i < probe_samples; i++)
+                in_file.read(i * (size - probe_sample_length) / (probe_samples - 1),
+                             &text[i * probe_sample_length], probe_sample_length);
+        return params.probed(looks_compressible(text.data(), text.size()), size);
+}
+
+
+CompressParams CompressParams::sized(unsigned long long in_len) const
+{
+        CompressParams params(*this);
+        if(in_len > dictionary_text_limit)
+                params.m_dictionary.reset();
+        return params;
+}
+
+
+CompressParams CompressParams::probed(bool in_compressible, unsigned long long in_len) const
+{
+        texts_probed++;
+        bytes_probed += in_len;
+        if(in_compressible)
+                return *this;
+        texts_stored++;
+        bytes_stored += in_len;
+        CompressParams params(*this);
+        params.m_codec = codec_stored;
+        params.m_level = 0;
+        params.m_dictionary.reset();
+        return params;
+}
+
+
+ProbeStats cryptar::probe_stats()
+{
+        ProbeStats stats;
+        stats.m_probed = texts_probed;
+        stats.m_stored = texts_stored;
+        stats.m_bytes_probed = bytes_probed;
+        stats.m_bytes_stored = bytes_stored;
+        return stats;
+}
+
+
+void cryptar::reset_probe_stats()
+{
+        texts_probed = 0;
+        texts_stored = 0;
+        bytes_probed = 0;
+        bytes_stored = 0;
+}
+
+
+/*
+  Compress a string.
+*/
+string cryptar::compress(const string &in_buf, const CompressParams &in_params)
+{
+        string out_buf;
+        StringSink sink(out_buf);
+        CompressSink compress(sink, in_params.for_text(in_buf.data(), in_buf.size()));
+        compress.expect(in_buf.size());
+        compress.write(in_buf.data(), in_buf.size());
+        compress.close();
+        return out_buf;
+}
+
+
+
+/*
+  Decompress a string.  If the header says how long the text is, we
+  decompress straight into a string of that size.
+*/
+string cryptar::decompress(const string &in_buf, const DictionarySource *in_dictionaries)
+{
+        string out_buf;
+        unsigned long long length;
+        if(decompressed_length(in_buf.data(), in_buf.size(), length)) {
+                if(length > out_buf.max_size())
+                        throw(length_error("decompress(): text too long for a string"));
+                out_buf.resize(length);
+                decompress(in_buf.data(), in_buf.size(), &out_buf[0], length, in_dictionaries);
+                return out_buf;
+        }
+        StringSink sink(out_buf);
+        DecompressSink decompress(sink, in_dictionaries);
+        decompress.write(in_buf.data(), in_buf.size());
+        decompress.close();
+        return out_buf;
+}
+
+
+bool cryptar::decompressed_length(const char *in_buf, size_t in_len, unsigned long long &out_length)
+{
+        Header header;
+        if(!parse_header(in_buf, in_len, header) || !header.m_length_known)
+                return false;
+        out_length = header.m_length;
+        return true;
+}
+
+
+
+/*
+  A compressor or decompressor for one codec.  write() passes in_buf
+  through the codec and what comes out on to out_sink.  Once a
+  decompressor has reached the end of the compressed stream, write()
+  returns true, and anything after is ignored.  A compressor writes
+  the end of its stream on finish().
+*/
+class cryptar::CodecStream {
+public:
+        CodecStream() : m_produced(0) {};
+        virtual ~CodecStream() {};
+        virtual bool write(const char *in_buf, size_t in_len, ByteSink &out_sink) = 0;
+        virtual void finish(ByteSink &out_sink) {};
+        virtual void expect(size_t in_len) {};
+        // A stream with no end marker of its own says when it could end.
+        virtual bool complete() const { return false; }
+
+        unsigned long long produced() const { return m_produced; }
+
+protected:
+        // Pass output on, counting it.
+        void emit(ByteSink &out_sink, const char *in_buf, size_t in_len)
+        {
+                m_produced += in_len;
+                out_sink.write(in_buf, in_len);
+        }
+
+private:
+        unsigned long long m_produced;
+};
+
+
+namespace {
+
+        /*
+          Throw for a bzip2 return code that means something went
+          wrong.
+        */
+        void bz_check(int in_ret, const string &in_where)
+        {
+                string the_error;
+                switch(in_ret) {
+                case BZ_OK:
+                case BZ_RUN_OK:
+                case BZ_FINISH_OK:
+                case BZ_STREAM_END:
+                        return;
+                case BZ_CONFIG_ERROR:
+                        the_error = "The bzip2 library has been mis-compiled.";
+                        cerr << the_error << endl;
+                        throw(runtime_error(the_error));
+                case BZ_PARAM_ERROR:
+                        the_error = "Parameter error in " + in_where;
+                        cerr << the_error << endl;
+                        throw(invalid_argument(the_error));
+                case BZ_SEQUENCE_ERROR:
+                        the_error = "Calls out of sequence in " + in_where;
+                        cerr << the_error << endl;
+                        throw(logic_error(the_error));
+                case BZ_MEM_ERROR:
+                        the_error = "Insufficient memory available in " + in_where;
+                        cerr << the_error << endl;
+                        throw(length_error(the_error));
+                case BZ_DATA_ERROR:
+                        the_error = "Data integrity error was detected in the compressed data.";
+                        cerr << the_error << endl;
+                        throw(domain_error(the_error));
+                case BZ_DATA_ERROR_MAGIC:
+                        the_error = "Compressed data doesn't begin with the right magic bytes.";
+                        cerr << the_error << endl;
+                        throw(domain_error(the_error));
+                case BZ_UNEXPECTED_EOF:
+                        the_error = "Compressed data ends unexpectedly.";
+                        cerr << the_error << endl;
+                        throw(domain_error(the_error));
+                case BZ_OUTBUFF_FULL:
+                        // We only decompress into a buffer when the
+                        // header says how long the text is.
+                        the_error = "Compressed data is longer than its header says.";
+                        cerr << the_error << endl;
+                        throw(domain_error(the_error));
+                default:
+                        the_error = "Unexpected return from " + in_where;
+                        cerr << the_error << endl;
+                        throw(logic_error(the_error));
+                };
+        }
+
+
+        // bzip2 counts in unsigned int, so feed it no more than this at once.
+        const size_t bz_max_input = 1 << 30;
+
+
+        /*
+          The streaming interface is documented at
+          http://www.bzip.org/1.0.3/html/low-level.html
+        */
+        class BzipCompressor : public CodecStream {
+        public:
+                explicit BzipCompressor(int in_block_size)
+                        : m_buffer(pipeline_chunk_size, '\0')
+                {
+                        m_bz.bzalloc = 0;
+                        m_bz.bzfree = 0;
+                        m_bz.opaque = 0;
+                        m_bz.next_in = 0;
+                        m_bz.avail_in = 0;
+                        bz_check(BZ2_bzCompressInit(&m_bz, in_block_size, (const bool)mode(Verbose), 0),
+                                 "BZ2_bzCompressInit");
+                }
+
+                virtual ~BzipCompressor() { BZ2_bzCompressEnd(&m_bz); }
+
+                virtual bool write(const char *in_buf, size_t in_len, ByteSink &out_sink)
+                {
+                        while(in_len > 0) {
+                                size_t piece = min(in_len, bz_max_input);
+                                m_bz.next_in = const_cast<char *>(in_buf);
+                                m_bz.avail_in = piece;
+                                run(BZ_RUN, out_sink);
+                                in_buf += piece;
+                                in_len -= piece;
+                        }
+                        return false;
+                }
+
+                virtual void finish(ByteSink &out_sink) { run(BZ_FINISH, out_sink); }
+
+        private:
+                /*
+                  Compress until bzip2 has taken all its input
+                  (BZ_RUN) or has written the end of the stream
+                  (BZ_FINISH), passing on each buffer's worth of
+                  output as it comes.
+                */
+                void run(int in_action, ByteSink &out_sink)
+                {
+                        int ret;
+                        do {
+                                m_bz.next_out = &m_buffer[0];
+                                m_bz.avail_out = m_buffer.size();
+                                ret = BZ2_bzCompress(&m_bz, in_action);
+                                bz_check(ret, "BZ2_bzCompress");
+                                size_t produced = m_buffer.size() - m_bz.avail_out;
+                                if(produced)
+                                        emit(out_sink, m_buffer.data(), produced);
+                        } while(BZ_RUN == in_action ? m_bz.avail_in > 0 : BZ_STREAM_END != ret);
+                }
+
+                bz_stream m_bz;
+                string m_buffer;
+        };
+
+
+        class BzipDecompressor : public CodecStream {
+        public:
+                BzipDecompressor() : m_buffer(pipeline_chunk_size, '\0')
+                {
+                        m_bz.bzalloc = 0;
+                        m_bz.bzfree = 0;
+                        m_bz.opaque = 0;
+                        m_bz.next_in = 0;
+                        m_bz.avail_in = 0;
+                        bz_check(BZ2_bzDecompressInit(&m_bz, mode(Verbose), 0), "BZ2_bzDecompressInit");
+                }
+
+                virtual ~BzipDecompressor() { BZ2_bzDecompressEnd(&m_bz); }
+
+                virtual bool write(const char *in_buf, size_t in_len, ByteSink &out_sink)
+                {
+                        bool done = false;
+                        while(in_len > 0 && !done) {
+                                size_t piece = min(in_len, bz_max_input);
+                                m_bz.next_in = const_cast<char *>(in_buf);
+                                m_bz.avail_in = piece;
+                                // A full output buffer may mean bzip2 has more for us
+                                // even once it has taken all the input.
+                                do {
+                                        m_bz.next_out = &m_buffer[0];
+                                        m_bz.avail_out = m_buffer.size();
+                                        int ret = BZ2_bzDecompress(&m_bz);
+                                        bz_check(ret, "BZ2_bzDecompress");
+                                        size_t produced = m_buffer.size() - m_bz.avail_out;
+                                        if(produced)
+                                                emit(out_sink, m_buffer.data(), produced);
+                                        if(BZ_STREAM_END == ret)
+                                                done = true;
+                                } while(!done && (m_bz.avail_in > 0 || 0 == m_bz.avail_out));
+                                in_buf += piece;
+                                in_len -= piece;
+                        }
+                        return done;
+                }
+
+        private:
+                bz_stream m_bz;
+                string m_buffer;
+        };
+
+
+        // Throw if a zstd return code is an error.
+        template<typename Error>
+        size_t zstd_check(size_t in_ret, const string &in_where)
+        {
+                if(!ZSTD_isError(in_ret))
+                        return in_ret;
+                const string the_error = in_where + ": " + ZSTD_getErrorName(in_ret);
                 cerr << the_error << endl;
-                throw(length_error(the_error));
-        case BZ_OUTBUFF_FULL:
-                cout << "The size of the compressed data exceeds *destLen, trying *= 2."
-                     << endl;
-                return decompress(in_buf, 2 * uncompressed_size_hint);
-        case BZ_DATA_ERROR:
-                the_error = "Data integrity error was detected in the compressed data.";
+                throw(Error(the_error));
+        }
+
+
+        /*
+          Against a dictionary, the level is the one the dictionary
+          was digested at.  Our header names the dictionary, so the
+          frame needn't.
+        */
+        class ZstdCompressor : public CodecStream {
+        public:
+                ZstdCompressor(int in_level, const shared_ptr<const CompressDictionary> &in_dictionary)
+                        : m_context(ZSTD_createCCtx(), ZSTD_freeCCtx), m_buffer(ZSTD_CStreamOutSize(), '\0'),
+                          m_dictionary(in_dictionary)
+                {
+                        if(!m_context)
+                                throw(length_error("Insufficient memory available in ZSTD_createCCtx"));
+                        zstd_check<invalid_argument>(ZSTD_CCtx_setParameter(m_context.get(),
+                                                                            ZSTD_c_compressionLevel,
+                                                                            in_level),
+                                                     "ZSTD_CCtx_setParameter");
+                        if(!m_dictionary)
+                                return;
+                        zstd_check<runtime_error>(ZSTD_CCtx_refCDict(m_context.get(),
+                                                                     m_dictionary->compress_dictionary(in_level)),
+                                                  "ZSTD_CCtx_refCDict");
+                        zstd_check<runtime_error>(ZSTD_CCtx_setParameter(m_context.get(), ZSTD_c_dictIDFlag, 0),
+                                                  "ZSTD_CCtx_setParameter");
+                }
+
+                virtual bool write(const char *in_buf, size_t in_len, ByteSink &out_sink)
+                {
+                        ZSTD_inBuffer in = { in_buf, in_len, 0 };
+                        while(in.pos < in.size)
+                                run(in, ZSTD_e_continue, out_sink);
+                        return false;
+                }
+
+                virtual void finish(ByteSink &out_sink)
+                {
+                        ZSTD_inBuffer in = { 0, 0, 0 };
+                        while(run(in, ZSTD_e_end, out_sink))
+                                ;
+                }
+
+                virtual void expect(size_t in_len)
+                {
+                        zstd_check<logic_error>(ZSTD_CCtx_setPledgedSrcSize(m_context.get(), in_len),
+                                                "ZSTD_CCtx_setPledgedSrcSize");
+                }
+
+        private:
+                // Returns what zstd has yet to flush.
+                size_t run(ZSTD_inBuffer &io_in, ZSTD_EndDirective in_mode, ByteSink &out_sink)
+                {
+                        ZSTD_outBuffer out = { &m_buffer[0], m_buffer.size(), 0 };
+                        const size_t remaining
+                                = zstd_check<runtime_error>(ZSTD_compressStream2(m_context.get(), &out,
+                                                                                 &io_in, in_mode),
+                                                            "ZSTD_compressStream2");
+                        if(out.pos)
+                                emit(out_sink, m_buffer.data(), out.pos);
+                        return remaining;
+                }
+
+                unique_ptr<ZSTD_CCtx, size_t (*)(ZSTD_CCtx *)> m_context;
+                string m_buffer;
+                shared_ptr<const CompressDictionary> m_dictionary;
+        };
+
+
+        class ZstdDecompressor : public CodecStream {
+        public:
+                explicit ZstdDecompressor(const shared_ptr<const CompressDictionary> &in_dictionary)
+                        : m_context(ZSTD_createDCtx(), ZSTD_freeDCtx), m_buffer(ZSTD_DStreamOutSize(), '\0'),
+                          m_dictionary(in_dictionary)
+                {
+                        if(!m_context)
+                                throw(length_error("Insufficient memory available in ZSTD_createDCtx"));
+                        if(m_dictionary)
+                                zstd_check<runtime_error>(ZSTD_DCtx_refDDict(m_context.get(),
+                                                                             m_dictionary->decompress_dictionary()),
+                                                          "ZSTD_DCtx_refDDict");
+                }
+
+                virtual bool write(const char *in_buf, size_t in_len, ByteSink &out_sink)
+                {
+                        ZSTD_inBuffer in = { in_buf, in_len, 0 };
+                        ZSTD_outBuffer out;
+                        do {
+                                out = { &m_buffer[0], m_buffer.size(), 0 };
+                                const size_t ret
+                                        = zstd_check<domain_error>(ZSTD_decompressStream(m_context.get(),
+                                                                                         &out, &in),
+                                                                   "ZSTD_decompressStream");
+                                if(out.pos)
+                                        emit(out_sink, m_buffer.data(), out.pos);
+                                if(0 == ret)
+                                        return true;    // the end of the frame
+                        } while(in.pos < in.size || out.pos == out.size);
+                        return false;
+                }
+
+        private:
+                unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx *)> m_context;
+                string m_buffer;
+                shared_ptr<const CompressDictionary> m_dictionary;
+        };
+
+
+        // Throw if an lz4 return code is an error.
+        template<typename Error>
+        size_t lz4_check(size_t in_ret, const string &in_where)
+        {
+                if(!LZ4F_isError(in_ret))
+                        return in_ret;
+                const string the_error = in_where + ": " + LZ4F_getErrorName(in_ret);
                 cerr << the_error << endl;
-                throw(domain_error(the_error));
-        case BZ_DATA_ERROR_MAGIC:
-                the_error = "Compressed data doesn't begin with the right magic bytes.";
+                throw(Error(the_error));
+        }
+
+
+        class Lz4Compressor : public CodecStream {
+        public:
+                explicit Lz4Compressor(int in_level) : m_started(false)
+                {
+                        memset(&m_prefs, 0, sizeof(m_prefs));
+                        m_prefs.compressionLevel = in_level;
+                        lz4_check<length_error>(LZ4F_createCompressionContext(&m_context, LZ4F_VERSION),
+                                                "LZ4F_createCompressionContext");
+                        // Room for the output of a piece of input and
+                        // whatever lz4 held back from before.
+                        m_buffer.resize(LZ4F_compressBound(pipeline_chunk_size, &m_prefs));
+                }
+
+                virtual ~Lz4Compressor() { LZ4F_freeCompressionContext(m_context); }
+
+                virtual bool write(const char *in_buf, size_t in_len, ByteSink &out_sink)
+                {
+                        start(out_sink);
+                        while(in_len > 0) {
+                                const size_t piece = min(in_len, pipeline_chunk_size);
+                                const size_t produced
+                                        = lz4_check<runtime_error>(LZ4F_compressUpdate(m_context,
+                                                                                       &m_buffer[0],
+                                                                                       m_buffer.size(),
+                                                                                       in_buf, piece, 0),
+                                                                   "LZ4F_compressUpdate");
+                                if(produced)
+                                        emit(out_sink, m_buffer.data(), produced);
+                                in_buf += piece;
+                                in_len -= piece;
+                        }
+                        return false;
+                }
+
+                virtual void finish(ByteSink &out_sink)
+                {
+                        start(out_sink);
+                        const size_t produced
+                                = lz4_check<runtime_error>(LZ4F_compressEnd(m_context, &m_buffer[0],
+                                                                            m_buffer.size(), 0),
+                                                           "LZ4F_compressEnd");
+                        emit(out_sink, m_buffer.data(), produced);
+                }
+
+        private:
+                // Write the frame header, once.
+                void start(ByteSink &out_sink)
+                {
+                        if(m_started)
+                                return;
+                        const size_t produced
+                                = lz4_check<runtime_error>(LZ4F_compressBegin(m_context, &m_buffer[0],
+                                                                              m_buffer.size(), &m_prefs),
+                                                           "LZ4F_compressBegin");
+                        emit(out_sink, m_buffer.data(), produced);
+                        m_started = true;
+                }
+
+                LZ4F_cctx *m_context;
+                LZ4F_preferences_t m_prefs;
+                string m_buffer;
+                bool m_started;
+        };
+
+
+        class Lz4Decompressor : public CodecStream {
+        public:
+                Lz4Decompressor() : m_buffer(pipeline_chunk_size, '\0')
+                {
+                        lz4_check<length_error>(LZ4F_createDecompressionContext(&m_context, LZ4F_VERSION),
+                                                "LZ4F_createDecompressionContext");
+                }
+
+                virtual ~Lz4Decompressor() { LZ4F_freeDecompressionContext(m_context); }
+
+                virtual bool write(const char *in_buf, size_t in_len, ByteSink &out_sink)
+                {
+                        while(true) {
+                                size_t produced = m_buffer.size();
+                                size_t consumed = in_len;
+                                const size_t ret
+                                        = lz4_check<domain_error>(LZ4F_decompress(m_context,
+                                                                                  &m_buffer[0], &produced,
+                                                                                  in_buf, &consumed, 0),
+                                                                  "LZ4F_decompress");
+                                if(produced)
+                                        emit(out_sink, m_buffer.data(), produced);
+                                in_buf += consumed;
+                                in_len -= consumed;
+                                if(0 == ret)
+                                        return true;    // the end of the frame
+                                // A full output buffer may mean lz4 has
+                                // more for us even once it has taken all
+                                // the input.
+                                if(0 == in_len && produced < m_buffer.size())
+                                        return false;
+                        }
+                }
+
+        private:
+                LZ4F_dctx *m_context;
+                string m_buffer;
+        };
+
+
+        void wrong_length()
+        {
+                string the_error("Compressed data is not as long as its header says.");
                 cerr << the_error << endl;
                 throw(domain_error(the_error));
-        case BZ_UNEXPECTED_EOF:
-                the_error = "Compressed data ends unexpectedly.";
+        }
+
+
+        /*
+          The stored "codec" passes the text through.  It has no end
+          marker: if the header gives the length, that is the end,
+          and otherwise the end of the payload is.
+        */
+        class StoredCompressor : public CodecStream {
+        public:
+                virtual bool write(const char *in_buf, size_t in_len, ByteSink &out_sink)
+                {
+                        emit(out_sink, in_buf, in_len);
+                        return false;
+                }
+        };
+
+
+        class StoredDecompressor : public CodecStream {
+        public:
+                StoredDecompressor(bool in_length_known, unsigned long long in_length)
+                        : m_length_known(in_length_known), m_length(in_length) {};
+
+                virtual bool write(const char *in_buf, size_t in_len, ByteSink &out_sink)
+                {
+                        if(!m_length_known) {
+                                emit(out_sink, in_buf, in_len);
+                                return false;
+                        }
+                        if(in_len > m_length - produced())
+                                wrong_length();
+                        emit(out_sink, in_buf, in_len);
+                        return complete();
+                }
+
+                virtual bool complete() const { return !m_length_known || produced() == m_length; }
+
+        private:
+                bool m_length_known;
+                unsigned long long m_length;
+        };
+
+
+        CodecStream *make_compressor(const CompressParams &in_params)
+        {
+                in_params.validate();
+                const int level = in_params.m_level;
+                switch(in_params.m_codec) {
+                case codec_bzip2:
+                        return new BzipCompressor(level ? level : 1);
+                case codec_zstd:
+                        return new ZstdCompressor(level ? level : ZSTD_CLEVEL_DEFAULT, in_params.m_dictionary);
+                case codec_lz4:
+                        return new Lz4Compressor(level);
+                case codec_stored:
+                        return new StoredCompressor;
+                }
+                throw(invalid_argument("Unknown codec"));
+        }
+
+
+        /*
+          Decompress a whole codec stream, whose text the header says
+          is in_out_len bytes long, straight into out_buf, in one
+          pass.  Return false if the codec can't (bzip2 counts in
+          unsigned int), and the caller should stream instead.
+        */
+        bool decode_frame(Codec in_codec,
+                          const CompressDictionary *in_dictionary,
+                          const char *in_buf,
+                          size_t in_len,
+                          char *out_buf,
+                          size_t in_out_len)
+        {
+                switch(in_codec) {
+                case codec_bzip2: {
+                        if(in_len > UINT_MAX || in_out_len > UINT_MAX)
+                                return false;
+                        unsigned int length = in_out_len;
+                        bz_check(BZ2_bzBuffToBuffDecompress(out_buf, &length,
+                                                            const_cast<char *>(in_buf), in_len,
+                                                            false, // small is false: else slower
+                                                            mode(Verbose)),
+                                 "BZ2_bzBuffToBuffDecompress");
+                        if(length != in_out_len)
+                                wrong_length();
+                        return true;
+                }
+                case codec_zstd: {
+                        size_t ret;
+                        if(in_dictionary) {
+                                unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx *)>
+                                        context(ZSTD_createDCtx(), ZSTD_freeDCtx);
+                                if(!context)
+                                        throw(length_error("Insufficient memory available in ZSTD_createDCtx"));
+                                ret = ZSTD_decompress_usingDDict(context.get(), out_buf, in_out_len,
+                                                                 in_buf, in_len,
+                                                                 in_dictionary->decompress_dictionary());
+                        } else
+                                ret = ZSTD_decompress(out_buf, in_out_len, in_buf, in_len);
+                        if(zstd_check<domain_error>(ret, "ZSTD_decompress") != in_out_len)
+                                wrong_length();
+                        return true;
+                }
+                case codec_lz4: {
+                        LZ4F_dctx *context;
+                        lz4_check<length_error>(LZ4F_createDecompressionContext(&context, LZ4F_VERSION),
+                                                "LZ4F_createDecompressionContext");
+                        unique_ptr<LZ4F_dctx, LZ4F_errorCode_t (*)(LZ4F_dctx *)>
+                                free_context(context, LZ4F_freeDecompressionContext);
+                        size_t in_pos = 0;
+                        size_t out_pos = 0;
+                        size_t ret = 1;
+                        while(0 != ret) {
+                                size_t produced = in_out_len - out_pos;
+                                size_t consumed = in_len - in_pos;
+                                ret = lz4_check<domain_error>(LZ4F_decompress(context,
+                                                                              out_buf + out_pos, &produced,
+                                                                              in_buf + in_pos, &consumed, 0),
+                                                              "LZ4F_decompress");
+                                in_pos += consumed;
+                                out_pos += produced;
+                                if(0 == produced && 0 == consumed)
+                                        break;  // out of input, or of room
+                        }
+                        if(0 != ret || out_pos != in_out_len)
+                                wrong_length();
+                        return true;
+                }
+                case codec_stored:
+                        if(in_len != in_out_len)
+                                wrong_length();
+                        memcpy(out_buf, in_buf, in_len);
+                        return true;
+                }
+                return false;
+        }
+
+
+        // Write to a buffer of fixed size.
+        class BufferSink : public ByteSink {
+        public:
+                BufferSink(char *out_buf, size_t in_size) : m_buf(out_buf), m_size(in_size), m_length(0) {};
+                virtual void write(const char *in_buf, size_t in_len)
+                {
+                        if(in_len > m_size - m_length)
+                                throw(length_error("decompress(): buffer too small"));
+                        memcpy(m_buf + m_length, in_buf, in_len);
+                        m_length += in_len;
+                }
+                size_t length() const { return m_length; }
+
+        private:
+                char *m_buf;
+                size_t m_size;
+                size_t m_length;
+        };
+
+
+        unsigned int threads_for(unsigned int in_threads)
+        {
+                if(in_threads)
+                        return in_threads;
+                return mode(Threads) ? max(1U, boost::thread::hardware_concurrency()) : 1;
+        }
+
+
+        /*
+          Call in_job(i) for each i < in_count, on up to in_threads
+          threads, and rethrow the first exception any call throws.
+        */
+        void parallel_for(size_t in_count,
+                          unsigned int in_threads,
+                          const function<void (size_t)> &in_job)
+        {
+                if(in_threads <= 1 || in_count <= 1) {
+                        for(size_t i = 0; i < in_count; i++)
+                                in_job(i);
+                        return;
+                }
+                size_t next = 0;
+                exception_ptr error;
+                boost::mutex access;
+                boost::thread_group workers;
+                for(size_t i = 0; i < min<size_t>(in_threads, in_count); i++)
+                        workers.create_thread([&]() {
+                                while(true) {
+                                        size_t job;
+                                        {
+                                                boost::lock_guard<boost::mutex> lock(access);
+                                                if(error || next >= in_count)
+                                                        return;
+                                                job = next++;
+                                        }
+                                        try {
+                                                in_job(job);
+                                        }
+                                        catch(...) {
+                                                boost::lock_guard<boost::mutex> lock(access);
+                                                if(!error)
+                                                        error = current_exception();
+                                        }
+                                }
+                        });
+                workers.join_all();
+                if(error)
+                        rethrow_exception(error);
+        }
+
+
+        // One frame of a container, as the codec's own stream.
+        string compress_frame(const CompressParams &in_params, const string &in_text)
+        {
+                string frame;
+                StringSink sink(frame);
+                unique_ptr<CodecStream> stream(make_compressor(in_params));
+                stream->expect(in_text.size());
+                stream->write(in_text.data(), in_text.size(), sink);
+                stream->finish(sink);
+                return frame;
+        }
+
+
+        void decode_whole_frame(Codec in_codec,
+                                const char *in_buf,
+                                const Frame &in_frame,
+                                char *out_buf)
+        {
+                if(!decode_frame(in_codec, 0, in_buf + in_frame.m_offset, in_frame.m_length,
+                                 out_buf, in_frame.m_text_length))
+                        bad_header();
+        }
+
+
+        /*
+          Decompress up to in_out_len bytes of a container's text from
+          in_offset, on as many threads as we have, and return how
+          many there were.  in_buf is what follows the header, to the
+          end of the footer.  Frames wholly in the range decompress
+          straight into out_buf.
+        */
+        size_t decode_container(Codec in_codec,
+                                const char *in_buf,
+                                size_t in_len,
+                                unsigned long long in_text_length,
+                                unsigned long long in_offset,
+                                char *out_buf,
+                                size_t in_out_len)
+        {
+                vector<Frame> frames;
+                read_index(in_buf, in_len, in_text_length, frames);
+                if(in_offset >= in_text_length || 0 == in_out_len)
+                        return 0;
+                const unsigned long long end = min<unsigned long long>(in_text_length, in_offset + in_out_len);
+                // All frames but the last are as long as the first.
+                const size_t frame_size = frames.front().m_text_length;
+                const size_t first = in_offset / frame_size;
+                parallel_for((end - 1) / frame_size - first + 1, threads_for(0), [&](size_t in_i) {
+                        const Frame &frame = frames[first + in_i];
+                        const unsigned long long from = max(in_offset, frame.m_text_offset);
+                        const unsigned long long to = min(end, frame.m_text_offset + frame.m_text_length);
+                        char *out = out_buf + (from - in_offset);
+                        if(to - from == frame.m_text_length) {
+                                decode_whole_frame(in_codec, in_buf, frame, out);
+                                return;
+                        }
+                        string text(frame.m_text_length, '\0');
+                        decode_whole_frame(in_codec, in_buf, frame, &text[0]);
+                        memcpy(out, text.data() + (from - frame.m_text_offset), to - from);
+                });
+                return end - in_offset;
+        }
+
+
+        /*
+          A container as a stream, a batch of frames at a time: as
+          many as we have threads, which decompress them at once.  We
+          check the index and footer against the frames we found.
+        */
+        class ContainerDecompressor : public CodecStream {
+        public:
+                ContainerDecompressor(Codec in_codec, unsigned long long in_length)
+                        : m_codec(in_codec), m_length(in_length), m_frame_size(0),
+                          m_text_offset(0), m_start(0), m_threads(threads_for(0)) {};
+
+                virtual bool write(const char *in_buf, size_t in_len, ByteSink &out_sink)
+                {
+                        m_held.erase(0, m_start);
+                        m_start = 0;
+                        m_held.append(in_buf, in_len);
+                        if(!m_frame_size) {
+                                unsigned long long frame_size;
+                                if(!get_frame_size(m_held.data(), m_held.size(), m_start, frame_size))
+                                        return false;
+                                m_frame_size = frame_size;
+                        }
+                        while(m_text_offset < m_length) {
+                                // The next frames we hold all of, up
+                                // to one for each thread.
+                                vector<Frame> frames;
+                                size_t pos = m_start;
+                                unsigned long long text_offset = m_text_offset;
+                                while(frames.size() < m_threads && text_offset < m_length) {
+                                        size_t at = pos;
+                                        unsigned long long length;
+                                        if(!get_number(m_held.data(), m_held.size(), at, length)
+                                           || length > m_held.size() - at)
+                                                break;
+                                        Frame frame;
+                                        frame.m_offset = at;
+                                        frame.m_length = length;
+                                        frame.m_text_offset = text_offset;
+                                        frame.m_text_length = min(m_frame_size, m_length - text_offset);
+                                        frames.push_back(frame);
+                                        pos = at + length;
+                                        text_offset += frame.m_text_length;
+                                }
+                                if(frames.size() < m_threads && text_offset < m_length)
+                                        return false;
+                                decode(frames, out_sink);
+                                m_start = pos;
+                                m_text_offset = text_offset;
+                        }
+                        return check_index();
+                }
+
+        private:
+                void decode(const vector<Frame> &in_frames, ByteSink &out_sink)
+                {
+                        vector<string> texts(in_frames.size());
+                        parallel_for(in_frames.size(), m_threads, [&](size_t in_i) {
+                                texts[in_i].resize(in_frames[in_i].m_text_length);
+                                decode_whole_frame(m_codec, m_held.data(), in_frames[in_i], &texts[in_i][0]);
+                        });
+                        for(size_t i = 0; i < in_frames.size(); i++) {
+                                emit(out_sink, texts[i].data(), texts[i].size());
+                                put_number(m_index, in_frames[i].m_length);
+                        }
+                }
+
+                // The index and footer had better be what the frames
+                // say.  Return false until we have them.
+                bool check_index()
+                {
+                        if(m_held.size() - m_start < m_index.size() + footer_length)
+                                return false;
+                        string footer;
+                        for(size_t i = 0; i < footer_length; i++)
+                                footer += static_cast<char>(static_cast<unsigned long long>(m_index.size()) >> (8 * i));
+                        if(0 != m_held.compare(m_start, m_index.size(), m_index)
+                           || 0 != m_held.compare(m_start + m_index.size(), footer_length, footer))
+                                bad_header();
+                        m_held.clear();
+                        m_start = 0;
+                        return true;
+                }
+
+                Codec m_codec;
+                unsigned long long m_length;
+                unsigned long long m_frame_size;        /* 0 until we read it */
+                unsigned long long m_text_offset;       /* of the next frame */
+                string m_held;
+                size_t m_start;                 /* of what we haven't used in m_held */
+                string m_index;                 /* as the frames we've decoded give it */
+                unsigned int m_threads;
+        };
+
+
+        /*
+          The dictionary a header names (by in_id, or 0 for none).
+        */
+        shared_ptr<const CompressDictionary> find_dictionary(Codec in_codec,
+                                                             unsigned long in_id,
+                                                             const DictionarySource *in_dictionaries)
+        {
+                shared_ptr<const CompressDictionary> dictionary;
+                if(0 == in_id)
+                        return dictionary;
+                if(codec_zstd != in_codec)
+                        bad_header();
+                if(in_dictionaries)
+                        dictionary = in_dictionaries->dictionary(in_id);
+                if(!dictionary) {
+                        string the_error("Compressed data needs dictionary " + to_string(in_id)
+                                         + ", which we don't have.");
+                        cerr << the_error << endl;
+                        throw(domain_error(the_error));
+                }
+                return dictionary;
+        }
+
+
+        CodecStream *make_decompressor(Codec in_codec,
+                                       const shared_ptr<const CompressDictionary> &in_dictionary,
+                                       bool in_length_known,
+                                       unsigned long long in_length)
+        {
+                switch(in_codec) {
+                case codec_bzip2:
+                        return new BzipDecompressor;
+                case codec_zstd:
+                        return new ZstdDecompressor(in_dictionary);
+                case codec_lz4:
+                        return new Lz4Decompressor;
+                case codec_stored:
+                        return new StoredDecompressor(in_length_known, in_length);
+                }
+                string the_error("Compressed data names an unknown codec.");
                 cerr << the_error << endl;
                 throw(domain_error(the_error));
-        case BZ_OK:
-                break;
-        default:
-                the_error = "Unexpected return from BZ2_bzBuffToBuffDecompress";
-                cerr << the_error << endl;
-                throw(logic_error(the_error));
+        }
+}
+
+
+
+CompressDictionary::CompressDictionary(unsigned long in_id, const string &in_content)
+        : m_id(in_id), m_content(in_content),
+          m_ddict(ZSTD_createDDict(m_content.data(), m_content.size()))
+{
+        if(0 == m_id)
+                throw(invalid_argument("CompressDictionary: id 0"));
+        if(!m_ddict)
+                throw(length_error("Insufficient memory available in ZSTD_createDDict"));
+}
+
+
+
+CompressDictionary::~CompressDictionary()
+{
+        ZSTD_freeDDict(m_ddict);
+        for(auto &cdict : m_cdicts)
+                ZSTD_freeCDict(cdict.second);
+}
+
+
+
+/*
+  Digesting the dictionary takes longer than compressing a small
+  block, so we do it once for each level.
+*/
+const ZSTD_CDict *CompressDictionary::compress_dictionary(int in_level) const
+{
+        boost::mutex::scoped_lock lock(m_mutex);
+        ZSTD_CDict *&cdict = m_cdicts[in_level];
+        if(!cdict)
+                cdict = ZSTD_createCDict(m_content.data(), m_content.size(), in_level);
+        if(!cdict)
+                throw(length_error("Insufficient memory available in ZSTD_createCDict"));
+        return cdict;
+}
+
+
+
+string cryptar::train_dictionary(const vector<string> &in_samples, size_t in_size)
+{
+        string samples;
+        vector<size_t> sizes;
+        for(const string &sample : in_samples) {
+                samples += sample;
+                sizes.push_back(sample.size());
+        }
+        string dictionary(in_size, '\0');
+        const size_t length = ZDICT_trainFromBuffer(&dictionary[0], dictionary.size(),
+                                                    samples.data(), sizes.data(), sizes.size());
+        if(ZDICT_isError(length))
+                throw(runtime_error(string("ZDICT_trainFromBuffer: ") + ZDICT_getErrorName(length)));
+        dictionary.resize(length);
+        return dictionary;
+}
+
+
+
+/*
+  Decompress into a buffer.  If the header says how long the text is,
+  the codec writes straight into the buffer.  Otherwise we stream.
+*/
+size_t cryptar::decompress(const char *in_buf, size_t in_len, char *out_buf, size_t in_out_size,
+                           const DictionarySource *in_dictionaries)
+{
+        Header header;
+        if(parse_header(in_buf, in_len, header) && header.m_length_known) {
+                const unsigned long long length = header.m_length;
+                if(length > in_out_size)
+                        throw(length_error("decompress(): buffer too small"));
+                const char *body = in_buf + header.m_header_length;
+                const size_t body_length = in_len - header.m_header_length;
+                if(header.m_container) {
+                        decode_container(header.m_codec, body, body_length, length, 0, out_buf, length);
+                        return length;
+                }
+                if(decode_frame(header.m_codec,
+                                find_dictionary(header.m_codec, header.m_dictionary, in_dictionaries).get(),
+                                body, body_length, out_buf, length))
+                        return length;
+        }
+        BufferSink sink(out_buf, in_out_size);
+        DecompressSink decompress(sink, in_dictionaries);
+        decompress.write(in_buf, in_len);
+        decompress.close();
+        return sink.length();
+}
+
+
+namespace {
+        // Keep the bytes from in_offset that fit in the buffer.
+        class RangeSink : public ByteSink {
+        public:
+                RangeSink(unsigned long long in_offset, char *out_buf, size_t in_size)
+                        : m_skip(in_offset), m_buf(out_buf), m_size(in_size), m_length(0) {};
+                virtual void write(const char *in_buf, size_t in_len)
+                {
+                        const size_t skip = min<unsigned long long>(in_len, m_skip);
+                        m_skip -= skip;
+                        const size_t take = min(in_len - skip, m_size - m_length);
+                        memcpy(m_buf + m_length, in_buf + skip, take);
+                        m_length += take;
+                }
+                size_t length() const { return m_length; }
+
+        private:
+                unsigned long long m_skip;
+                char *m_buf;
+                size_t m_size;
+                size_t m_length;
         };
-        
-        string out_buf(out_buf_raw, uncompressed_size_hint);
-        return(out_buf);
 }
 
 
+size_t cryptar::decompress_range(const char *in_buf,
+                                 size_t in_len,
+                                 unsigned long long in_offset,
+                                 char *out_buf,
+                                 size_t in_out_len,
+                                 const DictionarySource *in_dictionaries)
+{
+        Header header;
+        if(parse_header(in_buf, in_len, header) && header.m_container)
+                return decode_container(header.m_codec,
+                                        in_buf + header.m_header_length, in_len - header.m_header_length,
+                                        header.m_length, in_offset, out_buf, in_out_len);
+        RangeSink sink(in_offset, out_buf, in_out_len);
+        DecompressSink decompress(sink, in_dictionaries);
+        decompress.write(in_buf, in_len);
+        decompress.close();
+        return sink.length();
+}
+
+
+
+CompressSink::CompressSink(ByteSink &out_sink, const CompressParams &in_params)
+        : m_sink(out_sink), m_params(in_params), m_stream(make_compressor(in_params)),
+          m_codec(in_params.m_codec),
+          m_dictionary(in_params.dictionary() ? in_params.dictionary()->id() : 0),
+          m_length(0), m_written(0), m_length_known(false), m_started(false), m_open(true),
+          m_container(false), m_threads(threads_for(in_params.m_threads))
+{
+}
+
+
+
+CompressSink::~CompressSink()
+{
+}
+
+
+
+void CompressSink::write(const char *in_buf, size_t in_len)
+{
+        if(!m_open)
+                throw(logic_error("CompressSink::write() after close()"));
+        start();
+        m_written += in_len;
+        if(m_length_known && m_written > m_length)
+                throw(logic_error("CompressSink::write() past the length expected"));
+        if(m_container)
+                add_to_frames(in_buf, in_len);
+        else
+                m_stream->write(in_buf, in_len, m_sink);
+}
+
+
+
+void CompressSink::expect(size_t in_len)
+{
+        if(m_started)
+                throw(logic_error("CompressSink::expect() after write()"));
+        m_stream->expect(in_len);
+        m_length = in_len;
+        m_length_known = true;
+}
+
+
+
+/*
+  Write the header, once.  A container's frames don't use the
+  dictionary (the texts that do are shorter than a frame).
+*/
+void CompressSink::start()
+{
+        if(m_started)
+                return;
+        m_started = true;
+        m_container = codec_stored != m_codec && m_params.m_frame_size
+                && m_length_known && m_length > m_params.m_frame_size;
+        if(m_container) {
+                m_stream.reset();
+                m_params.m_dictionary.reset();
+                m_dictionary = 0;
+                m_piece.reserve(m_params.m_frame_size);
+                string header(1, container_tag);
+                header += static_cast<char>(m_codec);
+                put_number(header, m_length);
+                put_number(header, m_params.m_frame_size);
+                m_sink.write(header.data(), header.size());
+                return;
+        }
+        string header(1, m_length_known ? frame_tag : codec_tag);
+        header += static_cast<char>(m_codec | (m_dictionary ? dictionary_flag : 0));
+        if(m_length_known)
+                put_number(header, m_length);
+        if(m_dictionary)
+                put_number(header, m_dictionary);
+        m_sink.write(header.data(), header.size());
+}
+
+
+
+void CompressSink::close()
+{
+        if(!m_open)
+                return;
+        start();
+        if(m_length_known && m_written != m_length)
+                throw(logic_error("CompressSink::close() short of the length expected"));
+        if(m_container) {
+                if(!m_piece.empty()) {
+                        m_pieces.push_back(string());
+                        m_pieces.back().swap(m_piece);
+                }
+                compress_pieces();
+                const unsigned long long index_length = m_index.size();
+                for(size_t i = 0; i < footer_length; i++)
+                        m_index += static_cast<char>(index_length >> (8 * i));
+                m_sink.write(m_index.data(), m_index.size());
+                m_index.clear();
+        } else
+                m_stream->finish(m_sink);
+        m_stream.reset();
+        m_open = false;
+        m_sink.close();
+}
+
+
+
+// Cut what we're given into frames, and compress them a batch at a time.
+void CompressSink::add_to_frames(const char *in_buf, size_t in_len)
+{
+        while(in_len > 0) {
+                const size_t take = min<size_t>(in_len, m_params.m_frame_size - m_piece.size());
+                m_piece.append(in_buf, take);
+                in_buf += take;
+                in_len -= take;
+                if(m_piece.size() == m_params.m_frame_size) {
+                        m_pieces.push_back(string());
+                        m_pieces.back().swap(m_piece);
+                        m_piece.reserve(m_params.m_frame_size);
+                }
+                if(m_pieces.size() == m_threads)
+                        compress_pieces();
+        }
+}
+
+
+
+/*
+  Compress a batch of frames and write them, each after its length,
+  and note their lengths for the index.
+*/
+void CompressSink::compress_pieces()
+{
+        vector<string> frames(m_pieces.size());
+        parallel_for(m_pieces.size(), m_threads, [&](size_t in_i) {
+                frames[in_i] = compress_frame(m_params, m_pieces[in_i]);
+        });
+        m_pieces.clear();
+        for(const string &frame : frames) {
+                string length;
+                put_number(length, frame.size());
+                m_sink.write(length.data(), length.size());
+                m_sink.write(frame.data(), frame.size());
+                put_number(m_index, frame.size());
+        }
+}
+
+
+
+DecompressSink::DecompressSink(ByteSink &out_sink, const DictionarySource *in_dictionaries)
+        : m_sink(out_sink), m_dictionaries(in_dictionaries), m_length(0), m_length_known(false), m_open(true), m_done(false)
+{
+}
+
+
+
+DecompressSink::~DecompressSink()
+{
+}
+
+
+
+/*
+  The header tells us which codec to decompress with, and perhaps
+  how much text to expect.  Anything after the end of the compressed
+  stream is ignored.
+
+  We hold no more than the codec does, so a frame may be larger than
+  memory.  Of a container, we hold a batch of frames at a time.
+*/
+void DecompressSink::write(const char *in_buf, size_t in_len)
+{
+        if(!m_open)
+                throw(logic_error("DecompressSink::write() after close()"));
+        if(!m_stream && in_len > 0) {
+                const size_t held = m_header.size();
+                m_header.append(in_buf, min(in_len, max_header_length - held));
+                Header header;
+                if(!parse_header(m_header.data(), m_header.size(), header))
+                        return;         // we took all of in_buf
+                m_length_known = header.m_length_known;
+                m_length = header.m_length;
+                if(header.m_container)
+                        m_stream.reset(new ContainerDecompressor(header.m_codec, m_length));
+                else
+                        m_stream.reset(make_decompressor(header.m_codec,
+                                                         find_dictionary(header.m_codec, header.m_dictionary,
+                                                                         m_dictionaries),
+                                                         m_length_known, m_length));
+                in_buf += header.m_header_length - held;
+                in_len -= header.m_header_length - held;
+                m_header.clear();
+        }
+        if(in_len > 0 && !m_done)
+                m_done = m_stream->write(in_buf, in_len, m_sink);
+}
+
+
+
+void DecompressSink::close()
+{
+        if(!m_open)
+                return;
+        const bool done = m_done || (m_stream && m_stream->complete());
+        const bool bad_length = done && m_length_known && m_stream->produced() != m_length;
+        m_stream.reset();
+        m_open = false;
+        if(!done)
+                ends_unexpectedly();
+        if(bad_length)
+                wrong_length();
+        m_sink.close();
+}
@@ -23,13 +23,314 @@
 #define __COMPRESS_H__ 1
 
 
+#include <boost/serialization/access.hpp>
+#include <boost/thread/mutex.hpp>
+#include <map>
+#include <memory>
 #include <string>
+#include <vector>
+
+#include "pipeline.h"
+
+
+struct ZSTD_CDict_s;
+struct ZSTD_DDict_s;
 
 
 namespace cryptar {
 
-        std::string compress(const std::string &);
-        std::string decompress(const std::string &, unsigned int = 0);        
+        /*
+          The codecs we compress with.  Each compressed payload starts
+          with a tag naming its codec (cf. compress.cpp), so a store
+          may hold blocks of several codecs at once.
+
+          Do not renumber: values are persisted in payloads and in
+          the store's config.
+        */
+        enum Codec {
+                codec_bzip2 = 1,
+                codec_zstd = 2,
+                codec_lz4 = 3,
+                codec_stored = 4,       /* not compressed at all */
+        };
+
+        const char *codec_name(Codec in_codec);
+
+
+        class LocalFile;
+
+
+        /*
+          A dictionary of text that small blocks tend to share (cf.
+          train_dictionary()), against which zstd compresses them
+          much better than each on its own.  The store numbers its
+          dictionaries from 1, and a payload compressed against one
+          names it in its header.
+
+          A dictionary is immutable and may be shared between
+          threads.
+        */
+        class CompressDictionary {
+        public:
+                CompressDictionary(unsigned long in_id, const std::string &in_content);
+                ~CompressDictionary();
+
+                unsigned long id() const { return m_id; }
+                const std::string &content() const { return m_content; }
+
+                // The dictionary, digested for zstd at in_level.
+                const ZSTD_CDict_s *compress_dictionary(int in_level) const;
+                const ZSTD_DDict_s *decompress_dictionary() const { return m_ddict; }
+
+        private:
+                CompressDictionary(const CompressDictionary &);
+                CompressDictionary &operator=(const CompressDictionary &);
+
+                unsigned long m_id;
+                std::string m_content;
+                ZSTD_DDict_s *m_ddict;
+                mutable boost::mutex m_mutex;
+                mutable std::map<int, ZSTD_CDict_s *> m_cdicts;
+        };
+
+        /*
+          Texts up to this long compress against the store's
+          dictionary.  Longer ones have enough context of their own.
+        */
+        const size_t dictionary_text_limit = 64 * 1024;
+        const size_t default_dictionary_size = 64 * 1024;
+
+        /*
+          Train a dictionary of up to in_size bytes from sample
+          texts.  zstd wants a hundred or so samples, and about a
+          hundred times in_size bytes of them in all, to do well.
+          Throw std::runtime_error if the samples are too few.
+        */
+        std::string train_dictionary(const std::vector<std::string> &in_samples,
+                                     size_t in_size = default_dictionary_size);
+
+        /*
+          Where DecompressSink finds the dictionary a payload's header
+          names.  Return null if there is no such dictionary.
+        */
+        class DictionarySource {
+        public:
+                virtual ~DictionarySource() {};
+                virtual std::shared_ptr<const CompressDictionary> dictionary(unsigned long in_id) const = 0;
+        };
+
+
+        /*
+          How to compress.  The level means what the codec means by
+          it: for bzip2 the block size in units of 100k (1 to 9), for
+          zstd its level (1 to 19, and more with more memory), for
+          lz4 its fast mode at 0 to 2 and its high compression mode
+          from 3 to 12.  Level 0 means the codec's default.
+
+          With m_probe, we first look at a sample of each text, and
+          store it uncompressed if it doesn't look like it would
+          compress (cf. looks_compressible()).  The choice is in the
+          payload's header.
+
+          With m_dictionary, zstd compresses texts of up to
+          dictionary_text_limit bytes against it.  The store sets
+          the dictionary (cf. Transport); it isn't persisted here.
+
+          With m_frame_size, a text of known length longer than that
+          is cut into frames of m_frame_size bytes, which are
+          compressed each on its own, on m_threads threads (0 for as
+          many as we have cores, if mode(Threads)), and decompressed
+          the same way.  A frame is also the unit of random access
+          (cf. decompress_range()).  The frames are the same however
+          many threads there are, so m_threads isn't persisted.
+        */
+        struct CompressParams {
+                CompressParams()
+                        : m_codec(codec_bzip2), m_level(0), m_probe(false), m_frame_size(0), m_threads(0) {};
+                CompressParams(Codec in_codec, int in_level = 0)
+                        : m_codec(in_codec), m_level(in_level), m_probe(false), m_frame_size(0), m_threads(0) {};
+
+                Codec m_codec;
+                int m_level;
+                bool m_probe;
+                std::shared_ptr<const CompressDictionary> m_dictionary;
+                unsigned long m_frame_size;     /* 0: never cut into frames */
+                unsigned int m_threads;
+
+                // Throw std::invalid_argument if the parameters make no sense.
+                void validate() const;
+
+                // The params for this text: ours, or codec_stored if
+                // we probe and it doesn't look worth compressing, and
+                // without the dictionary if it's too long to use it.
+                CompressParams for_text(const char *in_buf, size_t in_len) const;
+                CompressParams for_text(const LocalFile &in_file) const;
+
+                // The dictionary we would compress with, or null.
+                const CompressDictionary *dictionary() const
+                { return codec_zstd == m_codec ? m_dictionary.get() : 0; }
+
+        private:
+                CompressParams sized(unsigned long long in_len) const;
+                CompressParams probed(bool in_compressible, unsigned long long in_len) const;
+
+                friend class boost::serialization::access;
+                template<class Archive>
+                        void serialize(Archive &in_ar, const unsigned int in_version) {
+                        in_ar & m_codec;
+                        in_ar & m_level;
+                        in_ar & m_probe;
+                        in_ar & m_frame_size;
+                }
+        };
+
+        const unsigned long default_frame_size = 1024 * 1024;
+        const unsigned long max_frame_size = 1024 * 1024 * 1024;
+
+
+        /*
+          Whether text looks worth compressing.  We try lz4 at its
+          fastest on a few samples, and estimate the entropy of their
+          bytes.  Text that lz4 can barely shrink and whose bytes look
+          random (already compressed, or encrypted, or media) is not.
+          Either test alone is fooled: lz4 can't shrink text of a
+          small alphabet without repeats, and text of repeated random
+          runs has high byte entropy.
+        */
+        bool looks_compressible(const char *in_buf, size_t in_len);
+
+        // What for_text() has decided, in this process.
+        struct ProbeStats {
+                ProbeStats() : m_probed(0), m_stored(0), m_bytes_probed(0), m_bytes_stored(0) {};
+                double skip_rate() const { return m_probed ? double(m_stored) / m_probed : 0; }
+
+                unsigned long m_probed;         /* texts */
+                unsigned long m_stored;         /* texts we didn't compress */
+                unsigned long long m_bytes_probed;
+                unsigned long long m_bytes_stored;
+        };
+        ProbeStats probe_stats();
+        void reset_probe_stats();
+
+
+        std::string compress(const std::string &in_buf,
+                             const CompressParams &in_params = CompressParams());
+        // Whatever the codec, or none at all for the oldest blocks (bzip2).
+        std::string decompress(const std::string &in_buf,
+                               const DictionarySource *in_dictionaries = 0);
+
+        /*
+          Decompress into out_buf, which has room for in_out_size
+          bytes, and return the length of the text.  Throw
+          std::length_error if there isn't room.
+        */
+        size_t decompress(const char *in_buf, size_t in_len, char *out_buf, size_t in_out_size,
+                          const DictionarySource *in_dictionaries = 0);
+
+        /*
+          The length of the text of a compressed payload, from its
+          header.  Return false if the header doesn't say (the
+          payload was compressed as a stream of unknown length, or is
+          one of the oldest) or if in_len bytes don't reach that far.
+        */
+        bool decompressed_length(const char *in_buf, size_t in_len, unsigned long long &out_length);
+
+        /*
+          Decompress up to in_out_len bytes of the text, from
+          in_offset, into out_buf, and return how many there were.
+          Of a container of frames, we decompress just the frames
+          that hold them.  Of anything else, we decompress from the
+          start.
+        */
+        size_t decompress_range(const char *in_buf,
+                                size_t in_len,
+                                unsigned long long in_offset,
+                                char *out_buf,
+                                size_t in_out_len,
+                                const DictionarySource *in_dictionaries = 0);
+
+
+        // One codec's compressor or decompressor (cf. compress.cpp).
+        class CodecStream;
+
+
+        /*
+          The same as pipeline stages.  The output is that of
+          compress() and decompress(), but neither side ever holds
+          more than a piece of it.  Of a container, each side holds
+          the text of as many frames as it has threads, and
+          CompressSink writes each batch of frames as soon as it has
+          compressed them.
+        */
+        class CompressSink : public ByteSink {
+        public:
+                explicit CompressSink(ByteSink &out_sink,
+                                      const CompressParams &in_params = CompressParams());
+                virtual ~CompressSink();
+                virtual void write(const char *in_buf, size_t in_len);
+                virtual void close();
+
+                /*
+                  Promise to write exactly in_len bytes, before the
+                  first write().  The length goes in the header, so
+                  the text can be decompressed into a buffer of
+                  exactly its size, and the codec may size itself to
+                  the text (zstd's tables at high levels are far
+                  bigger than a small block).
+                */
+                void expect(size_t in_len);
+
+        private:
+                CompressSink(const CompressSink &);
+                CompressSink &operator=(const CompressSink &);
+
+                void start();
+                void add_to_frames(const char *in_buf, size_t in_len);
+                void compress_pieces();
+
+                ByteSink &m_sink;
+                CompressParams m_params;
+                std::unique_ptr<CodecStream> m_stream;
+                Codec m_codec;
+                unsigned long m_dictionary;     /* its id, or 0 */
+                unsigned long long m_length;    /* as promised to expect() */
+                unsigned long long m_written;
+                bool m_length_known;
+                bool m_started;                 /* the header is written */
+                bool m_open;
+                bool m_container;               /* of frames */
+                unsigned int m_threads;
+                std::string m_piece;            /* the frame we're filling */
+                std::vector<std::string> m_pieces;      /* full, to compress */
+                std::string m_index;            /* of the frames we've written */
+        };
+
+
+        /*
+          A payload compressed against a dictionary needs
+          in_dictionaries to find it.
+        */
+        class DecompressSink : public ByteSink {
+        public:
+                explicit DecompressSink(ByteSink &out_sink,
+                                        const DictionarySource *in_dictionaries = 0);
+                virtual ~DecompressSink();
+                virtual void write(const char *in_buf, size_t in_len);
+                virtual void close();
+
+        private:
+                DecompressSink(const DecompressSink &);
+                DecompressSink &operator=(const DecompressSink &);
+
+                ByteSink &m_sink;
+                const DictionarySource *m_dictionaries;
+                std::string m_header;           /* until we have all of it */
+                std::unique_ptr<CodecStream> m_stream;
+                unsigned long long m_length;    /* as the header says */
+                bool m_length_known;
+                bool m_open;
+                bool m_done;
+        };
         
 }
 
@@ -0,0 +1,176 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+
+#include <boost/filesystem.hpp>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "cryptar.h"
+
+
+using namespace cryptar;
+using namespace std;
+
+
+/*
+  Compression ratio against speed for each codec at a few levels.
+  The text is the source in the current directory (so run from
+  src/), cut into blocks of a few sizes, since small blocks compress
+  worse than large ones.  Random bytes show what each codec costs
+  on data that doesn't compress.  With "probe", each block is
+  sampled first and stored if it doesn't look compressible; we show
+  what fraction of blocks that skipped.  With "dict", zstd
+  compresses small blocks against a dictionary trained on every
+  fourth 512 byte block of the source.
+*/
+
+
+namespace {
+
+        double mb_per_second(unsigned long in_bytes,
+                             chrono::steady_clock::time_point in_start,
+                             chrono::steady_clock::time_point in_end)
+        {
+                double seconds = chrono::duration<double>(in_end - in_start).count();
+                return static_cast<double>(in_bytes) / (1024 * 1024) / seconds;
+        }
+
+
+        string source_text()
+        {
+                ostringstream text;
+                boost::filesystem::directory_iterator end;
+                for(boost::filesystem::directory_iterator it("."); it != end; ++it) {
+                        const string ext = it->path().extension().string();
+                        if(".cpp" != ext && ".h" != ext)
+                                continue;
+                        ifstream in(it->path().string());
+                        text << in.rdbuf();
+                }
+                return text.str();
+        }
+
+
+        class OneDictionary : public DictionarySource {
+        public:
+                explicit OneDictionary(const shared_ptr<const CompressDictionary> &in_dictionary)
+                        : m_dictionary(in_dictionary) {};
+                virtual shared_ptr<const CompressDictionary> dictionary(unsigned long in_id) const
+                { return m_dictionary; }
+
+        private:
+                shared_ptr<const CompressDictionary> m_dictionary;
+        };
+
+
+        void bench(const string &in_name,
+                   const string &in_text,
+                   unsigned long in_block_size,
+                   const CompressParams &in_params)
+        {
+                vector<string> compressed;
+                unsigned long compressed_bytes = 0;
+                reset_probe_stats();
+                auto start = chrono::steady_clock::now();
+                for(unsigned long offset = 0; offset < in_text.size(); offset += in_block_size) {
+                        compressed.push_back(compress(in_text.substr(offset, in_block_size), in_params));
+                        compressed_bytes += compressed.back().size();
+                }
+                auto compressed_at = chrono::steady_clock::now();
+                unsigned long check = 0;
+                const OneDictionary dictionary(in_params.m_dictionary);
+                for(auto it = compressed.begin(); it != compressed.end(); ++it)
+                        check += decompress(*it, &dictionary).size();
+                auto end = chrono::steady_clock::now();
+                if(check != in_text.size())
+                        cout << "decompression lost bytes!" << endl;
+
+                ostringstream codec;
+                codec << codec_name(in_params.m_codec) << " " << in_params.m_level;
+                if(in_params.m_probe)
+                        codec << " probe";
+                if(in_params.dictionary())
+                        codec << " dict";
+                if(in_params.m_frame_size)
+                        codec << " frames";
+                cout << setw(8) << left << in_name
+                     << setw(8) << right << in_block_size
+                     << "  " << setw(14) << left << codec.str()
+                     << setw(8) << right << fixed << setprecision(3)
+                     << static_cast<double>(compressed_bytes) / in_text.size() << " ratio"
+                     << setw(9) << setprecision(1)
+                     << mb_per_second(in_text.size(), start, compressed_at) << " MB/s in"
+                     << setw(9) << mb_per_second(in_text.size(), compressed_at, end) << " MB/s out";
+                if(in_params.m_probe)
+                        cout << setw(7) << setprecision(1) << 100 * probe_stats().skip_rate() << "% stored";
+                cout << endl;
+        }
+}
+
+
+int main(int argc, char *argv[])
+{
+        CompressParams probe(codec_zstd, 3);
+        probe.m_probe = true;
+        const string source(source_text());
+        vector<string> samples;
+        for(unsigned long offset = 0; offset < source.size(); offset += 4 * 512)
+                samples.push_back(source.substr(offset, 512));
+        CompressParams dictionary(codec_zstd, 3);
+        dictionary.m_dictionary.reset(new CompressDictionary(1, train_dictionary(samples)));
+        CompressParams framed(codec_zstd, 3);
+        framed.m_frame_size = 128 * 1024;
+        const CompressParams all_params[] = {
+                CompressParams(codec_bzip2, 1),
+                CompressParams(codec_bzip2, 9),
+                CompressParams(codec_zstd, 1),
+                CompressParams(codec_zstd, 3),
+                CompressParams(codec_zstd, 9),
+                CompressParams(codec_zstd, 19),
+                CompressParams(codec_lz4, 0),
+                CompressParams(codec_lz4, 9),
+                CompressParams(codec_stored),
+                probe,
+                dictionary,
+                framed,
+        };
+        const string random(pseudo_random_string(4 * 1024 * 1024));
+        const unsigned long block_sizes[] = { 512, 8 * 1024, 1024 * 1024 };
+        for(unsigned long block_size : block_sizes) {
+                for(const CompressParams &params : all_params)
+                        bench("source", source, block_size, params);
+                cout << endl;
+        }
+        for(unsigned long block_size : block_sizes) {
+                for(const CompressParams &params : all_params)
+                        bench("random", random, block_size, params);
+                cout << endl;
+        }
+        return 0;
+}
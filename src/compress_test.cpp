@@ -22,8 +22,14 @@
 #define BOOST_TEST_MODULE tests
 #include <algorithm>
 #include <boost/test/unit_test.hpp>
+#include <bzlib.h>
+#include <map>
+#include <memory>
 #include <pstreams/pstream.h>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <vector>
 
 #include "cryptar.h"
 #include "test_text.h"
@@ -60,6 +66,456 @@ namespace {
                 }
                 
         }
+
+
+        // Decompress a piece at a time, so that pieces split the tag.
+        string decompress_pieces(const string &in_buf,
+                                 size_t in_piece,
+                                 const DictionarySource *in_dictionaries = 0)
+        {
+                string out;
+                StringSink sink(out);
+                DecompressSink decompress(sink, in_dictionaries);
+                for(size_t offset = 0; offset < in_buf.size(); offset += in_piece)
+                        decompress.write(in_buf.data() + offset, min(in_piece, in_buf.size() - offset));
+                decompress.close();
+                return out;
+        }
+
+
+        /*
+          Each codec, at a few levels, gives back what it was given,
+          tags its output, and decodes however the input is cut.
+        */
+        void test_codecs()
+        {
+                const vector<CompressParams> all_params = {
+                        CompressParams(codec_bzip2), CompressParams(codec_bzip2, 9),
+                        CompressParams(codec_zstd), CompressParams(codec_zstd, 1),
+                        CompressParams(codec_zstd, 19), CompressParams(codec_lz4),
+                        CompressParams(codec_lz4, 9), CompressParams(codec_stored),
+                };
+                string text;
+                while(text.size() < 300000)
+                        text += "The quick brown fox jumps over the lazy dog.  ";
+                const vector<string> messages = {
+                        string(), string("a"), pseudo_random_string(1000),
+                        text, pseudo_random_string(200000) + text,
+                };
+                for(const CompressParams &params : all_params)
+                        for(const string &message : messages) {
+                                const string compressed(compress(message, params));
+                                BOOST_REQUIRE(compressed.size() >= 2);
+                                BOOST_CHECK_EQUAL('\xcd', compressed[0]);
+                                BOOST_CHECK_EQUAL(params.m_codec, compressed[1]);
+                                BOOST_CHECK(decompress(compressed) == message);
+                                BOOST_CHECK(decompress_pieces(compressed, 1000) == message);
+                                if(message.size() < 2000)
+                                        BOOST_CHECK(decompress_pieces(compressed, 1) == message);
+                                if(message == text && codec_stored != params.m_codec)
+                                        BOOST_CHECK(compressed.size() < message.size() / 10);
+                        }
+        }
+
+
+        /*
+          The oldest blocks are bare bzip2 streams, with no tag.
+        */
+        void test_untagged()
+        {
+                const string message(pseudo_random_string(10000) + string(10000, 'x'));
+                unsigned int length = message.size() * 2 + 600;
+                string compressed(length, '\0');
+                BOOST_REQUIRE_EQUAL(BZ_OK, BZ2_bzBuffToBuffCompress(&compressed[0], &length,
+                                                                    const_cast<char *>(message.data()),
+                                                                    message.size(), 1, 0, 0));
+                compressed.resize(length);
+                BOOST_CHECK(decompress(compressed) == message);
+                BOOST_CHECK(decompress_pieces(compressed, 1) == message);
+        }
+
+
+        /*
+          compress() records the length of the text, so decompress()
+          can write straight into a buffer of that size.  A stream
+          of unknown length has no length in its header, and still
+          decompresses into a big enough buffer.
+        */
+        void test_frames()
+        {
+                const string message(pseudo_random_string(5000) + string(100000, 'z'));
+                for(Codec codec : { codec_bzip2, codec_zstd, codec_lz4, codec_stored }) {
+                        const string framed(compress(message, CompressParams(codec)));
+                        unsigned long long length;
+                        BOOST_REQUIRE(decompressed_length(framed.data(), framed.size(), length));
+                        BOOST_CHECK_EQUAL(message.size(), length);
+                        BOOST_CHECK(!decompressed_length(framed.data(), 3, length));
+
+                        string unframed;
+                        StringSink sink(unframed);
+                        CompressSink compress(sink, CompressParams(codec));
+                        compress.write(message.data(), message.size());
+                        compress.close();
+                        BOOST_CHECK_EQUAL('\xcc', unframed[0]);
+                        BOOST_CHECK(!decompressed_length(unframed.data(), unframed.size(), length));
+                        BOOST_CHECK(decompress(unframed) == message);
+
+                        for(const string &payload : { framed, unframed }) {
+                                vector<char> buf(message.size() + 10);
+                                BOOST_CHECK_EQUAL(message.size(),
+                                                  decompress(payload.data(), payload.size(),
+                                                             buf.data(), message.size()));
+                                BOOST_CHECK(string(buf.data(), message.size()) == message);
+                                BOOST_CHECK_EQUAL(message.size(),
+                                                  decompress(payload.data(), payload.size(),
+                                                             buf.data(), buf.size()));
+                                BOOST_CHECK_THROW(decompress(payload.data(), payload.size(),
+                                                             buf.data(), message.size() - 1),
+                                                  length_error);
+                        }
+
+                        // A header that lies about the length.
+                        string lying(framed);
+                        lying[2] ^= 1;
+                        BOOST_CHECK_THROW(decompress(lying), domain_error);
+                        BOOST_CHECK_THROW(decompress_pieces(lying, 1000), domain_error);
+                }
+        }
+
+
+        // Count what we're given, and keep none of it.
+        class CountingSink : public ByteSink {
+        public:
+                CountingSink() : m_length(0), m_sum(0) {};
+                virtual void write(const char *in_buf, size_t in_len)
+                {
+                        m_length += in_len;
+                        for(size_t i = 0; i < in_len; i++)
+                                m_sum += static_cast<unsigned char>(in_buf[i]);
+                }
+
+                unsigned long long m_length;
+                unsigned long long m_sum;
+        };
+
+
+        // Count what we're given, and pass it on.
+        class PassingSink : public ByteSink {
+        public:
+                explicit PassingSink(ByteSink &out_sink) : m_sink(out_sink), m_length(0) {};
+                virtual void write(const char *in_buf, size_t in_len)
+                {
+                        m_length += in_len;
+                        m_sink.write(in_buf, in_len);
+                }
+                virtual void close() { m_sink.close(); }
+
+                ByteSink &m_sink;
+                unsigned long long m_length;
+        };
+
+
+        /*
+          A frame decodes a piece at a time, so neither side need
+          hold it all.
+        */
+        void test_stream()
+        {
+                const unsigned long long length = 64ULL * 1024 * 1024;
+                const string piece(pseudo_random_string(4096) + string(60 * 1024, 'q'));
+                CountingSink counter;
+                DecompressSink decompress(counter);
+                CompressSink compress(decompress, CompressParams(codec_zstd, 1));
+                compress.expect(length);
+                unsigned long long sum = 0;
+                for(unsigned long long written = 0; written < length; written += piece.size()) {
+                        const size_t len = min<unsigned long long>(piece.size(), length - written);
+                        compress.write(piece.data(), len);
+                        for(size_t i = 0; i < len; i++)
+                                sum += static_cast<unsigned char>(piece[i]);
+                }
+                compress.close();
+                BOOST_CHECK_EQUAL(length, counter.m_length);
+                BOOST_CHECK_EQUAL(sum, counter.m_sum);
+        }
+
+
+        /*
+          With m_probe, random text is stored rather than compressed,
+          and text that compresses is compressed as asked.
+        */
+        void test_probe()
+        {
+                string text;
+                while(text.size() < 100000)
+                        text += "Pack my box with five dozen liquor jugs.  ";
+                // Mostly random, but with a compressible stretch in
+                // the middle, which the samples should miss.
+                const string noise(pseudo_random_string(50000) + text.substr(0, 5000) +
+                                   pseudo_random_string(50000));
+                const string small_noise(pseudo_random_string(512));
+
+                CompressParams params(codec_zstd, 3);
+                BOOST_CHECK_EQUAL(codec_zstd, params.for_text(noise.data(), noise.size()).m_codec);
+                params.m_probe = true;
+                reset_probe_stats();
+                BOOST_CHECK_EQUAL(codec_stored, params.for_text(noise.data(), noise.size()).m_codec);
+                BOOST_CHECK_EQUAL(codec_stored,
+                                  params.for_text(small_noise.data(), small_noise.size()).m_codec);
+                const CompressParams for_text(params.for_text(text.data(), text.size()));
+                BOOST_CHECK_EQUAL(codec_zstd, for_text.m_codec);
+                BOOST_CHECK_EQUAL(3, for_text.m_level);
+                BOOST_CHECK_EQUAL(codec_zstd, params.for_text(0, 0).m_codec);
+
+                const ProbeStats stats(probe_stats());
+                BOOST_CHECK_EQUAL(4, stats.m_probed);
+                BOOST_CHECK_EQUAL(2, stats.m_stored);
+                BOOST_CHECK_EQUAL(noise.size() + small_noise.size() + text.size(), stats.m_bytes_probed);
+                BOOST_CHECK_EQUAL(noise.size() + small_noise.size(), stats.m_bytes_stored);
+                BOOST_CHECK_CLOSE(0.5, stats.skip_rate(), 1e-9);
+
+                const string stored(compress(noise, params));
+                BOOST_CHECK_EQUAL(codec_stored, stored[1]);
+                BOOST_CHECK(stored.size() < noise.size() + 8);
+                BOOST_CHECK(decompress(stored) == noise);
+                BOOST_CHECK(decompress_pieces(stored, 777) == noise);
+                BOOST_CHECK_EQUAL(codec_zstd, compress(text, params)[1]);
+
+                // Stored text has no end marker of its own.
+                BOOST_CHECK_THROW(decompress(stored.substr(0, stored.size() - 1)), domain_error);
+                BOOST_CHECK_THROW(decompress_pieces(stored.substr(0, stored.size() - 1), 100),
+                                  domain_error);
+                BOOST_CHECK_THROW(decompress_pieces(stored + "x", 100), domain_error);
+        }
+
+
+        // Small texts much alike, as a store's metadata might be.
+        string record(unsigned int in_i)
+        {
+                ostringstream text;
+                text << "{ \"name\": \"file-" << in_i << ".txt\", \"size\": " << in_i * 7919 % 100000
+                     << ", \"owner\": \"" << (in_i % 3 ? "jeff" : "root") << "\", \"mode\": \"0644\""
+                     << ", \"block\": \"" << filename_from_random_bits(pseudo_random_string(12))
+                     << "\", \"modified\": \"2013-0" << 1 + in_i % 9 << "-1" << in_i % 10 << "\" }";
+                return text.str();
+        }
+
+
+        class Dictionaries : public DictionarySource {
+        public:
+                virtual shared_ptr<const CompressDictionary> dictionary(unsigned long in_id) const
+                {
+                        auto it = m_dictionaries.find(in_id);
+                        return m_dictionaries.end() == it ? shared_ptr<const CompressDictionary>() : it->second;
+                }
+
+                map<unsigned long, shared_ptr<const CompressDictionary> > m_dictionaries;
+        };
+
+
+        /*
+          Small texts compress much better against a dictionary
+          trained on their like, and the header names it.
+        */
+        void test_dictionary()
+        {
+                vector<string> samples;
+                for(unsigned int i = 0; i < 2000; i++)
+                        samples.push_back(record(i));
+                BOOST_CHECK_THROW(train_dictionary(vector<string>(samples.begin(), samples.begin() + 3)),
+                                  runtime_error);
+                Dictionaries dictionaries;
+                shared_ptr<const CompressDictionary> dictionary(new CompressDictionary(5, train_dictionary(samples)));
+                dictionaries.m_dictionaries[5] = dictionary;
+                BOOST_CHECK(dictionary->content().size() <= default_dictionary_size);
+
+                CompressParams plain(codec_zstd, 3);
+                CompressParams params(plain);
+                params.m_dictionary = dictionary;
+                size_t plain_length = 0;
+                size_t dictionary_length = 0;
+                for(unsigned int i = 5000; i < 5100; i++) {
+                        const string text(record(i));
+                        plain_length += compress(text, plain).size();
+                        const string compressed(compress(text, params));
+                        dictionary_length += compressed.size();
+                        BOOST_CHECK_EQUAL('\xcd', compressed[0]);
+                        BOOST_CHECK_EQUAL('\x82', compressed[1]);
+                        BOOST_CHECK(decompress(compressed, &dictionaries) == text);
+                        BOOST_CHECK(decompress_pieces(compressed, 1, &dictionaries) == text);
+                        BOOST_CHECK_THROW(decompress(compressed), domain_error);
+                }
+                BOOST_CHECK(dictionary_length < plain_length * 2 / 3);
+
+                // Without expect(), the id follows the codec.
+                const string text(record(1));
+                string unframed;
+                StringSink sink(unframed);
+                CompressSink compress_sink(sink, params);
+                compress_sink.write(text.data(), text.size());
+                compress_sink.close();
+                BOOST_CHECK_EQUAL('\xcc', unframed[0]);
+                BOOST_CHECK_EQUAL('\x82', unframed[1]);
+                BOOST_CHECK_EQUAL('\x05', unframed[2]);
+                BOOST_CHECK(decompress(unframed, &dictionaries) == text);
+
+                // Long texts don't use it, nor do other codecs.
+                const string long_text(pseudo_random_string(dictionary_text_limit + 1));
+                BOOST_CHECK_EQUAL('\x02', compress(long_text, params)[1]);
+                BOOST_CHECK(!params.for_text(long_text.data(), long_text.size()).m_dictionary);
+                params.m_codec = codec_lz4;
+                BOOST_CHECK(0 == params.dictionary());
+                BOOST_CHECK(decompress(compress(text, params)) == text);
+
+                // A dictionary we don't have.
+                params.m_codec = codec_zstd;
+                const string compressed(compress(text, params));
+                dictionaries.m_dictionaries.clear();
+                BOOST_CHECK_THROW(decompress(compressed, &dictionaries), domain_error);
+                BOOST_CHECK_THROW(CompressDictionary(0, dictionary->content()), invalid_argument);
+        }
+
+
+        /*
+          A long text is a container of frames, compressed and
+          decompressed on several threads, and the same however many
+          threads there are.  We can decompress any part of it
+          without decompressing the rest.
+        */
+        void test_container()
+        {
+                mode(Threads, true);
+                string text;
+                while(text.size() < 200000)
+                        text += "Sphinx of black quartz, judge my vow.  ";
+                const string message(text + pseudo_random_string(300000) + text + "end");
+                for(Codec codec : { codec_bzip2, codec_zstd, codec_lz4 }) {
+                        CompressParams params(codec);
+                        params.m_frame_size = 64 * 1024;
+                        params.m_threads = 4;
+                        const string compressed(compress(message, params));
+                        BOOST_CHECK_EQUAL('\xce', compressed[0]);
+                        BOOST_CHECK_EQUAL(codec, compressed[1]);
+                        params.m_threads = 1;
+                        BOOST_CHECK(compress(message, params) == compressed);
+                        BOOST_CHECK(decompress(compressed) == message);
+                        BOOST_CHECK(decompress_pieces(compressed, 10000) == message);
+                        unsigned long long length;
+                        BOOST_CHECK(decompressed_length(compressed.data(), compressed.size(), length));
+                        BOOST_CHECK_EQUAL(message.size(), length);
+
+                        // Written a piece at a time.
+                        string streamed;
+                        StringSink sink(streamed);
+                        CompressSink compress_sink(sink, params);
+                        compress_sink.expect(message.size());
+                        for(size_t offset = 0; offset < message.size(); offset += 7777)
+                                compress_sink.write(message.data() + offset, min<size_t>(7777, message.size() - offset));
+                        compress_sink.close();
+                        BOOST_CHECK(streamed == compressed);
+
+                        // Any range, within a frame or across several.
+                        vector<char> buf(300000);
+                        const vector<pair<unsigned long long, size_t> > ranges = {
+                                { 0, 10 }, { 65530, 20 }, { 100000, 300000 }, { message.size() - 5, 100 },
+                                { message.size(), 10 }, { 0, 0 },
+                        };
+                        for(const auto &range : ranges) {
+                                const size_t expected = range.first < message.size()
+                                        ? min<size_t>(range.second, message.size() - range.first) : 0;
+                                BOOST_CHECK_EQUAL(expected, decompress_range(compressed.data(), compressed.size(),
+                                                                             range.first, buf.data(), range.second));
+                                BOOST_CHECK(string(buf.data(), expected) == message.substr(range.first, expected));
+                        }
+
+                        // Truncated, in the index or in a frame.
+                        BOOST_CHECK_THROW(decompress(compressed.substr(0, 8)), domain_error);
+                        BOOST_CHECK_THROW(decompress(compressed.substr(0, compressed.size() - 1)), domain_error);
+                        BOOST_CHECK_THROW(decompress_pieces(compressed.substr(0, compressed.size() - 1), 1000),
+                                          domain_error);
+                }
+
+                // One byte at a time, through the index and frames.
+                CompressParams params(codec_zstd);
+                params.m_frame_size = 4096;
+                const string small(text.substr(0, 50000));
+                const string compressed(compress(small, params));
+                BOOST_CHECK(decompress_pieces(compressed, 1) == small);
+
+                // Short texts, and stored ones, are not containers.
+                BOOST_CHECK_EQUAL('\xcd', compress(small.substr(0, 4096), params)[0]);
+                params.m_codec = codec_stored;
+                BOOST_CHECK_EQUAL('\xcd', compress(small, params)[0]);
+
+                // Ranges of payloads that aren't containers.
+                const string framed(compress(small, CompressParams(codec_lz4)));
+                vector<char> buf(100);
+                BOOST_CHECK_EQUAL(100UL, decompress_range(framed.data(), framed.size(), 20000, buf.data(), 100));
+                BOOST_CHECK(string(buf.data(), 100) == small.substr(20000, 100));
+
+                params.m_frame_size = max_frame_size + 1;
+                BOOST_CHECK_THROW(params.validate(), invalid_argument);
+                mode(Threads, false);
+        }
+
+
+        /*
+          A container is written a batch of frames at a time, so
+          however long the text, CompressSink holds no more than a
+          frame for each thread and the one it's filling, and reads
+          back a batch at a time too.
+        */
+        void test_container_bounded()
+        {
+                mode(Threads, true);
+                CompressParams params(codec_lz4);
+                params.m_frame_size = 64 * 1024;
+                params.m_threads = 4;
+                const unsigned long long length = 64ULL * 1024 * 1024;
+                // Random, and never repeating within a frame, so each
+                // frame is about as long compressed.
+                string random(1024 * 1024, '\0');
+                pseudo_random_bytes(&random[0], random.size());
+                const size_t piece = 50000;
+                CountingSink counter;
+                DecompressSink decompress(counter);
+                PassingSink compressed(decompress);
+                CompressSink compress(compressed, params);
+                compress.expect(length);
+                unsigned long long held = 0;
+                for(unsigned long long written = 0; written < length; written += piece) {
+                        const size_t len = min<unsigned long long>(piece, length - written);
+                        compress.write(random.data() + written % (random.size() - piece), len);
+                        if(written + len > compressed.m_length)
+                                held = max(held, written + len - compressed.m_length);
+                }
+                compress.close();
+                BOOST_CHECK(held <= (params.m_threads + 1) * params.m_frame_size);
+                BOOST_CHECK_EQUAL(length, counter.m_length);
+                mode(Threads, false);
+        }
+
+
+        void test_errors()
+        {
+                BOOST_CHECK_THROW(CompressParams(codec_bzip2, 10).validate(), invalid_argument);
+                BOOST_CHECK_THROW(CompressParams(codec_lz4, 13).validate(), invalid_argument);
+                BOOST_CHECK_THROW(CompressParams(static_cast<Codec>(99)).validate(), invalid_argument);
+                BOOST_CHECK_THROW(compress("text", CompressParams(codec_zstd, 100)), invalid_argument);
+
+                string compressed(compress("some text", CompressParams(codec_zstd)));
+                string unknown(compressed);
+                unknown[1] = 99;
+                BOOST_CHECK_THROW(decompress(unknown), domain_error);
+                BOOST_CHECK_THROW(decompress(compressed.substr(0, compressed.size() - 2)), domain_error);
+                BOOST_CHECK_THROW(decompress(compressed.substr(0, 1)), domain_error);
+
+                string out;
+                StringSink sink(out);
+                CompressSink compress(sink);
+                compress.expect(4);
+                BOOST_CHECK_THROW(compress.write("12345", 5), logic_error);
+        }
 }
 
 
@@ -72,3 +528,48 @@ BOOST_AUTO_TEST_CASE(message_digest)
 }
 
 BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_CASE(codecs)
+{
+        test_codecs();
+}
+
+BOOST_AUTO_TEST_CASE(untagged)
+{
+        test_untagged();
+}
+
+BOOST_AUTO_TEST_CASE(frames)
+{
+        test_frames();
+}
+
+BOOST_AUTO_TEST_CASE(stream)
+{
+        test_stream();
+}
+
+BOOST_AUTO_TEST_CASE(probe)
+{
+        test_probe();
+}
+
+BOOST_AUTO_TEST_CASE(dictionary)
+{
+        test_dictionary();
+}
+
+BOOST_AUTO_TEST_CASE(container)
+{
+        test_container();
+}
+
+BOOST_AUTO_TEST_CASE(container_bounded)
+{
+        test_container_bounded();
+}
+
+BOOST_AUTO_TEST_CASE(errors)
+{
+        test_errors();
+}
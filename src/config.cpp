@@ -28,10 +28,10 @@
 #include <sstream>
 #include <string>
 
-#include "compress.h"
 #include "config.h"
 #include "crypt.h"
 #include "mode.h"
+#include "pipeline.h"
 #include "system.h"
 #include "transport.h"
 
@@ -59,14 +59,10 @@ const shared_ptr<Transport> ConfigParam::transport() const
 */
 const shared_ptr<Transport> ConfigParam::make_transport() const
 {
-        if(invalid_transport == m_transport_type)
-                throw(runtime_error("Invalid transport"));
-        if(no_transport == m_transport_type)
-                return make_shared<NoTransport>();
-        if(fs == m_transport_type)
-                return make_shared<TransportFS>(m_local_dir);
-        	//return shared_ptr<TransportFS>(new TransportFS(m_local_dir));
-        throw(runtime_error("Unknown transport"));
+        shared_ptr<Transport> transport(cryptar::make_transport(m_transport_type, m_local_dir));
+        transport->cover_params(m_cover_params);
+        transport->compress_params(m_compress_params);
+        return transport;
 }
 
 
@@ -167,25 +163,16 @@ Config::Config(const string &in_config_name, const std::string &in_passphrase)
         m_config_name = in_config_name;
         m_crypto_key = phrase_to_key(in_passphrase);
         ifstream fs(m_config_name, ios_base::binary);
-        // FIXME.  I've now repeated this same pattern here and in block::read().
-        //         Abstract to a function.
-        fs.seekg(0, ios::end);
-        int length = fs.tellg();
-        fs.seekg(0, ios::beg);
-        char *buffer = new char[length];
-        fs.read(buffer, length);
-        string cipher_text = string(buffer, length);
+        if(!fs)
+                throw_system_error("Config::Config()");
+        string big_text;
+        StringSink sink(big_text);
+        Decoder decoder(m_crypto_key, sink);
+        pump(fs, decoder);
         fs.close();
-
-        // FIXME    (This is somewhat shared with Block.
-        //           Abstract to a function that moves between unencrypted text
-        //           and encrypted text in a file.)
-        string plain_text = decrypt(cipher_text, m_crypto_key);
-        string big_text = decompress(plain_text);
         istringstream big_text_stream(big_text);
         boost::archive::text_iarchive ia(big_text_stream);
         ia & *this;
-        // FIXME    (Streaming MUST support m_transport!!!!)
 }
 
 
@@ -225,14 +212,15 @@ void Config::save()
         boost::archive::text_oarchive oa(big_text_stream);
         oa & *this;
         string big_text(big_text_stream.str()); // FIXME:  (Is this correct?  What about oa?)
-        string plain_text = compress(big_text);
-        string cipher_text = encrypt(plain_text, m_crypto_key);
 
-        // FIXME: Abstract this from block::write and so define only once
         ofstream fs(m_config_name, ios_base::binary | ios_base::trunc);
-        fs.write(cipher_text.data(), cipher_text.size());
         if(!fs)
                 throw_system_error("Config::save()");
+        OstreamSink sink(fs);
+        Encoder encoder(m_crypto_key, sink);
+        encoder.expect(big_text.size());
+        encoder.write(big_text.data(), big_text.size());
+        encoder.close();
         if(mode(Verbose))
                 cout << "Config saved." << endl;
 }
@@ -241,15 +229,28 @@ void Config::save()
 
 /*
   Serialize or deserialize according to context.
+
+  From version 1, the config holds the store: its transport type and
+  directory, from which we make the transport again on loading, then
+  the transport's own state (cf. Transport::serialize()), so that a
+  store reopens as it was made and not with the defaults.
 */
 template<class Archive>
 void Config::serialize(Archive &in_ar, const unsigned int in_version)
 {
-        // FIXME    (Use in_version)
-        // FIXME    (Persist transport)
-        //in_ar & m_transport;
         in_ar & m_root_id;
         in_ar & m_crypto_key;
+        if(in_version < 1)
+                return;
+        TransportType transport_type = m_transport ? m_transport->transport_type() : invalid_transport;
+        string local_dir(m_transport ? m_transport->local_dir() : string());
+        in_ar & transport_type;
+        in_ar & local_dir;
+        if(invalid_transport == transport_type)
+                return;
+        if(Archive::is_loading::value)
+                m_transport = cryptar::make_transport(transport_type, local_dir);
+        in_ar & *m_transport;
 }
 
 
@@ -26,6 +26,7 @@
 #include <boost/archive/text_iarchive.hpp>
 #include <boost/archive/text_oarchive.hpp>
 #include <boost/serialization/string.hpp>
+#include <boost/serialization/version.hpp>
 #include <memory>
 #include <string>
 
@@ -53,11 +54,24 @@ namespace cryptar {
                   A structure for instantiating new Config's.
                   We document the meaning of the entries in Config,
                   since they are mostly passed through directly.
+                  The covering and compression parameters go to the
+                  store's transport, which the Config persists, so a
+                  store loaded by name keeps them.
                 */
         public:
                 ConfigParam(TransportType in_transport)
                         : m_transport_type(in_transport) {
                         assert(invalid_transport != m_transport_type);
+                        // Each new store gets its own key for matching
+                        // blocks, sizes blocks to each file, doesn't
+                        // try to compress what won't compress, and
+                        // compresses long blocks a frame per core.
+                        m_cover_params.m_match_hash = match_keyed;
+                        m_cover_params.m_match_key = pseudo_random_string(keyed_hash_key_length);
+                        m_cover_params.m_adaptive = true;
+                        m_compress_params = CompressParams(codec_zstd);
+                        m_compress_params.m_probe = true;
+                        m_compress_params.m_frame_size = default_frame_size;
                 }
                 std::string m_config_name;
                 std::string m_passphrase;
@@ -65,6 +79,8 @@ namespace cryptar {
                 std::string m_remote_dir;
                 std::string m_remote_host;
                 TransportType m_transport_type;
+                CoverParams m_cover_params;    /* how to cut files into blocks */
+                CompressParams m_compress_params;       /* how to compress blocks */
 
                 const std::shared_ptr<Transport> transport() const;
 
@@ -124,6 +140,8 @@ namespace cryptar {
                           const std::string &in_passphrase);
                 // Fetch the RootBlock (or create) and return.
                 std::shared_ptr<RootBlock> root();
+                // The store, as made or as loaded.
+                const std::shared_ptr<Transport> transport() const { return m_transport; }
 
         private:
                 /* We need to be able to create a root block from the
@@ -166,4 +184,7 @@ namespace cryptar {
         std::shared_ptr<Config> make_config(const ConfigParam &param);
 }
 
+// Version 1 persists the store's transport.
+BOOST_CLASS_VERSION(cryptar::Config, 1)
+
 #endif  /* __CONFIG_H__*/
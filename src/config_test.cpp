@@ -25,7 +25,9 @@
 #include <algorithm>
 #include <boost/test/unit_test.hpp>
 #include <pstreams/pstream.h>
+#include <sstream>
 #include <string>
+#include <vector>
 
 #include "cryptar.h"
 #include "test_text.h"
@@ -61,6 +63,98 @@ namespace {
                 clean_temp_dir(params.m_local_dir);
         }
 
+
+        /*
+          A store reopens with the covering and compression it was
+          made with, its match key included, and not the defaults.
+        */
+        void test_store_params()
+        {
+                cout << "  [store_params]" << endl;
+                mode(Testing, true);
+                mode(Threads, false);
+
+                ConfigParam params(fs);
+                params.m_local_dir = temp_dir_name();
+                params.m_passphrase = pseudo_random_string();
+                params.m_cover_params.m_mode = cover_cdc;
+                params.m_cover_params.m_avg_chunk = 16384;
+                params.m_compress_params = CompressParams(codec_lz4, 9);
+                params.m_compress_params.m_frame_size = 256 * 1024;
+                const string filename(temp_file_name(params.m_local_dir));
+                make_config(params)->save(filename, params.m_passphrase);
+
+                Config config(filename, params.m_passphrase);
+                BOOST_REQUIRE(config.transport());
+                BOOST_CHECK_EQUAL(fs, config.transport()->transport_type());
+                BOOST_CHECK_EQUAL(params.m_local_dir, config.transport()->local_dir());
+                const CoverParams &cover = config.transport()->cover_params();
+                BOOST_CHECK_EQUAL(cover_cdc, cover.m_mode);
+                BOOST_CHECK_EQUAL(16384UL, cover.m_avg_chunk);
+                BOOST_CHECK_EQUAL(match_keyed, cover.m_match_hash);
+                BOOST_CHECK(params.m_cover_params.m_match_key == cover.m_match_key);
+                const CompressParams compress(config.transport()->compress_params());
+                BOOST_CHECK_EQUAL(codec_lz4, compress.m_codec);
+                BOOST_CHECK_EQUAL(9, compress.m_level);
+                BOOST_CHECK(!compress.m_probe);
+                BOOST_CHECK_EQUAL(256UL * 1024, compress.m_frame_size);
+
+                // A new store has a key of its own.
+                ConfigParam other(fs);
+                BOOST_CHECK(other.m_cover_params.m_match_key != cover.m_match_key);
+
+                clean_temp_dir(params.m_local_dir);
+        }
+
+
+        /*
+          A block compressed against the store's dictionary reads
+          back once the store is saved and loaded again, which finds
+          the dictionary from the config alone.
+        */
+        void test_store_dictionary()
+        {
+                cout << "  [store_dictionary]" << endl;
+                mode(Testing, true);
+                mode(Threads, false);
+
+                ConfigParam params(fs);
+                params.m_local_dir = temp_dir_name();
+                params.m_passphrase = pseudo_random_string();
+                shared_ptr<Config> config = make_config(params);
+                shared_ptr<Transport> transport(config->transport());
+                vector<string> contents;
+                for(unsigned int i = 0; i < 1500; i++) {
+                        ostringstream content;
+                        content << "owner=jeff group=users mode=0644 size=" << i * 7919 % 100000
+                                << " name=" << filename_from_random_bits(pseudo_random_string(9))
+                                << " modified=2013-0" << 1 + i % 9 << "-1" << i % 10;
+                        contents.push_back(content.str());
+                }
+                BOOST_REQUIRE_EQUAL(1UL, transport->train_dictionary(contents));
+                DataBlock *bp = block_by_content<DataBlock>(transport, params.m_passphrase, contents[7]);
+                bp->write();
+                const BlockId id(bp->id());
+                delete bp;
+                const string filename(temp_file_name(params.m_local_dir));
+                config->save(filename, params.m_passphrase);
+
+                Config loaded(filename, params.m_passphrase);
+                BOOST_CHECK_EQUAL(1UL, loaded.transport()->current_dictionary());
+                DataBlock *bp2 = block_by_id<DataBlock>(loaded.transport(), params.m_passphrase, id);
+                bp2->read();
+                BOOST_CHECK_EQUAL(contents[7], bp2->plain_text());
+                delete bp2;
+
+                // Without the dictionary, the block doesn't decode.
+                shared_ptr<Transport> no_store;
+                DataBlock *bp3 = block_by_id<DataBlock>(no_store, params.m_passphrase, id);
+                loaded.transport()->read(bp3);
+                BOOST_CHECK_THROW(bp3->plain_text(), domain_error);
+                delete bp3;
+
+                clean_temp_dir(params.m_local_dir);
+        }
 }
 
 
@@ -68,3 +162,13 @@ BOOST_AUTO_TEST_CASE(persist)
 {
         test_persist();
 }
+
+BOOST_AUTO_TEST_CASE(store_params)
+{
+        test_store_params();
+}
+
+BOOST_AUTO_TEST_CASE(store_dictionary)
+{
+        test_store_dictionary();
+}
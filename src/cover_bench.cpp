@@ -0,0 +1,136 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "cryptar.h"
+
+
+using namespace cryptar;
+using namespace std;
+
+
+/*
+  How much does confirming weak checksum hits cost?  First hash
+  blocks directly with SHA-256 and with the keyed hash, then cover
+  some content, change it a little every so often, and cover it
+  again, matching blocks each way.
+
+  Nothing is stored (no_transport), but new blocks are still
+  compressed and encrypted.
+*/
+
+
+namespace {
+
+        const unsigned long window = 512;
+        const unsigned long content_size = 8 * 1024 * 1024;
+        const unsigned long edit_spacing = 64 * 1024;
+
+
+        double mb_per_second(unsigned long in_bytes,
+                             chrono::steady_clock::time_point in_start,
+                             chrono::steady_clock::time_point in_end)
+        {
+                double seconds = chrono::duration<double>(in_end - in_start).count();
+                return static_cast<double>(in_bytes) / (1024 * 1024) / seconds;
+        }
+
+
+        /*
+          Hash every window of in_buf with in_params.match_checksum().
+        */
+        void report_hash(const string &in_name, const CoverParams &in_params, const string &in_buf)
+        {
+                unsigned long sink = 0;
+                auto start = chrono::steady_clock::now();
+                for(unsigned long offset = 0; offset + window <= in_buf.size(); offset += window)
+                        sink += static_cast<unsigned char>(in_params.match_checksum(in_buf.data() + offset, window).data()[0]);
+                auto end = chrono::steady_clock::now();
+                cout << setw(24) << left << in_name
+                     << setw(8) << right << fixed << setprecision(1)
+                     << mb_per_second(in_buf.size(), start, end) << " MB/s  "
+                     << "(" << sink << ")" << endl;
+        }
+
+
+        /*
+          Cover in_old, then time covering in_new against it.
+        */
+        void report_cover(const string &in_name,
+                          MatchHash in_match_hash,
+                          const string &in_old,
+                          const string &in_new)
+        {
+                ConfigParam params(no_transport);
+                params.m_passphrase = pseudo_random_string();
+                params.m_cover_params.m_adaptive = false;
+                params.m_cover_params.m_window = window;
+                params.m_cover_params.m_match_hash = in_match_hash;
+
+                CoverBlock *cbp = block_by_content<CoverBlock>(params.transport(),
+                                                               params.m_passphrase,
+                                                               in_old);
+                auto start = chrono::steady_clock::now();
+                cbp->set_content(in_new);
+                auto end = chrono::steady_clock::now();
+                const CoverBlock::CoverStats &stats = cbp->stats();
+                cout << setw(24) << left << in_name
+                     << setw(8) << right << fixed << setprecision(1)
+                     << mb_per_second(in_new.size(), start, end) << " MB/s  "
+                     << setw(8) << stats.m_blocks_reused << " reused  "
+                     << setw(6) << stats.m_blocks_written << " written" << endl;
+                delete cbp;
+        }
+}
+
+
+int main(int argc, char *argv[])
+{
+        mode(Threads, false);
+
+        string content(content_size, '\0');
+        srand(1);
+        for(unsigned long i = 0; i < content.size(); i++)
+                content[i] = rand();
+        string changed(content);
+        for(unsigned long offset = changed.size() - 1; offset > 0; offset -= min(offset, edit_spacing))
+                changed.insert(offset, 1, static_cast<char>(rand()));
+
+        CoverParams params;
+        cout << "Match checksum of " << window << " byte blocks:" << endl;
+        params.m_match_hash = match_sha256;
+        report_hash("sha256", params, content);
+        params.m_match_hash = match_keyed;
+        params.m_match_key = pseudo_random_string(keyed_hash_key_length);
+        report_hash("keyed", params, content);
+
+        cout << endl << "Re-cover " << content_size / (1024 * 1024) << " MB with one byte inserted every "
+             << edit_spacing / 1024 << " KB:" << endl;
+        report_cover("sha256", match_sha256, content, changed);
+        report_cover("keyed", match_keyed, content, changed);
+        return 0;
+}
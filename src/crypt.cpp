@@ -23,10 +23,15 @@
 #include <crypto++/osrng.h>
 #include <crypto++/sha.h>
 #include <errno.h>
+#include <list>
+#include <map>
+#include <memory>
 #include <sstream>
 #include <stdexcept>
+#include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <vector>
 
 
 // Modified from http://www.cryptopp.com/wiki/Hash_Functions
@@ -63,6 +68,7 @@
 #include <crypto++/modes.h> // xxx_Mode< >
 #include <crypto++/filters.h> // StringSource and
 // StreamTransformation
+#include <crypto++/gcm.h>
 
 // Ciphers and cipher modes are types, so have to use cpp, pending inspiration.  Ick.  Sorry.
 //
@@ -149,25 +155,19 @@ namespace {
 */
 string cryptar::message_digest(const string &message, bool filesystem_safe)
 {
-        string digest;
-        CryptoPP::SHA256 hash;
-        CryptoPP::StringSource(message, true,
-                               new CryptoPP::HashFilter(hash,
-                                                        new CryptoPP::Base64Encoder(new CryptoPP::StringSink(digest))));
-
-        // Why does a LF get appended?  Just hack around it.
-        if(*digest.rbegin() == '\n')
-                digest.erase(digest.end() - 1);
-        if(!filesystem_safe)
-                return digest;
-        
-        string safe_name;
-        replace_copy(digest.begin(),
-                     digest.end(),
-                     back_inserter(safe_name),
-                     '/',
-                     '_');
-        return safe_name;
+        return sha256(message.data(), message.size()).encode(filesystem_safe);
+}
+
+
+
+/*
+  Compute hash (SHA-256) of a buffer.
+*/
+Digest cryptar::sha256(const char *in_buf, size_t in_len)
+{
+        byte digest[CryptoPP::SHA256::DIGESTSIZE];
+        CryptoPP::SHA256().CalculateDigest(digest, reinterpret_cast<const byte *>(in_buf), in_len);
+        return Digest(reinterpret_cast<const char *>(digest));
 }
 
 
@@ -195,17 +195,95 @@ string cryptar::phrase_to_key(const string &in_phrase)
 
 
 
+/*
+  Making an AutoSeededRandomPool reads a seed from the OS, which costs
+  far more than the few dozen bytes a BlockId or salt wants.  So each
+  thread keeps one pool and hands out bytes from a buffer, refilling
+  the buffer as it empties and reseeding the pool from the OS every
+  random_reseed_bytes.
+
+  A forked child would otherwise hand out the same bytes as its
+  parent, so a change of pid also forces a reseed.
+*/
+namespace {
+        const size_t random_buffer_size = 4096;
+        const unsigned long random_reseed_bytes = 1024 * 1024;
+
+        class RandomBuffer {
+        public:
+                RandomBuffer() : m_used(random_buffer_size), m_since_seed(0), m_pid(getpid()) {};
+
+                void get(byte *out_buf, size_t in_length)
+                {
+                        if(getpid() != m_pid) {
+                                m_pid = getpid();
+                                reseed();
+                        }
+                        while(in_length > 0) {
+                                if(m_used == random_buffer_size)
+                                        refill();
+                                const size_t take = min(in_length, random_buffer_size - m_used);
+                                memcpy(out_buf, m_buffer + m_used, take);
+                                // What we hand out, we don't keep.
+                                memset(m_buffer + m_used, 0, take);
+                                m_used += take;
+                                out_buf += take;
+                                in_length -= take;
+                        }
+                }
+
+        private:
+                void refill()
+                {
+                        if(m_since_seed >= random_reseed_bytes)
+                                reseed();
+                        m_rng.GenerateBlock(m_buffer, random_buffer_size);
+                        m_since_seed += random_buffer_size;
+                        m_used = 0;
+                }
+
+                void reseed()
+                {
+                        m_rng.Reseed();
+                        m_since_seed = 0;
+                        m_used = random_buffer_size;
+                }
+
+                CryptoPP::AutoSeededRandomPool m_rng;
+                byte m_buffer[random_buffer_size];
+                size_t m_used;
+                unsigned long m_since_seed;
+                pid_t m_pid;
+        };
+
+        RandomBuffer &random_buffer()
+        {
+                static thread_local RandomBuffer buffer;
+                return buffer;
+        }
+}
+
+
+
+/*
+  Fill a buffer with pseudo-random bytes.
+*/
+void cryptar::pseudo_random_bytes(char *out_buf, size_t in_length)
+{
+        random_buffer().get(reinterpret_cast<byte *>(out_buf), in_length);
+}
+
+
+
 /*
   Return a string of length pseudo-random characters.
   Not necessarily human readable.
 */
 string cryptar::pseudo_random_string(int length)
 {
-        CryptoPP::AutoSeededRandomPool rng;
-        byte random_bytes[length];
-        rng.GenerateBlock(random_bytes, length);
-        string rand_str;
-        copy(random_bytes, random_bytes + length, back_inserter(rand_str));
+        string rand_str(length, '\0');
+        if(length > 0)
+                pseudo_random_bytes(&rand_str[0], length);
         return rand_str;
 }
 
@@ -243,72 +321,460 @@ string cryptar::filename_from_random_bits(const string &in_random)
   Encrypt and return cipher text.
 */
 string cryptar::encrypt(const string &plain_text, const string &password)
+{
+        return cipher_context(password)->encrypt(plain_text);
+}
+
+
+
+/*
+  Decrypt and return plain text.
+*/
+string cryptar::decrypt(const string &cipher_text, const string &password)
+{
+        return cipher_context(password)->decrypt(cipher_text);
+}
+
+
+
+/*
+  The key schedules and IV for one password.
+
+  CBC uses the key and IV that init_key_iv() always has.  GCM uses
+  its own 256 bit key, a hash of the password, rather than share the
+  CBC key between modes.
+*/
+struct CipherContext::Keys {
+        CipherFormat m_format;
+        CryptoPP::CIPHER_MODE<CryptoPP::CIPHER>::Encryption m_encryptor;
+        CryptoPP::CIPHER_MODE<CryptoPP::CIPHER>::Decryption m_decryptor;
+        crypto_iv_type m_iv;
+        CryptoPP::GCM<CryptoPP::AES>::Encryption m_gcm_encryptor;
+        CryptoPP::GCM<CryptoPP::AES>::Decryption m_gcm_decryptor;
+};
+
+
+/*
+  The header of cipher text in a format other than cipher_aes_cbc:
+
+      4 bytes    magic, 0x89 'C' 'R' 'Y'
+      1 byte     header version, 1
+      1 byte     CipherFormat
+      12 bytes   nonce
+
+  then the cipher text and a 16 byte tag.  The tag authenticates the
+  header too.
+
+  Cipher text with no header is CBC, and so is cipher text whose
+  header names no format we write, so that a CBC text that happens to
+  start with the magic and version (once in 2^40) still reads.  A CBC
+  text starts with a header we'd take for one, format and all, only
+  once in 2^47, so we don't fall back to CBC when a header's tag
+  doesn't check: that would let a forger choose the mode.
+
+  A cipher_aes_gcm_stream has the same header, then segments of
+  stream_segment_length bytes of plain text, each followed by its
+  tag.  The last segment may be shorter (even empty), and there is
+  always one.  Segment i uses the header's nonce with i (big endian)
+  xored into its last four bytes and, for the last segment only,
+  0x80 xored into its first byte.  So segments can't be reordered,
+  and a stream cut at a segment boundary doesn't check.
+*/
+namespace {
+        const char header_magic[] = { '\x89', 'C', 'R', 'Y' };
+        const size_t header_magic_length = sizeof(header_magic);
+        const char header_version = 1;
+        const size_t nonce_length = 12;
+        const size_t header_length = header_magic_length + 2 + nonce_length;
+        const size_t tag_length = 16;
+        const size_t stream_segment_length = 64 * 1024;
+
+        string make_header(CipherFormat in_format)
+        {
+                string header(header_magic, header_magic_length);
+                header += header_version;
+                header += static_cast<char>(in_format);
+                header.resize(header_length);
+                return header;
+        }
+
+        void segment_nonce(const string &in_header, uint32_t in_segment, bool in_last,
+                           char *out_nonce)
+        {
+                memcpy(out_nonce, in_header.data() + header_magic_length + 2, nonce_length);
+                for(int i = 0; i < 4; i++)
+                        out_nonce[nonce_length - 1 - i] ^= static_cast<char>(in_segment >> (8 * i));
+                if(in_last)
+                        out_nonce[0] ^= '\x80';
+        }
+
+        bool has_header(const string &in_cipher_text)
+        {
+                if(in_cipher_text.size() < header_magic_length + 2
+                   || 0 != in_cipher_text.compare(0, header_magic_length,
+                                                  header_magic, header_magic_length)
+                   || header_version != in_cipher_text[header_magic_length])
+                        return false;
+                const char format = in_cipher_text[header_magic_length + 1];
+                return cipher_aes_gcm == format || cipher_aes_gcm_stream == format;
+        }
+}
+
+
+CipherContext::CipherContext(const string &in_password, CipherFormat in_format)
+        : m_keys(new Keys)
+{
+        m_keys->m_format = in_format;
+        crypto_key_type key;
+        init_key_iv(in_password, key, m_keys->m_iv);
+        m_keys->m_encryptor.SetKeyWithIV(key, sizeof(key), m_keys->m_iv);
+        m_keys->m_decryptor.SetKeyWithIV(key, sizeof(key), m_keys->m_iv);
+
+        byte gcm_key[CryptoPP::SHA256::DIGESTSIZE];
+        const string label("cryptar aes-gcm key\n" + in_password);
+        CryptoPP::SHA256().CalculateDigest(gcm_key,
+                                           reinterpret_cast<const byte *>(label.data()),
+                                           label.size());
+        const byte zero_nonce[nonce_length] = { 0 };
+        m_keys->m_gcm_encryptor.SetKeyWithIV(gcm_key, sizeof(gcm_key), zero_nonce, nonce_length);
+        m_keys->m_gcm_decryptor.SetKeyWithIV(gcm_key, sizeof(gcm_key), zero_nonce, nonce_length);
+}
+
+
+CipherContext::~CipherContext()
+{
+}
+
+
+/*
+  Encrypt and return cipher text.
+
+  GCM encrypts and authenticates in one pass, and being a counter
+  mode, Crypto++ runs it with AES-NI and carryless multiplication
+  several blocks at a time where the CPU has them.
+
+  For CBC, we pad (PKCS #7, as StreamTransformationFilter does) and
+  encrypt in place in the returned string, rather than build a filter
+  chain for each message.  Every message starts again from the IV.
+*/
+string CipherContext::encrypt(const string &in_plain_text)
 {
         try {
-                crypto_key_type key;
-                crypto_iv_type iv;
-                init_key_iv(password, key, iv);
-                
-                // Cipher Text Sink
-                string cipher_text;
-
-                // Encryptor
-                CryptoPP::CIPHER_MODE<CryptoPP::CIPHER>::Encryption
-                        Encryptor(key, sizeof(key), iv);
-
-                // Encryption
-                CryptoPP::StreamTransformationFilter *source =
-                        new CryptoPP::StreamTransformationFilter(Encryptor,
-                                                                 new CryptoPP::StringSink(cipher_text)
-                                                                 ); // StreamTransformationFilter
-                CryptoPP::StringSource(plain_text, true, source);
+                if(cipher_aes_gcm == m_keys->m_format) {
+                        string cipher_text(make_header(cipher_aes_gcm));
+                        gcm_nonce(&cipher_text[header_magic_length + 2]);
+                        cipher_text.resize(header_length + in_plain_text.size() + tag_length);
+                        gcm_seal(&cipher_text[header_magic_length + 2],
+                                 cipher_text.data(), header_length,
+                                 in_plain_text.data(), in_plain_text.size(),
+                                 &cipher_text[header_length]);
+                        return cipher_text;
+                }
+                if(cipher_aes_gcm_stream == m_keys->m_format) {
+                        string cipher_text;
+                        StringSink sink(cipher_text);
+                        EncryptSink encrypt_sink(*this, sink);
+                        encrypt_sink.write(in_plain_text.data(), in_plain_text.size());
+                        encrypt_sink.close();
+                        return cipher_text;
+                }
+                const size_t block_size = CryptoPP::CIPHER::BLOCKSIZE;
+                const size_t pad = block_size - in_plain_text.size() % block_size;
+                string cipher_text(in_plain_text);
+                cipher_text.append(pad, static_cast<char>(pad));
+                byte *text = reinterpret_cast<byte *>(&cipher_text[0]);
+                m_keys->m_encryptor.Resynchronize(m_keys->m_iv);
+                m_keys->m_encryptor.ProcessData(text, text, cipher_text.size());
                 return cipher_text;
+        }
+        catch(CryptoPP::Exception& e) {
+                cerr << e.what() << endl;
+        }
+        throw(runtime_error("encryption failed"));
+}
+
+
+/*
+  Decrypt and return plain text, in whatever format the cipher text
+  is.  If it has a tag that doesn't check, throw.
+*/
+string CipherContext::decrypt(const string &in_cipher_text)
+{
+        if(has_header(in_cipher_text)) {
+                const char format = in_cipher_text[header_magic_length + 1];
+                if(cipher_aes_gcm_stream == format) {
+                        string plain_text;
+                        StringSink sink(plain_text);
+                        DecryptSink decrypt_sink(*this, sink);
+                        decrypt_sink.write(in_cipher_text.data(), in_cipher_text.size());
+                        decrypt_sink.close();
+                        return plain_text;
+                }
+                if(in_cipher_text.size() < header_length + tag_length)
+                        throw(runtime_error("decryption failed"));
+                string plain_text(in_cipher_text.size() - header_length - tag_length, '\0');
+                if(gcm_open(in_cipher_text.data() + header_magic_length + 2,
+                            in_cipher_text.data(), header_length,
+                            in_cipher_text.data() + header_length,
+                            in_cipher_text.size() - header_length,
+                            &plain_text[0]))
+                        return plain_text;
+                throw(runtime_error("decryption failed: cipher text damaged or forged"));
+        }
 
+        const size_t block_size = CryptoPP::CIPHER::BLOCKSIZE;
+        if(in_cipher_text.empty() || in_cipher_text.size() % block_size)
+                throw(runtime_error("decryption failed"));
+        try {
+                string plain_text(in_cipher_text);
+                byte *text = reinterpret_cast<byte *>(&plain_text[0]);
+                m_keys->m_decryptor.Resynchronize(m_keys->m_iv);
+                m_keys->m_decryptor.ProcessData(text, text, plain_text.size());
+                const size_t pad = text[plain_text.size() - 1];
+                if(0 < pad && pad <= block_size
+                   && plain_text.find_first_not_of(static_cast<char>(pad),
+                                                   plain_text.size() - pad) == string::npos) {
+                        plain_text.resize(plain_text.size() - pad);
+                        return plain_text;
+                }
         }
         catch(CryptoPP::Exception& e) {
                 cerr << e.what() << endl;
         }
-   
-        catch(...) {
-                cerr << "Unknown Error" << endl;
+        throw(runtime_error("decryption failed"));
+}
+
+
+void CipherContext::gcm_nonce(char *out_nonce)
+{
+        pseudo_random_bytes(out_nonce, nonce_length);
+}
+
+
+void CipherContext::gcm_seal(const char *in_nonce, const char *in_aad, size_t in_aad_length,
+                             const char *in_plain, size_t in_length, char *out_cipher)
+{
+        try {
+                m_keys->m_gcm_encryptor.EncryptAndAuthenticate(
+                        reinterpret_cast<byte *>(out_cipher),
+                        reinterpret_cast<byte *>(out_cipher + in_length), tag_length,
+                        reinterpret_cast<const byte *>(in_nonce), nonce_length,
+                        reinterpret_cast<const byte *>(in_aad), in_aad_length,
+                        reinterpret_cast<const byte *>(in_plain), in_length);
+                return;
+        }
+        catch(CryptoPP::Exception& e) {
+                cerr << e.what() << endl;
         }
         throw(runtime_error("encryption failed"));
 }
 
 
-
 /*
-  Decrypt and return plain text.
+  Here in_length counts the tag.
 */
-string cryptar::decrypt(const string &cipher_text, const string &password)
+bool CipherContext::gcm_open(const char *in_nonce, const char *in_aad, size_t in_aad_length,
+                             const char *in_cipher, size_t in_length, char *out_plain)
 {
+        if(in_length < tag_length)
+                return false;
+        const size_t length = in_length - tag_length;
         try {
-                crypto_key_type key;
-                crypto_iv_type iv;
-                init_key_iv(password, key, iv);
-
-                // Recovered Text Sink
-                string plain_text;
-
-                // Decryptor
-                CryptoPP::CIPHER_MODE<CryptoPP::CIPHER>::Decryption
-                        Decryptor(key, sizeof(key), iv);
-
-                // Decryption
-                CryptoPP::StringSource(cipher_text, true,
-                                       new CryptoPP::StreamTransformationFilter(Decryptor,
-                                                                                new CryptoPP::StringSink(plain_text)
-                                                                                ) // StreamTransformationFilter
-                                       ); // StringSource
-                return plain_text;
+                return m_keys->m_gcm_decryptor.DecryptAndVerify(
+                        reinterpret_cast<byte *>(out_plain),
+                        reinterpret_cast<const byte *>(in_cipher + length), tag_length,
+                        reinterpret_cast<const byte *>(in_nonce), nonce_length,
+                        reinterpret_cast<const byte *>(in_aad), in_aad_length,
+                        reinterpret_cast<const byte *>(in_cipher), length);
         }
         catch(CryptoPP::Exception& e) {
                 cerr << e.what() << endl;
         }
-   
-        catch(...) {
-                cerr << "Unknown Error" << endl;
-        }   
-        throw(runtime_error("decryption failed"));
+        return false;
+}
+
+
+void CipherContext::encrypt(const vector<string> &in_plain_texts,
+                            vector<string> &out_cipher_texts)
+{
+        out_cipher_texts.clear();
+        out_cipher_texts.reserve(in_plain_texts.size());
+        for(auto it = in_plain_texts.begin(); it != in_plain_texts.end(); ++it)
+                out_cipher_texts.push_back(encrypt(*it));
+}
+
+
+void CipherContext::decrypt(const vector<string> &in_cipher_texts,
+                            vector<string> &out_plain_texts)
+{
+        out_plain_texts.clear();
+        out_plain_texts.reserve(in_cipher_texts.size());
+        for(auto it = in_cipher_texts.begin(); it != in_cipher_texts.end(); ++it)
+                out_plain_texts.push_back(decrypt(*it));
+}
+
+
+namespace {
+        const size_t cipher_context_cache_size = 16;
+}
+
+
+/*
+  Each file has a password of its own (cf. TimelineBlock), so there
+  are as many passwords as files.  Each thread keeps contexts for the
+  few passwords it used last, most recent first, found by a digest of
+  the password rather than by the password itself.  A context we drop
+  lives on until its callers are done with it.
+*/
+shared_ptr<CipherContext> cryptar::cipher_context(const string &in_password)
+{
+        typedef pair<Digest, shared_ptr<CipherContext> > Entry;
+        static thread_local list<Entry> contexts;
+        const Digest digest(sha256(in_password.data(), in_password.size()));
+        for(auto it = contexts.begin(); it != contexts.end(); ++it)
+                if(it->first == digest) {
+                        contexts.splice(contexts.begin(), contexts, it);
+                        return it->second;
+                }
+        contexts.push_front(Entry(digest, make_shared<CipherContext>(in_password)));
+        if(contexts.size() > cipher_context_cache_size)
+                contexts.pop_back();
+        return contexts.front().second;
+}
+
+
+
+EncryptSink::EncryptSink(CipherContext &in_context, ByteSink &out_sink)
+        : m_context(in_context), m_sink(out_sink),
+          m_header(make_header(cipher_aes_gcm_stream)), m_segment(0), m_open(true)
+{
+        m_context.gcm_nonce(&m_header[header_magic_length + 2]);
+        m_plain.reserve(stream_segment_length);
+        m_sink.write(m_header.data(), m_header.size());
 }
 
+
+
+/*
+  A full segment is sealed only once more plain text comes, since
+  until then we don't know if it is the last.
+*/
+void EncryptSink::write(const char *in_buf, size_t in_len)
+{
+        if(!m_open)
+                throw(logic_error("EncryptSink::write() after close()"));
+        while(in_len > 0) {
+                if(m_plain.size() == stream_segment_length)
+                        seal(false);
+                const size_t take = min(in_len, stream_segment_length - m_plain.size());
+                m_plain.append(in_buf, take);
+                in_buf += take;
+                in_len -= take;
+        }
+}
+
+
+
+void EncryptSink::close()
+{
+        if(!m_open)
+                return;
+        seal(true);
+        m_open = false;
+        m_sink.close();
+}
+
+
+
+void EncryptSink::seal(bool in_last)
+{
+        if(0 == ++m_segment)
+                throw(length_error("EncryptSink: too many segments"));
+        char nonce[nonce_length];
+        segment_nonce(m_header, m_segment - 1, in_last, nonce);
+        m_cipher.resize(m_plain.size() + tag_length);
+        m_context.gcm_seal(nonce, m_header.data(), header_length,
+                           m_plain.data(), m_plain.size(), &m_cipher[0]);
+        m_sink.write(m_cipher.data(), m_cipher.size());
+        m_plain.clear();
+}
+
+
+
+DecryptSink::DecryptSink(CipherContext &in_context, ByteSink &out_sink)
+        : m_context(in_context), m_sink(out_sink), m_segment(0),
+          m_started(false), m_streaming(false), m_open(true)
+{
+}
+
+
+
+void DecryptSink::write(const char *in_buf, size_t in_len)
+{
+        if(!m_open)
+                throw(logic_error("DecryptSink::write() after close()"));
+        while(in_len > 0) {
+                if(!m_started) {
+                        // Gather a header's worth, to know the format.
+                        const size_t take = min(in_len, header_length - m_cipher.size());
+                        m_cipher.append(in_buf, take);
+                        in_buf += take;
+                        in_len -= take;
+                        if(m_cipher.size() < header_length)
+                                return;
+                        m_started = true;
+                        if(has_header(m_cipher)
+                           && cipher_aes_gcm_stream == m_cipher[header_magic_length + 1]) {
+                                m_streaming = true;
+                                m_header.swap(m_cipher);
+                                m_cipher.clear();
+                                m_cipher.reserve(stream_segment_length + tag_length);
+                        }
+                        continue;
+                }
+                if(!m_streaming) {
+                        m_cipher.append(in_buf, in_len);
+                        return;
+                }
+                // As for EncryptSink, a full segment isn't known not
+                // to be the last until more comes.
+                if(m_cipher.size() == stream_segment_length + tag_length)
+                        open(false);
+                const size_t take = min(in_len, stream_segment_length + tag_length - m_cipher.size());
+                m_cipher.append(in_buf, take);
+                in_buf += take;
+                in_len -= take;
+        }
+}
+
+
+
+void DecryptSink::close()
+{
+        if(!m_open)
+                return;
+        m_open = false;
+        if(m_streaming)
+                open(true);
+        else {
+                const string plain_text(m_context.decrypt(m_cipher));
+                m_sink.write(plain_text.data(), plain_text.size());
+        }
+        m_sink.close();
+}
+
+
+
+void DecryptSink::open(bool in_last)
+{
+        char nonce[nonce_length];
+        segment_nonce(m_header, m_segment++, in_last, nonce);
+        if(m_cipher.size() < tag_length)
+                throw(runtime_error("decryption failed"));
+        m_plain.resize(m_cipher.size() - tag_length);
+        if(!m_context.gcm_open(nonce, m_header.data(), header_length,
+                               m_cipher.data(), m_cipher.size(), &m_plain[0]))
+                throw(runtime_error("decryption failed: cipher text damaged or forged"));
+        m_sink.write(m_plain.data(), m_plain.size());
+        m_cipher.clear();
+}
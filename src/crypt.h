@@ -23,7 +23,13 @@
 #define __CRYPT_H__ 1
 
 
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <vector>
+
+#include "digest.h"
+#include "pipeline.h"
 
 
 namespace cryptar {
@@ -31,12 +37,16 @@ namespace cryptar {
         // Compute a hash (message digest).  Currently SHA-256.
         std::string message_digest(const std::string &message,
                                    const bool filesystem_safe = false);
+        // The same, as bytes.
+        Digest sha256(const char *in_buf, size_t in_len);
 
         // Compute a crypto key from an arbitrary passphrase
         std::string phrase_to_key(const std::string &in_phrase);
         
         // Return a (not necessarily human readable) string of random bits.
         std::string pseudo_random_string(int length = 40);
+        // Fill a buffer with random bits (from this thread's pool).
+        void pseudo_random_bytes(char *out_buf, size_t in_length);
 
         // Return a filename based on some optional random bits.
         // Random bits produced if none provided.
@@ -47,11 +57,127 @@ namespace cryptar {
         // and http://www.cryptopp.com/fom-serve/cache/1.html
         // and http://www.cryptopp.com/wiki/FAQ
 
+        // Encrypt with cipher_aes_gcm (cf. CipherFormat, below).
+        // Decrypt any format.
         std::string encrypt(const std::string &plain_message,
                             const std::string &password);
         std::string decrypt(const std::string &cipher_message,
                             const std::string &password);
 
+
+        /*
+          How we encrypt.  Cipher text in any format other than
+          cipher_aes_cbc starts with a header naming its format, and
+          decrypt() reads every format.
+        */
+        // Do not renumber members of this enum.  Values are persisted.
+        enum CipherFormat {
+                cipher_aes_cbc = 0,     /* no header, fixed IV, no MAC: the original format */
+                cipher_aes_gcm = 1,     /* AES-256-GCM, random nonce */
+                cipher_aes_gcm_stream = 2,      /* the same in segments, cf. EncryptSink */
+        };
+
+
+        /*
+          What encrypt() and decrypt() derive from a password (the key
+          schedules and the CBC IV), derived once so that many blocks
+          under one password don't each pay for it.  The output is
+          that of encrypt() and decrypt().
+
+          A CipherContext keeps cipher state between calls, so it is
+          not to be shared between threads.
+        */
+        class CipherContext {
+        public:
+                explicit CipherContext(const std::string &in_password,
+                                       CipherFormat in_format = cipher_aes_gcm);
+                ~CipherContext();
+
+                std::string encrypt(const std::string &in_plain_text);
+                std::string decrypt(const std::string &in_cipher_text);
+
+                // The same, for many buffers at a time.
+                void encrypt(const std::vector<std::string> &in_plain_texts,
+                             std::vector<std::string> &out_cipher_texts);
+                void decrypt(const std::vector<std::string> &in_cipher_texts,
+                             std::vector<std::string> &out_plain_texts);
+
+        private:
+                CipherContext(const CipherContext &);
+                CipherContext &operator=(const CipherContext &);
+
+                friend class EncryptSink;
+                friend class DecryptSink;
+
+                // AES-256-GCM.  The cipher text is as long as the
+                // plain text, then the tag.  gcm_open() returns false
+                // if the tag doesn't check.
+                void gcm_nonce(char *out_nonce);
+                void gcm_seal(const char *in_nonce, const char *in_aad, size_t in_aad_length,
+                              const char *in_plain, size_t in_length, char *out_cipher);
+                bool gcm_open(const char *in_nonce, const char *in_aad, size_t in_aad_length,
+                              const char *in_cipher, size_t in_length, char *out_plain);
+
+                struct Keys;
+                std::unique_ptr<Keys> m_keys;
+        };
+
+        // This thread's CipherContext for the password, made on first
+        // use.  Hold on to it while using it (cf. crypt.cpp).
+        std::shared_ptr<CipherContext> cipher_context(const std::string &in_password);
+
+
+        /*
+          Encryption as a pipeline stage, writing cipher_aes_gcm_stream:
+          the header, then the plain text in fixed size segments, each
+          sealed with its own tag (cf. crypt.cpp).  Neither side holds
+          more than a segment.
+        */
+        class EncryptSink : public ByteSink {
+        public:
+                EncryptSink(CipherContext &in_context, ByteSink &out_sink);
+                virtual void write(const char *in_buf, size_t in_len);
+                virtual void close();
+
+        private:
+                void seal(bool in_last);
+
+                CipherContext &m_context;
+                ByteSink &m_sink;
+                std::string m_header;
+                std::string m_plain;            /* the segment being filled */
+                std::string m_cipher;
+                uint32_t m_segment;
+                bool m_open;
+        };
+
+
+        /*
+          And back, from any format.  A cipher_aes_gcm_stream is checked
+          and passed on a segment at a time.  The older formats have
+          one tag (or none) for the whole text, so we hold them until
+          close().
+        */
+        class DecryptSink : public ByteSink {
+        public:
+                DecryptSink(CipherContext &in_context, ByteSink &out_sink);
+                virtual void write(const char *in_buf, size_t in_len);
+                virtual void close();
+
+        private:
+                void open(bool in_last);
+
+                CipherContext &m_context;
+                ByteSink &m_sink;
+                std::string m_header;
+                std::string m_cipher;           /* the segment being filled */
+                std::string m_plain;
+                uint32_t m_segment;
+                bool m_started;                 /* we know the format */
+                bool m_streaming;
+                bool m_open;
+        };
+
         
 }
 
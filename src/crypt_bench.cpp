@@ -0,0 +1,119 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "crypt.h"
+
+
+using namespace cryptar;
+using namespace std;
+
+
+/*
+  What does it cost to encrypt blocks one at a time, deriving the key
+  schedule and IV from the password for each (as encrypt() used to),
+  compared with a CipherContext made once and reused, one buffer or a
+  batch at a time?  And how does GCM compare with the original CBC?
+*/
+
+
+namespace {
+
+        const unsigned long total_bytes = 32 * 1024 * 1024;
+
+
+        void report(const string &in_name,
+                    unsigned long in_block_size,
+                    chrono::steady_clock::time_point in_start,
+                    chrono::steady_clock::time_point in_end)
+        {
+                double seconds = chrono::duration<double>(in_end - in_start).count();
+                unsigned long blocks = total_bytes / in_block_size;
+                cout << setw(24) << left << in_name
+                     << setw(8) << right << fixed << setprecision(1)
+                     << total_bytes / (1024 * 1024) / seconds << " MB/s  "
+                     << setw(8) << setprecision(2) << 1e6 * seconds / blocks << " us/block"
+                     << endl;
+        }
+
+
+        void bench(unsigned long in_block_size)
+        {
+                const string password(message_digest(pseudo_random_string()));
+                vector<string> plain_texts;
+                for(unsigned long i = 0; i < total_bytes / in_block_size; i++)
+                        plain_texts.push_back(pseudo_random_string(in_block_size));
+                vector<string> cipher_texts;
+                cout << endl << in_block_size << " byte blocks:" << endl;
+
+                auto start = chrono::steady_clock::now();
+                for(auto it = plain_texts.begin(); it != plain_texts.end(); ++it)
+                        cipher_texts.push_back(CipherContext(password).encrypt(*it));
+                report("encrypt, setup per block", in_block_size, start, chrono::steady_clock::now());
+
+                CipherContext context(password);
+                start = chrono::steady_clock::now();
+                for(unsigned long i = 0; i < plain_texts.size(); i++)
+                        cipher_texts[i] = context.encrypt(plain_texts[i]);
+                report("encrypt, reused context", in_block_size, start, chrono::steady_clock::now());
+
+                start = chrono::steady_clock::now();
+                context.encrypt(plain_texts, cipher_texts);
+                report("encrypt, batch", in_block_size, start, chrono::steady_clock::now());
+
+                vector<string> recovered;
+                start = chrono::steady_clock::now();
+                for(auto it = cipher_texts.begin(); it != cipher_texts.end(); ++it)
+                        recovered.push_back(CipherContext(password).decrypt(*it));
+                report("decrypt, setup per block", in_block_size, start, chrono::steady_clock::now());
+
+                start = chrono::steady_clock::now();
+                context.decrypt(cipher_texts, recovered);
+                report("decrypt, batch", in_block_size, start, chrono::steady_clock::now());
+                if(recovered != plain_texts)
+                        cout << "decryption failed!" << endl;
+
+                // The original format, for comparison.
+                CipherContext cbc_context(password, cipher_aes_cbc);
+                start = chrono::steady_clock::now();
+                cbc_context.encrypt(plain_texts, cipher_texts);
+                report("cbc encrypt, batch", in_block_size, start, chrono::steady_clock::now());
+                start = chrono::steady_clock::now();
+                cbc_context.decrypt(cipher_texts, recovered);
+                report("cbc decrypt, batch", in_block_size, start, chrono::steady_clock::now());
+        }
+}
+
+
+int main(int argc, char *argv[])
+{
+        bench(512);
+        bench(4096);
+        bench(64 * 1024);
+        bench(1024 * 1024);
+        return 0;
+}
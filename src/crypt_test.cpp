@@ -25,7 +25,11 @@
 #include <boost/test/unit_test.hpp>
 #include <pstreams/pstream.h>
 #include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
 #include <unordered_set>
+#include <vector>
 
 #include "cryptar.h"
 #include "test_text.h"
@@ -103,6 +107,98 @@ namespace {
         }
 
 
+        /*
+          A CipherContext decrypts what encrypt() encrypts, one buffer
+          or many, and tells a wrong or damaged cipher text.
+        */
+        void test_cipher_context(const string &message)
+        {
+                string password(message_digest(message, false));
+                CipherContext context(password);
+                string cipher_text = context.encrypt(message);
+                BOOST_CHECK(message == decrypt(cipher_text, password));
+                BOOST_CHECK(message == context.decrypt(encrypt(message, password)));
+
+                vector<string> plain_texts;
+                for(unsigned int i = 0; i < 50; i++)
+                        plain_texts.push_back(message.substr(0, i) + pseudo_random_string(i));
+                vector<string> cipher_texts;
+                context.encrypt(plain_texts, cipher_texts);
+                BOOST_REQUIRE_EQUAL(cipher_texts.size(), plain_texts.size());
+                vector<string> recovered;
+                context.decrypt(cipher_texts, recovered);
+                BOOST_CHECK(recovered == plain_texts);
+
+                BOOST_CHECK_THROW(context.decrypt(string()), runtime_error);
+                BOOST_CHECK_THROW(context.decrypt(cipher_text.substr(1)), runtime_error);
+                BOOST_CHECK_THROW(context.decrypt(cipher_text.substr(0, cipher_text.size() - 1)),
+                                  runtime_error);
+
+                // Each thread keeps contexts for only the passwords
+                // it used last; one it drops lives on while held.
+                shared_ptr<CipherContext> held(cipher_context(password));
+                BOOST_CHECK(held == cipher_context(password));
+                for(unsigned int i = 0; i < 1000; i++)
+                        cipher_context(password + to_string(i));
+                BOOST_CHECK_EQUAL(1L, held.use_count());
+                BOOST_CHECK(held != cipher_context(password));
+                BOOST_CHECK(message == held->decrypt(encrypt(message, password)));
+        }
+
+
+        /*
+          GCM cipher text has a header and a fresh nonce each time,
+          and any change to it is caught.  CBC cipher text, as cryptar
+          first wrote it, is still read.
+        */
+        void test_cipher_formats(const string &message)
+        {
+                string password(message_digest(message, false));
+                CipherContext gcm(password);
+                const string cipher_text = gcm.encrypt(message);
+                BOOST_CHECK_EQUAL(cipher_text.size(), message.size() + 18 + 16);
+                BOOST_CHECK_EQUAL(cipher_text.substr(1, 3), string("CRY"));
+                BOOST_CHECK_EQUAL(cipher_text[5], static_cast<char>(cipher_aes_gcm));
+                BOOST_CHECK(cipher_text != gcm.encrypt(message));
+                for(unsigned int i = 0; i < cipher_text.size(); i += 5) {
+                        string damaged(cipher_text);
+                        damaged[i] ^= 0x10;
+                        BOOST_CHECK_THROW(gcm.decrypt(damaged), runtime_error);
+                }
+                BOOST_CHECK_THROW(CipherContext(password + "x").decrypt(cipher_text), runtime_error);
+
+                CipherContext cbc(password, cipher_aes_cbc);
+                const string cbc_text = cbc.encrypt(message);
+                BOOST_CHECK_EQUAL(cbc_text.size() % 16, 0UL);
+                BOOST_CHECK(cbc_text == cbc.encrypt(message));
+                BOOST_CHECK(message == gcm.decrypt(cbc_text));
+                BOOST_CHECK(message == decrypt(cbc_text, password));
+
+                // A CBC text that starts with the magic and version
+                // but no format we write is still CBC.  We make one by
+                // trying second blocks until the padding checks; CBC
+                // with a fixed IV encrypts the plain text back to it.
+                string lookalike(cipher_text.substr(0, 5) + '\x7f' + pseudo_random_string(26));
+                string plain_text;
+                bool found = false;
+                for(unsigned int i = 0; i < 100000 && !found; i++) {
+                        pseudo_random_bytes(&lookalike[16], 16);
+                        try {
+                                plain_text = gcm.decrypt(lookalike);
+                                found = true;
+                        } catch(runtime_error &) {}
+                }
+                BOOST_REQUIRE(found);
+                BOOST_CHECK(cbc.encrypt(plain_text) == lookalike);
+                string streamed;
+                StringSink sink(streamed);
+                DecryptSink decrypt_sink(gcm, sink);
+                decrypt_sink.write(lookalike.data(), lookalike.size());
+                decrypt_sink.close();
+                BOOST_CHECK(streamed == plain_text);
+        }
+
+
 
         /*
           Check that message_digest() and pseudo_random_string()
@@ -200,6 +296,51 @@ namespace {
                 
                 BOOST_CHECK(s.size() == N);
         }
+
+
+        /*
+          The random pool is per thread and per process: threads, and
+          a child and its parent after fork(), don't see the same
+          bytes.  Requests larger than the pool's buffer work too.
+        */
+        void test_random_pool()
+        {
+                cout << "  [begin random pool test]" << endl;
+                string big(100000, '\0');
+                pseudo_random_bytes(&big[0], big.size());
+                BOOST_CHECK(big.find_first_not_of('\0', big.size() - 100) != string::npos);
+
+                const int num_threads = 4;
+                vector<string> from_thread(num_threads);
+                vector<thread> threads;
+                for(int i = 0; i < num_threads; i++)
+                        threads.push_back(thread([&from_thread, i]() {
+                                                from_thread[i] = pseudo_random_string(64);
+                                        }));
+                for(auto it = threads.begin(); it != threads.end(); ++it)
+                        it->join();
+                unordered_set<string> distinct(from_thread.begin(), from_thread.end());
+                BOOST_CHECK_EQUAL(distinct.size(), num_threads);
+
+                int fds[2];
+                BOOST_REQUIRE(0 == pipe(fds));
+                pseudo_random_string(1);        // so the parent's buffer is warm
+                pid_t pid = fork();
+                BOOST_REQUIRE(pid >= 0);
+                if(0 == pid) {
+                        const string child(pseudo_random_string(32));
+                        ssize_t ignored = ::write(fds[1], child.data(), child.size());
+                        (void)ignored;
+                        _exit(0);
+                }
+                const string parent(pseudo_random_string(32));
+                string child(32, '\0');
+                BOOST_CHECK_EQUAL(::read(fds[0], &child[0], child.size()), 32);
+                waitpid(pid, 0, 0);
+                close(fds[0]);
+                close(fds[1]);
+                BOOST_CHECK(parent != child);
+        }
 }
 
 
@@ -227,6 +368,20 @@ BOOST_AUTO_TEST_CASE(encryption)
 }
 
 
+BOOST_AUTO_TEST_CASE(cipher_context)
+{
+        cout << "  [test_cipher_context]" << endl;
+        test(test_cipher_context);
+}
+
+
+BOOST_AUTO_TEST_CASE(cipher_formats)
+{
+        cout << "  [test_cipher_formats]" << endl;
+        test(test_cipher_formats);
+}
+
+
 BOOST_AUTO_TEST_CASE(lengths)
 {
         test_lengths();
@@ -245,4 +400,10 @@ BOOST_AUTO_TEST_CASE(unique)
 }
 
 
+BOOST_AUTO_TEST_CASE(random_pool)
+{
+        test_random_pool();
+}
+
+
 BOOST_AUTO_TEST_SUITE_END()
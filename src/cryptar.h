@@ -28,10 +28,20 @@
 #include <string>
 #include <vector>
 
+#include "arena.h"
+#include "bytes.h"
 #include "compress.h"
+#include "digest.h"
 #include "crypt.h"
 #include "mode.h"
+#include "checksum.h"
+#include "bloom.h"
+#include "checksum_index.h"
+#include "chunk.h"
+#include "local_file.h"
+#include "pipeline.h"
 #include "block.h"
+#include "stage.h"
 #include "config.h"
 #include "transport.h"
 #include "communicate.h"
@@ -0,0 +1,525 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CRYPTAR_X86_KERNELS 1
+#include <cpuid.h>
+#include <immintrin.h>
+#else
+#define CRYPTAR_X86_KERNELS 0
+#endif
+
+#include "crypt.h"
+#include "digest.h"
+
+
+using namespace cryptar;
+using namespace std;
+
+
+const size_t Digest::length;
+const size_t Digest::encoded_length;
+
+
+namespace {
+        const char base64_chars[] =
+                "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+}
+
+
+/*
+  Standard base64 (RFC 4648), padded, as Crypto++'s Base64Encoder
+  writes it for so short an input, less the newline it appends.
+*/
+string Digest::encode(bool in_filesystem_safe) const
+{
+        string encoded(encoded_length, '=');
+        const char slash = in_filesystem_safe ? '_' : '/';
+        size_t out = 0;
+        for(size_t in = 0; in < length; in += 3) {
+                const size_t remaining = length - in;
+                unsigned long group = m_bytes[in] << 16;
+                if(remaining > 1)
+                        group |= m_bytes[in + 1] << 8;
+                if(remaining > 2)
+                        group |= m_bytes[in + 2];
+                for(size_t i = 0; i < 4; i++) {
+                        if(i > remaining)
+                                break;
+                        const char c = base64_chars[(group >> (18 - 6 * i)) & 0x3F];
+                        encoded[out + i] = ('/' == c) ? slash : c;
+                }
+                out += 4;
+        }
+        return encoded;
+}
+
+
+
+Digest Digest::decode(const string &in_encoded)
+{
+        if(encoded_length != in_encoded.size()) {
+                cerr << "Digest::decode(): bad length " << in_encoded.size() << endl;
+                throw(domain_error("Digest::decode(): bad length"));
+        }
+        char bytes[length + 2];
+        size_t out = 0;
+        for(size_t in = 0; in < encoded_length; in += 4) {
+                unsigned long group = 0;
+                for(size_t i = 0; i < 4; i++) {
+                        const char c = '_' == in_encoded[in + i] ? '/' : in_encoded[in + i];
+                        const bool pad = encoded_length - 1 == in + i;
+                        const char *found = c && !pad ? strchr(base64_chars, c) : 0;
+                        if(!found && !(pad && '=' == c)) {
+                                cerr << "Digest::decode(): bad character" << endl;
+                                throw(domain_error("Digest::decode(): bad character"));
+                        }
+                        group = (group << 6) | (found ? found - base64_chars : 0);
+                }
+                bytes[out++] = group >> 16;
+                bytes[out++] = group >> 8;
+                bytes[out++] = group;
+        }
+        /* The bits past the last byte must be zero, as encode() leaves them. */
+        if(bytes[length]) {
+                cerr << "Digest::decode(): bad padding" << endl;
+                throw(domain_error("Digest::decode(): bad padding"));
+        }
+        return Digest(bytes);
+}
+
+
+
+/*
+  Batched SHA-256 (FIPS 180-4).  Each kernel takes the buffers in
+  order of length, longest first, so that buffers run side by side
+  have about as many blocks.
+*/
+namespace {
+        const uint32_t sha256_k[64] = {
+                0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+                0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+                0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+                0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+                0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+                0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+                0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+                0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+        };
+
+        const uint32_t sha256_h0[8] = {
+                0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+        };
+
+
+        /*
+          A message as SHA-256 sees it, a run of 64 byte blocks: the
+          whole blocks where they lie, then the padded tail (one or
+          two blocks) copied aside.
+        */
+        class PaddedMessage {
+        public:
+                PaddedMessage() : m_data(0), m_whole(0), m_blocks(0) {};
+
+                void init(const char *in_buf, size_t in_len)
+                {
+                        m_data = reinterpret_cast<const unsigned char *>(in_buf);
+                        m_whole = in_len / 64;
+                        const size_t rest = in_len % 64;
+                        const size_t tail_blocks = rest + 9 <= 64 ? 1 : 2;
+                        m_blocks = m_whole + tail_blocks;
+                        memset(m_tail, 0, sizeof(m_tail));
+                        if(rest)
+                                memcpy(m_tail, m_data + 64 * m_whole, rest);
+                        m_tail[rest] = 0x80;
+                        const uint64_t bits = static_cast<uint64_t>(in_len) * 8;
+                        unsigned char *end = m_tail + 64 * tail_blocks;
+                        for(int i = 0; i < 8; i++)
+                                end[-1 - i] = static_cast<unsigned char>(bits >> (8 * i));
+                }
+
+                size_t blocks() const { return m_blocks; }
+                const unsigned char *block(size_t in_i) const
+                {
+                        return in_i < m_whole ? m_data + 64 * in_i : m_tail + 64 * (in_i - m_whole);
+                }
+
+        private:
+                const unsigned char *m_data;
+                size_t m_whole;
+                size_t m_blocks;
+                unsigned char m_tail[128];
+        };
+
+
+        vector<size_t> by_length(const size_t *in_lens, size_t in_count)
+        {
+                vector<size_t> order(in_count);
+                for(size_t i = 0; i < in_count; i++)
+                        order[i] = i;
+                stable_sort(order.begin(), order.end(),
+                            [in_lens](size_t in_a, size_t in_b) { return in_lens[in_a] > in_lens[in_b]; });
+                return order;
+        }
+
+
+        typedef void (*BatchKernel)(const char *const *, const size_t *, size_t, Digest *);
+
+
+        // No SIMD: one buffer at a time, as sha256() does it.
+        void sha256_batch_single(const char *const *in_bufs, const size_t *in_lens, size_t in_count,
+                                 Digest *out_digests)
+        {
+                for(size_t i = 0; i < in_count; i++)
+                        out_digests[i] = sha256(in_bufs[i], in_lens[i]);
+        }
+
+
+#if CRYPTAR_X86_KERNELS
+        /*
+          SHA extensions.  The state is held as ABEF and CDGH, as
+          sha256rnds2 wants it.  A block is a long chain of dependent
+          rounds, so we hash two messages a block at a time each and
+          let the CPU overlap the two chains.
+        */
+        __attribute__((target("sha,sse4.1")))
+        inline void sha_ni_rounds(__m128i &io_abef, __m128i &io_cdgh, __m128i in_words, int in_group)
+        {
+                __m128i msg = _mm_add_epi32(in_words,
+                                            _mm_loadu_si128(reinterpret_cast<const __m128i *>(sha256_k + 4 * in_group)));
+                io_cdgh = _mm_sha256rnds2_epu32(io_cdgh, io_abef, msg);
+                msg = _mm_shuffle_epi32(msg, 0x0E);
+                io_abef = _mm_sha256rnds2_epu32(io_abef, io_cdgh, msg);
+        }
+
+        /*
+          Four rounds on the words in io_cur, and meanwhile the
+          schedule: io_next gets the words twelve rounds on, and
+          io_prev the first half of those sixteen rounds on.
+        */
+        __attribute__((target("sha,sse4.1")))
+        inline void sha_ni_step(__m128i &io_abef, __m128i &io_cdgh,
+                                __m128i &io_cur, __m128i &io_prev, __m128i &io_next, int in_group)
+        {
+                sha_ni_rounds(io_abef, io_cdgh, io_cur, in_group);
+                if(in_group >= 3 && in_group <= 14)
+                        io_next = _mm_sha256msg2_epu32(_mm_add_epi32(io_next,
+                                                                     _mm_alignr_epi8(io_cur, io_prev, 4)),
+                                                       io_cur);
+                if(in_group >= 1 && in_group <= 12)
+                        io_prev = _mm_sha256msg1_epu32(io_prev, io_cur);
+        }
+
+        __attribute__((target("sha,sse4.1")))
+        inline void sha_ni_block(__m128i &io_abef, __m128i &io_cdgh, const unsigned char *in_block)
+        {
+                const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+                __m128i m0 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in_block)), bswap);
+                __m128i m1 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in_block + 16)), bswap);
+                __m128i m2 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in_block + 32)), bswap);
+                __m128i m3 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in_block + 48)), bswap);
+                const __m128i abef = io_abef;
+                const __m128i cdgh = io_cdgh;
+                sha_ni_step(io_abef, io_cdgh, m0, m3, m1, 0);
+                sha_ni_step(io_abef, io_cdgh, m1, m0, m2, 1);
+                sha_ni_step(io_abef, io_cdgh, m2, m1, m3, 2);
+                sha_ni_step(io_abef, io_cdgh, m3, m2, m0, 3);
+                sha_ni_step(io_abef, io_cdgh, m0, m3, m1, 4);
+                sha_ni_step(io_abef, io_cdgh, m1, m0, m2, 5);
+                sha_ni_step(io_abef, io_cdgh, m2, m1, m3, 6);
+                sha_ni_step(io_abef, io_cdgh, m3, m2, m0, 7);
+                sha_ni_step(io_abef, io_cdgh, m0, m3, m1, 8);
+                sha_ni_step(io_abef, io_cdgh, m1, m0, m2, 9);
+                sha_ni_step(io_abef, io_cdgh, m2, m1, m3, 10);
+                sha_ni_step(io_abef, io_cdgh, m3, m2, m0, 11);
+                sha_ni_step(io_abef, io_cdgh, m0, m3, m1, 12);
+                sha_ni_step(io_abef, io_cdgh, m1, m0, m2, 13);
+                sha_ni_step(io_abef, io_cdgh, m2, m1, m3, 14);
+                sha_ni_step(io_abef, io_cdgh, m3, m2, m0, 15);
+                io_abef = _mm_add_epi32(io_abef, abef);
+                io_cdgh = _mm_add_epi32(io_cdgh, cdgh);
+        }
+
+        __attribute__((target("sha,sse4.1")))
+        inline void sha_ni_start(__m128i &out_abef, __m128i &out_cdgh)
+        {
+                const __m128i dcba = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(sha256_h0)), 0xB1);
+                const __m128i efgh = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(sha256_h0 + 4)), 0x1B);
+                out_abef = _mm_alignr_epi8(dcba, efgh, 8);
+                out_cdgh = _mm_blend_epi16(efgh, dcba, 0xF0);
+        }
+
+        __attribute__((target("sha,sse4.1")))
+        inline Digest sha_ni_finish(__m128i in_abef, __m128i in_cdgh)
+        {
+                const __m128i feba = _mm_shuffle_epi32(in_abef, 0x1B);
+                const __m128i dchg = _mm_shuffle_epi32(in_cdgh, 0xB1);
+                const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+                char bytes[Digest::length];
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(bytes),
+                                 _mm_shuffle_epi8(_mm_blend_epi16(feba, dchg, 0xF0), bswap));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(bytes + 16),
+                                 _mm_shuffle_epi8(_mm_alignr_epi8(dchg, feba, 8), bswap));
+                return Digest(bytes);
+        }
+
+        __attribute__((target("sha,sse4.1")))
+        void sha256_batch_sha_ni(const char *const *in_bufs, const size_t *in_lens, size_t in_count,
+                                 Digest *out_digests)
+        {
+                const vector<size_t> order(by_length(in_lens, in_count));
+                PaddedMessage first, second;
+                size_t i = 0;
+                for(; i + 1 < in_count; i += 2) {
+                        first.init(in_bufs[order[i]], in_lens[order[i]]);
+                        second.init(in_bufs[order[i + 1]], in_lens[order[i + 1]]);
+                        __m128i abef1, cdgh1, abef2, cdgh2;
+                        sha_ni_start(abef1, cdgh1);
+                        sha_ni_start(abef2, cdgh2);
+                        size_t k = 0;
+                        for(; k < second.blocks(); k++) {
+                                sha_ni_block(abef1, cdgh1, first.block(k));
+                                sha_ni_block(abef2, cdgh2, second.block(k));
+                        }
+                        for(; k < first.blocks(); k++)
+                                sha_ni_block(abef1, cdgh1, first.block(k));
+                        out_digests[order[i]] = sha_ni_finish(abef1, cdgh1);
+                        out_digests[order[i + 1]] = sha_ni_finish(abef2, cdgh2);
+                }
+                if(i < in_count) {
+                        first.init(in_bufs[order[i]], in_lens[order[i]]);
+                        __m128i abef, cdgh;
+                        sha_ni_start(abef, cdgh);
+                        for(size_t k = 0; k < first.blocks(); k++)
+                                sha_ni_block(abef, cdgh, first.block(k));
+                        out_digests[order[i]] = sha_ni_finish(abef, cdgh);
+                }
+        }
+
+
+        /*
+          AVX2: eight messages at once, one per 32 bit lane.  Word i
+          of the state (and of the schedule) for all eight messages
+          is one vector.  A message that has run out of blocks hashes
+          a dummy block and keeps its state.
+        */
+        __attribute__((target("avx2")))
+        inline __m256i rotr(__m256i in_x, int in_n)
+        {
+                return _mm256_or_si256(_mm256_srli_epi32(in_x, in_n), _mm256_slli_epi32(in_x, 32 - in_n));
+        }
+
+        // Rows of eight words to columns, and back.
+        __attribute__((target("avx2")))
+        inline void transpose8(__m256i io_rows[8])
+        {
+                const __m256i t0 = _mm256_unpacklo_epi32(io_rows[0], io_rows[1]);
+                const __m256i t1 = _mm256_unpackhi_epi32(io_rows[0], io_rows[1]);
+                const __m256i t2 = _mm256_unpacklo_epi32(io_rows[2], io_rows[3]);
+                const __m256i t3 = _mm256_unpackhi_epi32(io_rows[2], io_rows[3]);
+                const __m256i t4 = _mm256_unpacklo_epi32(io_rows[4], io_rows[5]);
+                const __m256i t5 = _mm256_unpackhi_epi32(io_rows[4], io_rows[5]);
+                const __m256i t6 = _mm256_unpacklo_epi32(io_rows[6], io_rows[7]);
+                const __m256i t7 = _mm256_unpackhi_epi32(io_rows[6], io_rows[7]);
+                const __m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+                const __m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+                const __m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+                const __m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+                const __m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+                const __m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+                const __m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+                const __m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+                io_rows[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+                io_rows[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+                io_rows[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+                io_rows[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+                io_rows[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+                io_rows[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+                io_rows[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+                io_rows[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+        }
+
+        __attribute__((target("avx2")))
+        inline __m256i bswap32(__m256i in_x)
+        {
+                const __m256i mask = _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+                                                     12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+                return _mm256_shuffle_epi8(in_x, mask);
+        }
+
+        __attribute__((target("avx2")))
+        void avx2_block(__m256i io_state[8], const unsigned char *const in_blocks[8], __m256i in_active)
+        {
+                __m256i w[16];
+                for(int half = 0; half < 2; half++) {
+                        for(int lane = 0; lane < 8; lane++)
+                                w[8 * half + lane] = _mm256_loadu_si256(
+                                        reinterpret_cast<const __m256i *>(in_blocks[lane] + 32 * half));
+                        transpose8(w + 8 * half);
+                }
+                for(int t = 0; t < 16; t++)
+                        w[t] = bswap32(w[t]);
+
+                __m256i a = io_state[0], b = io_state[1], c = io_state[2], d = io_state[3];
+                __m256i e = io_state[4], f = io_state[5], g = io_state[6], h = io_state[7];
+                for(int t = 0; t < 64; t++) {
+                        if(t >= 16) {
+                                const __m256i w15 = w[(t - 15) & 15];
+                                const __m256i w2 = w[(t - 2) & 15];
+                                const __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(rotr(w15, 7), rotr(w15, 18)),
+                                                                    _mm256_srli_epi32(w15, 3));
+                                const __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(rotr(w2, 17), rotr(w2, 19)),
+                                                                    _mm256_srli_epi32(w2, 10));
+                                w[t & 15] = _mm256_add_epi32(_mm256_add_epi32(w[t & 15], s0),
+                                                             _mm256_add_epi32(w[(t - 7) & 15], s1));
+                        }
+                        const __m256i big_s1 = _mm256_xor_si256(_mm256_xor_si256(rotr(e, 6), rotr(e, 11)), rotr(e, 25));
+                        const __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+                        const __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, big_s1),
+                                                            _mm256_add_epi32(_mm256_add_epi32(ch, w[t & 15]),
+                                                                             _mm256_set1_epi32(sha256_k[t])));
+                        const __m256i big_s0 = _mm256_xor_si256(_mm256_xor_si256(rotr(a, 2), rotr(a, 13)), rotr(a, 22));
+                        const __m256i maj = _mm256_xor_si256(_mm256_and_si256(a, b),
+                                                             _mm256_and_si256(c, _mm256_xor_si256(a, b)));
+                        h = g;
+                        g = f;
+                        f = e;
+                        e = _mm256_add_epi32(d, t1);
+                        d = c;
+                        c = b;
+                        b = a;
+                        a = _mm256_add_epi32(t1, _mm256_add_epi32(big_s0, maj));
+                }
+                const __m256i result[8] = { a, b, c, d, e, f, g, h };
+                for(int i = 0; i < 8; i++)
+                        io_state[i] = _mm256_blendv_epi8(io_state[i],
+                                                         _mm256_add_epi32(io_state[i], result[i]),
+                                                         in_active);
+        }
+
+        __attribute__((target("avx2")))
+        void sha256_batch_avx2(const char *const *in_bufs, const size_t *in_lens, size_t in_count,
+                               Digest *out_digests)
+        {
+                static const unsigned char dummy_block[64] = { 0 };
+                const vector<size_t> order(by_length(in_lens, in_count));
+                PaddedMessage messages[8];
+                for(size_t first = 0; first < in_count; first += 8) {
+                        const size_t lanes = min<size_t>(8, in_count - first);
+                        for(size_t lane = 0; lane < lanes; lane++)
+                                messages[lane].init(in_bufs[order[first + lane]], in_lens[order[first + lane]]);
+                        __m256i state[8];
+                        for(int i = 0; i < 8; i++)
+                                state[i] = _mm256_set1_epi32(sha256_h0[i]);
+                        for(size_t k = 0; k < messages[0].blocks(); k++) {
+                                const unsigned char *blocks[8];
+                                int active[8];
+                                for(size_t lane = 0; lane < 8; lane++) {
+                                        const bool live = lane < lanes && k < messages[lane].blocks();
+                                        blocks[lane] = live ? messages[lane].block(k) : dummy_block;
+                                        active[lane] = live ? -1 : 0;
+                                }
+                                avx2_block(state, blocks,
+                                           _mm256_set_epi32(active[7], active[6], active[5], active[4],
+                                                            active[3], active[2], active[1], active[0]));
+                        }
+                        transpose8(state);
+                        for(size_t lane = 0; lane < lanes; lane++) {
+                                char bytes[Digest::length];
+                                _mm256_storeu_si256(reinterpret_cast<__m256i *>(bytes), bswap32(state[lane]));
+                                out_digests[order[first + lane]] = Digest(bytes);
+                        }
+                }
+        }
+
+
+        bool cpu_has_sha()
+        {
+                unsigned int eax, ebx, ecx, edx;
+                if(!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+                        return false;
+                return (ebx & (1u << 29)) && __builtin_cpu_supports("sse4.1");
+        }
+#endif  /* CRYPTAR_X86_KERNELS */
+
+
+        struct NamedKernel {
+                const char *m_name;
+                BatchKernel m_kernel;
+        };
+
+        // What this CPU can run, best first.
+        vector<NamedKernel> available_kernels()
+        {
+                vector<NamedKernel> kernels;
+#if CRYPTAR_X86_KERNELS
+                __builtin_cpu_init();
+                if(cpu_has_sha())
+                        kernels.push_back(NamedKernel{"sha-ni", sha256_batch_sha_ni});
+                if(__builtin_cpu_supports("avx2"))
+                        kernels.push_back(NamedKernel{"avx2", sha256_batch_avx2});
+#endif
+                kernels.push_back(NamedKernel{"single", sha256_batch_single});
+                return kernels;
+        }
+
+        NamedKernel &active_kernel()
+        {
+                static NamedKernel kernel = available_kernels().front();
+                return kernel;
+        }
+}
+
+
+
+void cryptar::sha256_batch(const char *const *in_bufs, const size_t *in_lens, size_t in_count,
+                           Digest *out_digests)
+{
+        active_kernel().m_kernel(in_bufs, in_lens, in_count, out_digests);
+}
+
+
+
+const char *cryptar::sha256_batch_kernel()
+{
+        return active_kernel().m_name;
+}
+
+
+
+bool cryptar::use_sha256_batch_kernel(const string &in_name)
+{
+        const vector<NamedKernel> kernels(available_kernels());
+        for(auto it = kernels.begin(); it != kernels.end(); ++it)
+                if(in_name == it->m_name) {
+                        active_kernel() = *it;
+                        return true;
+                }
+        return false;
+}
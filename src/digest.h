@@ -0,0 +1,112 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+#ifndef __DIGEST_H__
+#define __DIGEST_H__ 1
+
+
+#include <boost/serialization/binary_object.hpp>
+#include <cstring>
+#include <functional>
+#include <string>
+
+
+namespace cryptar {
+
+        /*
+          A 32 byte value: a SHA-256 digest, or a block id.  Just the
+          bytes, so it copies, compares and hashes without allocating,
+          and maps and sets of them are dense.  All zeros is empty.
+        */
+        class Digest {
+        public:
+                static const size_t length = 32;
+                static const size_t encoded_length = 44;        /* base64, with padding */
+
+                Digest() { std::memset(m_bytes, 0, length); }
+                // The first length bytes at in_bytes.
+                explicit Digest(const char *in_bytes) { std::memcpy(m_bytes, in_bytes, length); }
+
+                bool operator==(const Digest &in_digest) const
+                { return 0 == std::memcmp(m_bytes, in_digest.m_bytes, length); }
+                bool operator!=(const Digest &in_digest) const
+                { return !operator==(in_digest); }
+                bool operator<(const Digest &in_digest) const
+                { return std::memcmp(m_bytes, in_digest.m_bytes, length) < 0; }
+
+                bool empty() const { return *this == Digest(); }
+                const char *data() const { return reinterpret_cast<const char *>(m_bytes); }
+                std::string as_string() const { return std::string(data(), length); }
+
+                // Base64 and, if in_filesystem_safe, '_' for '/' (as
+                // message_digest() has always done).
+                std::string encode(bool in_filesystem_safe = true) const;
+                // The digest encode() gave, either way.  Throws
+                // std::domain_error if it isn't one.
+                static Digest decode(const std::string &in_encoded);
+
+                // The bytes are already uniform, so any eight will do.
+                size_t hash() const
+                {
+                        size_t hash;
+                        std::memcpy(&hash, m_bytes, sizeof(hash));
+                        return hash;
+                }
+
+        private:
+                unsigned char m_bytes[length];
+
+                friend class boost::serialization::access;
+                template<class Archive>
+                        void serialize(Archive &in_ar, const unsigned int in_version) {
+                        in_ar & boost::serialization::make_binary_object(m_bytes, length);
+                }
+        };
+
+
+        /*
+          SHA-256 of many independent buffers at once:
+          out_digests[i] is the digest of in_lens[i] bytes at
+          in_bufs[i].  With SHA extensions we run two buffers at a
+          time, else with AVX2 eight (one per 32 bit lane), else one
+          by one.  It pays for small buffers, where one buffer at a
+          time leaves the CPU waiting on each round.
+        */
+        void sha256_batch(const char *const *in_bufs, const size_t *in_lens, size_t in_count,
+                          Digest *out_digests);
+
+        // Name the kernel sha256_batch() uses.
+        const char *sha256_batch_kernel();
+        // Use the named kernel instead, if this CPU has it, and say
+        // if it does.  For tests and benchmarks.
+        bool use_sha256_batch_kernel(const std::string &in_name);
+}
+
+
+namespace std {
+        template<> struct hash<cryptar::Digest> {
+                size_t operator()(const cryptar::Digest &in_digest) const
+                { return in_digest.hash(); }
+        };
+}
+
+#endif  /* __DIGEST_H__*/
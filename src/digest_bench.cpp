@@ -0,0 +1,99 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "crypt.h"
+#include "digest.h"
+
+
+using namespace cryptar;
+using namespace std;
+
+
+/*
+  How many blocks a second can we hash, one at a time with sha256()
+  or together with sha256_batch(), with each kernel this CPU has?
+*/
+
+
+namespace {
+
+        const unsigned long total_bytes = 32 * 1024 * 1024;
+
+
+        void report(const string &in_name,
+                    unsigned long in_blocks,
+                    chrono::steady_clock::time_point in_start,
+                    chrono::steady_clock::time_point in_end)
+        {
+                double seconds = chrono::duration<double>(in_end - in_start).count();
+                cout << setw(20) << left << in_name
+                     << setw(12) << right << fixed << setprecision(0)
+                     << in_blocks / seconds << " blocks/s  "
+                     << setw(8) << setprecision(1)
+                     << total_bytes / (1024 * 1024) / seconds << " MB/s"
+                     << endl;
+        }
+
+
+        void bench(unsigned long in_block_size)
+        {
+                const string text(pseudo_random_string(total_bytes));
+                const unsigned long blocks = total_bytes / in_block_size;
+                vector<const char *> bufs(blocks);
+                vector<size_t> lens(blocks, in_block_size);
+                for(unsigned long i = 0; i < blocks; i++)
+                        bufs[i] = text.data() + i * in_block_size;
+                vector<Digest> digests(blocks);
+                cout << endl << in_block_size << " byte blocks:" << endl;
+
+                auto start = chrono::steady_clock::now();
+                for(unsigned long i = 0; i < blocks; i++)
+                        digests[i] = sha256(bufs[i], lens[i]);
+                report("sha256()", blocks, start, chrono::steady_clock::now());
+                const vector<Digest> expected(digests);
+
+                const char *kernels[] = { "sha-ni", "avx2", "single" };
+                for(const char *kernel : kernels) {
+                        if(!use_sha256_batch_kernel(kernel))
+                                continue;
+                        start = chrono::steady_clock::now();
+                        sha256_batch(bufs.data(), lens.data(), blocks, digests.data());
+                        report(string("batch, ") + kernel, blocks, start, chrono::steady_clock::now());
+                        if(digests != expected)
+                                cout << "digests differ!" << endl;
+                }
+        }
+}
+
+
+int main(int argc, char *argv[])
+{
+        bench(512);
+        bench(4096);
+        bench(64 * 1024);
+        return 0;
+}
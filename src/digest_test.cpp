@@ -0,0 +1,150 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE tests
+#include <boost/test/unit_test.hpp>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "cryptar.h"
+
+
+using namespace cryptar;
+using namespace std;
+
+
+namespace {
+
+        /*
+          Digests encode as message_digest() always has, decode back,
+          and compare and hash by value.
+        */
+        void test_digest()
+        {
+                // SHA-256 of the empty string, which has a '/'.
+                const Digest empty_sha(sha256("", 0));
+                BOOST_CHECK_EQUAL(empty_sha.encode(false),
+                                  "47DEQpj8HBSa+/TImW+5JCeuQeRkm5NMpJWZG3hSuFU=");
+                BOOST_CHECK_EQUAL(empty_sha.encode(true),
+                                  "47DEQpj8HBSa+_TImW+5JCeuQeRkm5NMpJWZG3hSuFU=");
+                BOOST_CHECK_EQUAL(message_digest(""), empty_sha.encode(false));
+
+                BOOST_CHECK(Digest().empty());
+                BOOST_CHECK(!empty_sha.empty());
+                BOOST_CHECK_EQUAL(Digest().encode().size(), Digest::encoded_length);
+                BOOST_CHECK(Digest::decode(empty_sha.encode(false)) == empty_sha);
+                BOOST_CHECK(Digest::decode(empty_sha.encode(true)) == empty_sha);
+                BOOST_CHECK_THROW(Digest::decode("47DEQpj8"), domain_error);
+                BOOST_CHECK_THROW(Digest::decode(string(Digest::encoded_length, '!')), domain_error);
+                // Padding only at the end, and no stray bits under it.
+                BOOST_CHECK_THROW(Digest::decode("47DEQpj8HBSa+/TImW+5JCeuQeRkm5NMpJWZG3hSuFUA"), domain_error);
+                BOOST_CHECK_THROW(Digest::decode("47DEQpj8HBSa+/TImW+5JCeuQeRkm5NMpJWZG3hSuF=="), domain_error);
+                BOOST_CHECK_THROW(Digest::decode("47DE=pj8HBSa+/TImW+5JCeuQeRkm5NMpJWZG3hSuFU="), domain_error);
+                BOOST_CHECK_THROW(Digest::decode("47DEQpj8HBSa+/TImW+5JCeuQeRkm5NMpJWZG3hSuFV="), domain_error);
+
+                const Digest copy(empty_sha);
+                BOOST_CHECK(copy == empty_sha);
+                BOOST_CHECK(copy.as_string() == empty_sha.as_string());
+                BOOST_CHECK(Digest(copy.data()) == empty_sha);
+                BOOST_CHECK(Digest() < empty_sha);
+                BOOST_CHECK(!(empty_sha < copy));
+
+                unordered_set<Digest> digests;
+                map<Digest, int> ordered;
+                for(int i = 0; i < 1000; i++) {
+                        const string text(pseudo_random_string(i));
+                        digests.insert(sha256(text.data(), text.size()));
+                        ordered[sha256(text.data(), text.size())] = i;
+                        BOOST_CHECK_EQUAL(sha256(text.data(), text.size()).encode(true),
+                                          message_digest(text, true));
+                        BOOST_CHECK(Digest::decode(message_digest(text, true))
+                                    == sha256(text.data(), text.size()));
+                }
+                BOOST_CHECK_EQUAL(digests.size(), 1000);
+                BOOST_CHECK_EQUAL(ordered.size(), 1000);
+                BOOST_CHECK_EQUAL(digests.count(empty_sha), 1);
+        }
+
+
+        /*
+          Every batch kernel this CPU has agrees with sha256(), for
+          lengths about the padding boundaries, batches of mixed
+          length, and batches that don't fill the lanes.
+        */
+        void test_batch()
+        {
+                const string selected(sha256_batch_kernel());
+                cout << "sha256 batch kernel: " << selected << endl;
+                const string text(pseudo_random_string(200000));
+                vector<size_t> lengths;
+                for(size_t len = 0; len < 200; len++)
+                        lengths.push_back(len);
+                const size_t more[] = { 1000, 4096, 65535, 65536, 65537, 199999 };
+                lengths.insert(lengths.end(), more, more + sizeof(more) / sizeof(more[0]));
+
+                const char *kernels[] = { "sha-ni", "avx2", "single" };
+                for(const char *kernel : kernels) {
+                        if(!use_sha256_batch_kernel(kernel)) {
+                                cout << "  (no " << kernel << " here)" << endl;
+                                continue;
+                        }
+                        for(size_t count = 0; count <= 19; count++) {
+                                vector<const char *> bufs;
+                                vector<size_t> lens;
+                                for(size_t i = 0; i < count; i++) {
+                                        const size_t len = lengths[(7 * i + count) % lengths.size()];
+                                        bufs.push_back(text.data() + i);
+                                        lens.push_back(len);
+                                }
+                                vector<Digest> digests(count);
+                                sha256_batch(bufs.data(), lens.data(), count, digests.data());
+                                for(size_t i = 0; i < count; i++)
+                                        BOOST_CHECK(digests[i] == sha256(bufs[i], lens[i]));
+                        }
+                        vector<const char *> bufs(lengths.size());
+                        vector<Digest> digests(lengths.size());
+                        for(size_t i = 0; i < lengths.size(); i++)
+                                bufs[i] = text.data() + lengths.size() - i;
+                        sha256_batch(bufs.data(), lengths.data(), lengths.size(), digests.data());
+                        for(size_t i = 0; i < lengths.size(); i++)
+                                BOOST_CHECK(digests[i] == sha256(bufs[i], lengths[i]));
+                }
+                BOOST_CHECK(use_sha256_batch_kernel(selected));
+                BOOST_CHECK(!use_sha256_batch_kernel("no such kernel"));
+        }
+}
+
+
+BOOST_AUTO_TEST_CASE(digest)
+{
+        test_digest();
+}
+
+BOOST_AUTO_TEST_CASE(batch)
+{
+        test_batch();
+}
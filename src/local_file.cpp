@@ -0,0 +1,227 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits>
+#include <mutex>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "local_file.h"
+#include "system.h"
+
+
+using namespace cryptar;
+using namespace std;
+
+
+namespace {
+
+        /*
+          The mappings that the SIGBUS handler looks after, one per
+          slot.  The handler may run on any thread at any moment, so
+          it touches nothing but these atomics and system calls.  A
+          slot's length is set before its start and its start cleared
+          before the slot is given up, so the handler never sees half
+          of one.
+        */
+        struct Guard {
+                atomic<bool> m_used;
+                atomic<uintptr_t> m_begin;
+                atomic<size_t> m_length;
+                atomic<bool> m_faulted;
+        };
+
+        const int max_guards = 256;
+        Guard guards[max_guards];
+        uintptr_t page_size;
+        struct sigaction previous_sigbus;
+
+
+        /*
+          A fault in a guarded mapping is the file having shrunk under
+          it: put zeros where the file was, from the faulting page to
+          the end of the mapping, note it, and carry on.  A fault
+          anywhere else is none of ours, so we put back whatever
+          handled SIGBUS before us, and the fault recurs with that.
+        */
+        void on_sigbus(int in_signal, siginfo_t *in_info, void *in_context)
+        {
+                const uintptr_t address = reinterpret_cast<uintptr_t>(in_info->si_addr);
+                for(int i = 0; i < max_guards; i++) {
+                        const uintptr_t begin = guards[i].m_begin;
+                        if(!begin || address < begin || address - begin >= guards[i].m_length)
+                                continue;
+                        const uintptr_t page = address & ~(page_size - 1);
+                        if(MAP_FAILED != mmap(reinterpret_cast<void *>(page),
+                                              begin + guards[i].m_length - page, PROT_READ,
+                                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0)) {
+                                guards[i].m_faulted = true;
+                                return;
+                        }
+                        break;
+                }
+                sigaction(SIGBUS, &previous_sigbus, 0);
+        }
+
+
+        /*
+          Make sure on_sigbus() handles SIGBUS.  We look each time we
+          map a file, since someone may have put in their own handler
+          since we last did (a test harness, say).
+        */
+        bool install_sigbus_handler()
+        {
+                static mutex install_mutex;
+                lock_guard<mutex> lock(install_mutex);
+                struct sigaction action;
+                if(sigaction(SIGBUS, 0, &action))
+                        return false;
+                if((action.sa_flags & SA_SIGINFO) && on_sigbus == action.sa_sigaction)
+                        return true;
+                page_size = sysconf(_SC_PAGESIZE);
+                memset(&action, 0, sizeof(action));
+                action.sa_sigaction = on_sigbus;
+                action.sa_flags = SA_SIGINFO;
+                sigemptyset(&action.sa_mask);
+                return 0 == sigaction(SIGBUS, &action, &previous_sigbus);
+        }
+
+
+        // Guard a mapping, and return its slot, or -1 if we can't.
+        int add_guard(const char *in_data, size_t in_length)
+        {
+                if(!install_sigbus_handler())
+                        return -1;
+                for(int i = 0; i < max_guards; i++) {
+                        bool used = false;
+                        if(!guards[i].m_used.compare_exchange_strong(used, true))
+                                continue;
+                        guards[i].m_faulted = false;
+                        guards[i].m_length = in_length;
+                        guards[i].m_begin = reinterpret_cast<uintptr_t>(in_data);
+                        return i;
+                }
+                return -1;
+        }
+
+
+        void remove_guard(int in_guard)
+        {
+                guards[in_guard].m_begin = 0;
+                guards[in_guard].m_used = false;
+        }
+}
+
+
+/*
+  Open the file and, if we may, map it.  We map it only if we can
+  guard the mapping against the file shrinking (cf. local_file.h).
+
+  We tell the kernel we'll read the mapping in order and soon, so it
+  reads ahead aggressively.  When we can't map, we give the same
+  advice about the file itself.
+*/
+LocalFile::LocalFile(const string &in_filename, bool in_map)
+        : m_filename(in_filename), m_fd(-1), m_size(0), m_data(0), m_guard(-1)
+{
+        m_fd = open(in_filename.c_str(), O_RDONLY);
+        if(m_fd < 0)
+                throw_system_error("LocalFile::LocalFile(open)");
+        struct stat stat_buf;
+        if(fstat(m_fd, &stat_buf)) {
+                close(m_fd);
+                throw_system_error("LocalFile::LocalFile(fstat)");
+        }
+        m_size = stat_buf.st_size;
+        m_mtime_sec = stat_buf.st_mtim.tv_sec;
+        m_mtime_nsec = stat_buf.st_mtim.tv_nsec;
+
+        if(in_map && m_size > 0
+           && static_cast<unsigned long long>(m_size) <= numeric_limits<size_t>::max()) {
+                void *data = mmap(0, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+                if(MAP_FAILED != data)
+                        m_guard = add_guard(static_cast<const char *>(data), m_size);
+                if(MAP_FAILED != data && m_guard < 0)
+                        munmap(data, m_size);
+                else if(MAP_FAILED != data) {
+                        posix_madvise(data, m_size, POSIX_MADV_SEQUENTIAL);
+                        posix_madvise(data, m_size, POSIX_MADV_WILLNEED);
+                        m_data = static_cast<const char *>(data);
+                        return;
+                }
+        }
+        posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+
+LocalFile::~LocalFile()
+{
+        if(m_data) {
+                remove_guard(m_guard);
+                munmap(const_cast<char *>(m_data), m_size);
+        }
+        close(m_fd);
+}
+
+
+
+bool LocalFile::changed() const
+{
+        if(m_data && guards[m_guard].m_faulted)
+                return true;
+        struct stat stat_buf;
+        if(fstat(m_fd, &stat_buf))
+                throw_system_error("LocalFile::changed()");
+        return static_cast<unsigned long>(stat_buf.st_size) != m_size
+                || stat_buf.st_mtim.tv_sec != m_mtime_sec
+                || stat_buf.st_mtim.tv_nsec != m_mtime_nsec;
+}
+
+
+/*
+  Read with pread(), so that reads don't depend on (or move) a file
+  position.  Short only at the end of the file.
+*/
+unsigned long LocalFile::read(unsigned long in_offset, char *out_buf, unsigned long in_len) const
+{
+        unsigned long done = 0;
+        while(done < in_len) {
+                ssize_t n = pread(m_fd, out_buf + done, in_len - done, in_offset + done);
+                if(n < 0) {
+                        if(EINTR == errno)
+                                continue;
+                        throw_system_error("LocalFile::read()");
+                }
+                if(0 == n)
+                        break;
+                done += n;
+        }
+        return done;
+}
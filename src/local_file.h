@@ -0,0 +1,80 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+#ifndef __LOCAL_FILE_H__
+#define __LOCAL_FILE_H__ 1
+
+
+#include <string>
+
+
+namespace cryptar {
+
+        /*
+          A local file to back up, opened read-only.
+
+          If we can, we map the whole file, and data() points at it,
+          so that CoverBlock can scan it, hash it, and cut blocks from
+          it without copying it.  If the file can't be mapped (it is
+          too big for the address space, or on a filesystem that
+          doesn't support it, or in_map is false), data() is 0 and
+          the client reads it piecewise with read().
+
+          We back up live files, which may change while we read
+          them.  Touching a page of a mapping past the end of a file
+          that has shrunk raises SIGBUS, which would kill us, so
+          LocalFile catches it: such pages read as zeros instead, and
+          changed() is true.  changed() is also true if the file's
+          size or modification time isn't what it was when we opened
+          it.  Either way, what we read of the file may not be any
+          one version of it, and the client should not keep it.
+        */
+        class LocalFile {
+        public:
+                LocalFile(const std::string &in_filename, bool in_map = true);
+                ~LocalFile();
+
+                const std::string &filename() const { return m_filename; }
+                unsigned long size() const { return m_size; }
+                bool mapped() const { return 0 != m_data; }
+                const char *data() const { return m_data; }
+
+                // Read up to in_len bytes at in_offset, return how many we read.
+                unsigned long read(unsigned long in_offset, char *out_buf, unsigned long in_len) const;
+
+                bool changed() const;
+
+        private:
+                LocalFile(const LocalFile &);
+                LocalFile &operator=(const LocalFile &);
+
+                std::string m_filename;
+                int m_fd;
+                unsigned long m_size;
+                const char *m_data;
+                int m_guard;                    /* cf. local_file.cpp, or -1 */
+                long long m_mtime_sec;          /* when we opened it */
+                long m_mtime_nsec;
+        };
+}
+
+#endif  /* __LOCAL_FILE_H__*/
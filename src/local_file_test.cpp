@@ -0,0 +1,177 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE tests
+#include <boost/test/unit_test.hpp>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "cryptar.h"
+#include "test_text.h"
+
+
+using namespace cryptar;
+using namespace std;
+
+
+namespace {
+
+        void write_file(const string &in_filename, const string &in_content)
+        {
+                ofstream out(in_filename, ios_base::binary | ios_base::trunc);
+                out.write(in_content.data(), in_content.size());
+        }
+
+
+        /*
+          A mapped file is all there at data(), and read() agrees.
+        */
+        void test_mapped()
+        {
+                string dir_name = temp_dir_name();
+                const string filename = dir_name + "file";
+                const string content(pseudo_random_string(100000));
+                write_file(filename, content);
+
+                LocalFile file(filename);
+                BOOST_REQUIRE(file.mapped());
+                BOOST_CHECK_EQUAL(file.size(), content.size());
+                BOOST_CHECK(string(file.data(), file.size()) == content);
+                vector<char> buf(1000);
+                BOOST_CHECK_EQUAL(file.read(5000, buf.data(), buf.size()), buf.size());
+                BOOST_CHECK(string(buf.data(), buf.size()) == content.substr(5000, 1000));
+                clean_temp_dir(dir_name);
+        }
+
+
+        /*
+          Without the mapping, we read pieces, short at the end.
+        */
+        void test_read()
+        {
+                string dir_name = temp_dir_name();
+                const string filename = dir_name + "file";
+                const string content(pseudo_random_string(100000));
+                write_file(filename, content);
+
+                LocalFile file(filename, false);
+                BOOST_CHECK(!file.mapped());
+                BOOST_CHECK(0 == file.data());
+                BOOST_CHECK_EQUAL(file.size(), content.size());
+                string read_back;
+                vector<char> buf(7777);
+                unsigned long n;
+                while((n = file.read(read_back.size(), buf.data(), buf.size())) > 0)
+                        read_back.append(buf.data(), n);
+                BOOST_CHECK(read_back == content);
+                BOOST_CHECK_EQUAL(file.read(content.size() - 10, buf.data(), buf.size()), 10UL);
+                clean_temp_dir(dir_name);
+        }
+
+
+        /*
+          We don't map an empty file, and a missing file is an error.
+        */
+        void test_edge()
+        {
+                string dir_name = temp_dir_name();
+                const string filename = dir_name + "file";
+                write_file(filename, string());
+                LocalFile file(filename);
+                BOOST_CHECK(!file.mapped());
+                BOOST_CHECK_EQUAL(file.size(), 0UL);
+                char c;
+                BOOST_CHECK_EQUAL(file.read(0, &c, 1), 0UL);
+                BOOST_CHECK_THROW(LocalFile(dir_name + "missing"), string);
+                clean_temp_dir(dir_name);
+        }
+
+
+        /*
+          A mapped file that shrinks under us reads as zeros past its
+          new end, rather than killing us, and we know it changed.
+        */
+        void test_shrunk()
+        {
+                string dir_name = temp_dir_name();
+                const string filename = dir_name + "file";
+                const string content(pseudo_random_string(1000000));
+                write_file(filename, content);
+
+                LocalFile file(filename);
+                BOOST_REQUIRE(file.mapped());
+                BOOST_CHECK(!file.changed());
+                BOOST_CHECK_EQUAL(file.data()[100], content[100]);
+                BOOST_REQUIRE(0 == truncate(filename.c_str(), 4096));
+                BOOST_CHECK_EQUAL(file.data()[100], content[100]);
+                BOOST_CHECK_EQUAL(file.data()[500000], 0);
+                BOOST_CHECK_EQUAL(file.data()[content.size() - 1], 0);
+                BOOST_CHECK(file.changed());
+                clean_temp_dir(dir_name);
+        }
+
+
+        /*
+          Without the mapping, we still notice a change of size.
+        */
+        void test_changed()
+        {
+                string dir_name = temp_dir_name();
+                const string filename = dir_name + "file";
+                write_file(filename, pseudo_random_string(10000));
+
+                LocalFile file(filename, false);
+                BOOST_CHECK(!file.changed());
+                write_file(filename, pseudo_random_string(5000));
+                BOOST_CHECK(file.changed());
+                clean_temp_dir(dir_name);
+        }
+}
+
+
+BOOST_AUTO_TEST_CASE(whole)
+{
+        test_mapped();
+}
+
+BOOST_AUTO_TEST_CASE(piecewise)
+{
+        test_read();
+}
+
+BOOST_AUTO_TEST_CASE(edge)
+{
+        test_edge();
+}
+
+BOOST_AUTO_TEST_CASE(shrunk)
+{
+        test_shrunk();
+}
+
+BOOST_AUTO_TEST_CASE(changed)
+{
+        test_changed();
+}
@@ -0,0 +1,164 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <stdexcept>
+#include <string>
+
+#include "compress.h"
+#include "crypt.h"
+#include "local_file.h"
+#include "pipeline.h"
+
+
+using namespace cryptar;
+using namespace std;
+
+
+void OstreamSink::write(const char *in_buf, size_t in_len)
+{
+        if(!m_stream.write(in_buf, in_len))
+                throw(runtime_error("OstreamSink::write() failed"));
+}
+
+
+
+void OstreamSink::close()
+{
+        if(!m_stream.flush())
+                throw(runtime_error("OstreamSink::close() failed"));
+}
+
+
+
+void cryptar::pump(istream &in_stream, ByteSink &out_sink)
+{
+        string buffer(pipeline_chunk_size, '\0');
+        while(in_stream) {
+                in_stream.read(&buffer[0], buffer.size());
+                if(in_stream.gcount() > 0)
+                        out_sink.write(buffer.data(), in_stream.gcount());
+        }
+        if(in_stream.bad())
+                throw(runtime_error("pump(): read failed"));
+        out_sink.close();
+}
+
+
+
+/*
+  A mapped file goes to the sink a piece at a time too, so that the
+  first stage never sees more than pipeline_chunk_size at once.
+*/
+void cryptar::pump(const LocalFile &in_file, ByteSink &out_sink)
+{
+        if(in_file.mapped()) {
+                for(unsigned long offset = 0; offset < in_file.size(); offset += pipeline_chunk_size)
+                        out_sink.write(in_file.data() + offset,
+                                       min<unsigned long>(pipeline_chunk_size,
+                                                          in_file.size() - offset));
+        } else {
+                string buffer(pipeline_chunk_size, '\0');
+                unsigned long offset = 0;
+                while(offset < in_file.size()) {
+                        unsigned long got = in_file.read(offset, &buffer[0], buffer.size());
+                        if(0 == got)
+                                throw(runtime_error("pump(): " + in_file.filename()
+                                                    + " shrank while we read it"));
+                        out_sink.write(buffer.data(), got);
+                        offset += got;
+                }
+        }
+        out_sink.close();
+}
+
+
+
+Encoder::Encoder(const string &in_crypto_key, ByteSink &out_sink)
+        : m_context(cipher_context(in_crypto_key)),
+          m_encrypt(new EncryptSink(*m_context, out_sink)),
+          m_compress(new CompressSink(*m_encrypt))
+{
+}
+
+
+
+Encoder::Encoder(const string &in_crypto_key, ByteSink &out_sink, const CompressParams &in_params)
+        : m_context(cipher_context(in_crypto_key)),
+          m_encrypt(new EncryptSink(*m_context, out_sink)),
+          m_compress(new CompressSink(*m_encrypt, in_params))
+{
+}
+
+
+
+Encoder::~Encoder()
+{
+}
+
+
+
+void Encoder::write(const char *in_buf, size_t in_len)
+{
+        m_compress->write(in_buf, in_len);
+}
+
+
+
+void Encoder::expect(size_t in_len)
+{
+        m_compress->expect(in_len);
+}
+
+
+
+void Encoder::close()
+{
+        m_compress->close();
+}
+
+
+
+Decoder::Decoder(const string &in_crypto_key, ByteSink &out_sink, const DictionarySource *in_dictionaries)
+        : m_context(cipher_context(in_crypto_key)),
+          m_decompress(new DecompressSink(out_sink, in_dictionaries)),
+          m_decrypt(new DecryptSink(*m_context, *m_decompress))
+{
+}
+
+
+
+Decoder::~Decoder()
+{
+}
+
+
+
+void Decoder::write(const char *in_buf, size_t in_len)
+{
+        m_decrypt->write(in_buf, in_len);
+}
+
+
+
+void Decoder::close()
+{
+        m_decrypt->close();
+}
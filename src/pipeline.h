@@ -0,0 +1,139 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+#ifndef __PIPELINE_H__
+#define __PIPELINE_H__ 1
+
+
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <string>
+
+
+namespace cryptar {
+
+        class LocalFile;
+
+
+        /*
+          Pipelines move data in pieces of about this size, so that
+          what they hold doesn't depend on how much passes through.
+        */
+        const size_t pipeline_chunk_size = 64 * 1024;
+
+
+        /*
+          Somewhere to put bytes, a piece at a time.  A stage of a
+          pipeline is a ByteSink that transforms what it is given and
+          writes the result to the next sink.  close() says there is
+          no more, flushes what the stage holds, and closes the next
+          sink.
+        */
+        class ByteSink {
+        public:
+                virtual ~ByteSink() {};
+                virtual void write(const char *in_buf, size_t in_len) = 0;
+                virtual void close() {};
+        };
+
+
+        // Append to a string.
+        class StringSink : public ByteSink {
+        public:
+                explicit StringSink(std::string &out_string) : m_string(out_string) {};
+                virtual void write(const char *in_buf, size_t in_len) { m_string.append(in_buf, in_len); }
+
+        private:
+                std::string &m_string;
+        };
+
+
+        // Write to a stream (notably a file).  Throw if the stream fails.
+        class OstreamSink : public ByteSink {
+        public:
+                explicit OstreamSink(std::ostream &out_stream) : m_stream(out_stream) {};
+                virtual void write(const char *in_buf, size_t in_len);
+                virtual void close();
+
+        private:
+                std::ostream &m_stream;
+        };
+
+
+        // Write all of a stream or file to the sink, then close the sink.
+        void pump(std::istream &in_stream, ByteSink &out_sink);
+        void pump(const LocalFile &in_file, ByteSink &out_sink);
+
+
+        class CompressSink;     /* cf. compress.h */
+        class DecompressSink;
+        struct CompressParams;
+        class DictionarySource;
+        class CipherContext;    /* cf. crypt.h */
+        class EncryptSink;
+        class DecryptSink;
+
+        /*
+          What we do to data before it leaves the machine: compress,
+          then encrypt (cf. EncryptSink for the format).
+        */
+        class Encoder : public ByteSink {
+        public:
+                Encoder(const std::string &in_crypto_key, ByteSink &out_sink);
+                Encoder(const std::string &in_crypto_key,
+                        ByteSink &out_sink,
+                        const CompressParams &in_params);
+                virtual ~Encoder();
+                virtual void write(const char *in_buf, size_t in_len);
+                virtual void close();
+                // Cf. CompressSink::expect().
+                void expect(size_t in_len);
+
+        private:
+                std::shared_ptr<CipherContext> m_context;
+                std::unique_ptr<EncryptSink> m_encrypt;
+                std::unique_ptr<CompressSink> m_compress;
+        };
+
+
+        /*
+          And back: decrypt (any format decrypt() reads), then
+          decompress, with the store's dictionaries if it has any.
+        */
+        class Decoder : public ByteSink {
+        public:
+                Decoder(const std::string &in_crypto_key,
+                        ByteSink &out_sink,
+                        const DictionarySource *in_dictionaries = 0);
+                virtual ~Decoder();
+                virtual void write(const char *in_buf, size_t in_len);
+                virtual void close();
+
+        private:
+                std::shared_ptr<CipherContext> m_context;
+                std::unique_ptr<DecompressSink> m_decompress;
+                std::unique_ptr<DecryptSink> m_decrypt;
+        };
+}
+
+#endif  /* __PIPELINE_H__*/
@@ -0,0 +1,213 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE tests
+#include <boost/test/unit_test.hpp>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "cryptar.h"
+#include "pipeline.h"
+#include "test_text.h"
+
+
+using namespace cryptar;
+using namespace std;
+
+
+namespace {
+
+        // Remember the largest write, to check that stages pass on pieces.
+        class CountingSink : public ByteSink {
+        public:
+                CountingSink() : m_largest(0), m_closed(false) {};
+                virtual void write(const char *in_buf, size_t in_len)
+                {
+                        m_text.append(in_buf, in_len);
+                        m_largest = max(m_largest, in_len);
+                }
+                virtual void close() { m_closed = true; }
+
+                string m_text;
+                size_t m_largest;
+                bool m_closed;
+        };
+
+
+        // Write to the sink in pieces of in_piece bytes, then close.
+        void write_pieces(ByteSink &out_sink, const string &in_text, size_t in_piece)
+        {
+                for(size_t offset = 0; offset < in_text.size(); offset += in_piece)
+                        out_sink.write(in_text.data() + offset,
+                                       min(in_piece, in_text.size() - offset));
+                out_sink.close();
+        }
+
+
+        string encode(const string &in_plain, const string &in_key, size_t in_piece)
+        {
+                string cipher_text;
+                StringSink sink(cipher_text);
+                Encoder encoder(in_key, sink);
+                write_pieces(encoder, in_plain, in_piece);
+                return cipher_text;
+        }
+
+
+        string decode(const string &in_cipher, const string &in_key, size_t in_piece)
+        {
+                CountingSink sink;
+                Decoder decoder(in_key, sink);
+                write_pieces(decoder, in_cipher, in_piece);
+                BOOST_CHECK(sink.m_closed);
+                BOOST_CHECK(sink.m_largest <= pipeline_chunk_size);
+                return sink.m_text;
+        }
+
+
+        /*
+          What goes in comes out, however the writes fall, and the
+          cipher text is what compress() then encrypt() would have
+          made, as far as decrypt() and decompress() can tell.
+        */
+        void test_round_trip()
+        {
+                const string key(phrase_to_key(pseudo_random_string()));
+                // Incompressible, so that there are several segments.
+                const size_t sizes[] = { 0, 1, 1000, 64 * 1024, 64 * 1024 + 1, 300000 };
+                const size_t pieces[] = { 1, 777, 100000, 1 << 20 };
+                for(size_t size : sizes) {
+                        const string plain(pseudo_random_string(size));
+                        for(size_t piece : pieces) {
+                                if(1 == piece && size > 1000)
+                                        continue;
+                                const string cipher_text(encode(plain, key, piece));
+                                BOOST_CHECK(decode(cipher_text, key, piece) == plain);
+                                BOOST_CHECK(decompress(decrypt(cipher_text, key)) == plain);
+                        }
+                }
+        }
+
+
+        /*
+          Text encrypted in the older formats decodes too.
+        */
+        void test_formats()
+        {
+                const string key(phrase_to_key(pseudo_random_string()));
+                const string plain(pseudo_random_string(100000));
+                const string compressed(compress(plain));
+                BOOST_CHECK(decode(encrypt(compressed, key), key, 4096) == plain);
+                CipherContext cbc(key, cipher_aes_cbc);
+                BOOST_CHECK(decode(cbc.encrypt(compressed), key, 4096) == plain);
+                CipherContext stream(key, cipher_aes_gcm_stream);
+                BOOST_CHECK(cbc.decrypt(stream.encrypt(compressed)) == compressed);
+        }
+
+
+        /*
+          Damaged, truncated, or reordered streams don't decode.
+        */
+        void test_tamper()
+        {
+                const string key(phrase_to_key(pseudo_random_string()));
+                CipherContext context(key, cipher_aes_gcm_stream);
+                const string plain(pseudo_random_string(200000));
+                const string cipher_text(context.encrypt(plain));
+                const size_t header = 18;
+                const size_t segment = 64 * 1024 + 16;
+                BOOST_REQUIRE_EQUAL(cipher_text.size(), header + 3 * segment + 200000 - 3 * 64 * 1024 + 16);
+
+                string damaged(cipher_text);
+                damaged[header + segment + 10] ^= 1;
+                BOOST_CHECK_THROW(context.decrypt(damaged), runtime_error);
+
+                BOOST_CHECK_THROW(context.decrypt(cipher_text.substr(0, header + 2 * segment)),
+                                  runtime_error);
+                BOOST_CHECK_THROW(context.decrypt(cipher_text.substr(0, cipher_text.size() - 1)),
+                                  runtime_error);
+
+                string swapped(cipher_text.substr(0, header)
+                               + cipher_text.substr(header + segment, segment)
+                               + cipher_text.substr(header, segment)
+                               + cipher_text.substr(header + 2 * segment));
+                BOOST_CHECK_THROW(context.decrypt(swapped), runtime_error);
+
+                BOOST_CHECK_THROW(context.decrypt(cipher_text.substr(0, header)), runtime_error);
+                BOOST_CHECK(context.decrypt(cipher_text) == plain);
+        }
+
+
+        /*
+          Files and streams pump through, mapped or not.
+        */
+        void test_pump()
+        {
+                string dir_name = temp_dir_name();
+                const string filename = dir_name + "file";
+                const string content(pseudo_random_string(500000));
+                {
+                        ofstream out(filename, ios_base::binary | ios_base::trunc);
+                        out.write(content.data(), content.size());
+                }
+                for(int map = 0; map < 2; map++) {
+                        LocalFile file(filename, map);
+                        CountingSink sink;
+                        pump(file, sink);
+                        BOOST_CHECK(sink.m_text == content);
+                        BOOST_CHECK(sink.m_closed);
+                        BOOST_CHECK(sink.m_largest <= pipeline_chunk_size);
+                }
+                istringstream in(content);
+                CountingSink sink;
+                pump(in, sink);
+                BOOST_CHECK(sink.m_text == content);
+                BOOST_CHECK(sink.m_closed);
+                clean_temp_dir(dir_name);
+        }
+}
+
+
+BOOST_AUTO_TEST_CASE(round_trip)
+{
+        test_round_trip();
+}
+
+BOOST_AUTO_TEST_CASE(formats)
+{
+        test_formats();
+}
+
+BOOST_AUTO_TEST_CASE(tamper)
+{
+        test_tamper();
+}
+
+BOOST_AUTO_TEST_CASE(pump_file)
+{
+        test_pump();
+}
@@ -0,0 +1,94 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <chrono>
+#include <crypto++/osrng.h>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "block.h"
+#include "crypt.h"
+
+
+using namespace cryptar;
+using namespace std;
+
+
+/*
+  How many BlockIds a second can we make?  Each wants 32 random
+  bytes.  Compare seeding a new AutoSeededRandomPool for each (as
+  pseudo_random_string() used to) with this thread's buffered pool.
+*/
+
+
+namespace {
+
+        const unsigned long num_ids = 200000;
+
+
+        void report(const string &in_name,
+                    chrono::steady_clock::time_point in_start,
+                    chrono::steady_clock::time_point in_end)
+        {
+                double seconds = chrono::duration<double>(in_end - in_start).count();
+                cout << setw(28) << left << in_name
+                     << setw(12) << right << fixed << setprecision(0)
+                     << num_ids / seconds << " /s  "
+                     << setw(8) << setprecision(3) << 1e6 * seconds / num_ids << " us each"
+                     << endl;
+        }
+
+
+        // The old pseudo_random_string().
+        string seeded_random_string(int in_length)
+        {
+                CryptoPP::AutoSeededRandomPool rng;
+                string rand_str(in_length, '\0');
+                rng.GenerateBlock(reinterpret_cast<byte *>(&rand_str[0]), in_length);
+                return rand_str;
+        }
+}
+
+
+int main(int argc, char *argv[])
+{
+        volatile char last;             // so the compiler keeps the work
+        auto start = chrono::steady_clock::now();
+        for(unsigned long i = 0; i < num_ids; i++)
+                last = BlockId(seeded_random_string(Digest::length)).as_string()[0];
+        report("BlockId, pool per id", start, chrono::steady_clock::now());
+
+        start = chrono::steady_clock::now();
+        for(unsigned long i = 0; i < num_ids; i++)
+                last = BlockId().as_string()[0];
+        report("BlockId, buffered pool", start, chrono::steady_clock::now());
+
+        start = chrono::steady_clock::now();
+        for(unsigned long i = 0; i < num_ids; i++)
+                last = seeded_random_string(11)[0];
+        report("11 byte salt, pool per call", start, chrono::steady_clock::now());
+
+        start = chrono::steady_clock::now();
+        for(unsigned long i = 0; i < num_ids; i++)
+                last = pseudo_random_string(11)[0];
+        report("11 byte salt, buffered pool", start, chrono::steady_clock::now());
+
+        (void)last;
+        return 0;
+}
@@ -0,0 +1,273 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <algorithm>
+
+#include "block.h"
+#include "compress.h"
+#include "crypt.h"
+#include "pipeline.h"
+#include "stage.h"
+
+
+using namespace cryptar;
+using namespace std;
+
+
+namespace {
+
+        enum {
+                stage_compress = 0,
+                stage_encrypt,
+                stage_write,
+                stage_complete,
+        };
+
+        template<typename D> double seconds(D in_duration)
+        {
+                return chrono::duration<double>(in_duration).count();
+        }
+}
+
+
+/*
+  A block on its way through the stages.  m_text holds the plain
+  text, then the compressed text, then the cipher text.  If we drop
+  the job, we delete the block.
+*/
+struct StagePipeline::Job {
+        unique_ptr<DataBlock> m_block;
+        string m_text;
+};
+
+
+StagePipeline::Stage::Stage(const string &in_name, unsigned int in_threads, size_t in_queue_length)
+        : m_queue(in_queue_length)
+{
+        m_stats.m_name = in_name;
+        m_stats.m_threads = max(1U, in_threads);
+}
+
+
+StagePipeline::StagePipeline(const StageThreads &in_threads)
+        : m_start(Clock::now()), m_pending(0)
+{
+        m_chunk.m_name = "chunk";
+        m_chunk.m_threads = 1;
+        const size_t length = in_threads.m_queue_length;
+        m_stages.emplace_back(new Stage("compress", in_threads.m_compress, length));
+        m_stages.emplace_back(new Stage("encrypt", in_threads.m_encrypt, length));
+        m_stages.emplace_back(new Stage("write", in_threads.m_write, length));
+        // Completion actions for a block run one after another, and
+        // a block's ACT's may expect to run in the order the blocks
+        // were written, so one thread.
+        m_stages.emplace_back(new Stage("complete", 1, length));
+        for(unsigned int i = 0; i < m_stages.size(); i++)
+                start(i);
+}
+
+
+/*
+  Close each stage in turn.  A stage's workers finish what is queued
+  for them before they exit, so everything pushed is done (or
+  dropped, if something failed) when we return.
+*/
+StagePipeline::~StagePipeline()
+{
+        for(auto it = m_stages.begin(); it != m_stages.end(); ++it) {
+                (*it)->m_queue.close();
+                (*it)->m_workers.join_all();
+        }
+}
+
+
+void StagePipeline::start(unsigned int in_stage)
+{
+        Stage &stage = *m_stages[in_stage];
+        for(unsigned int i = 0; i < stage.m_stats.m_threads; i++)
+                stage.m_workers.create_thread([this, in_stage]() { run(in_stage); });
+}
+
+
+void StagePipeline::push(DataBlock *in_block, string &io_plain_text)
+{
+        JobPtr job(new Job);
+        job->m_block.reset(in_block);
+        job->m_text.swap(io_plain_text);
+        const size_t bytes = job->m_text.size();
+        {
+                boost::lock_guard<boost::mutex> lock(m_access);
+                m_pending++;
+        }
+        // We count the job before it is queued, lest a worker finish
+        // it first, and uncount it if the queue turns it away, lest
+        // wait() wait for it forever.
+        const Clock::time_point begin = Clock::now();
+        if(!m_stages[stage_compress]->m_queue.push(move(job))) {
+                done();
+                throw(logic_error("StagePipeline: push() after close"));
+        }
+        boost::lock_guard<boost::mutex> lock(m_access);
+        m_chunk.m_items++;
+        m_chunk.m_bytes += bytes;
+        m_chunk.m_blocked_seconds += seconds(Clock::now() - begin);
+}
+
+
+void StagePipeline::wait()
+{
+        const Clock::time_point begin = Clock::now();
+        boost::unique_lock<boost::mutex> lock(m_access);
+        while(m_pending)
+                m_idle.wait(lock);
+        m_chunk.m_blocked_seconds += seconds(Clock::now() - begin);
+        if(m_error) {
+                exception_ptr error = m_error;
+                m_error = exception_ptr();
+                rethrow_exception(error);
+        }
+}
+
+
+/*
+  The client's time is busy unless it is waiting on us.
+*/
+vector<StageStats> StagePipeline::stats() const
+{
+        const double wall = seconds(Clock::now() - m_start);
+        vector<StageStats> ret;
+        {
+                boost::lock_guard<boost::mutex> lock(m_access);
+                ret.push_back(m_chunk);
+        }
+        ret.back().m_wall_seconds = wall;
+        ret.back().m_busy_seconds = max(0.0, wall - ret.back().m_blocked_seconds);
+        for(auto it = m_stages.begin(); it != m_stages.end(); ++it) {
+                boost::lock_guard<boost::mutex> lock((*it)->m_stats_access);
+                ret.push_back((*it)->m_stats);
+                ret.back().m_wall_seconds = wall;
+        }
+        return ret;
+}
+
+
+/*
+  A worker: take jobs from our stage's queue until it is closed, do
+  our part and pass each on.  Once something has failed we only
+  drain the queue.
+*/
+void StagePipeline::run(unsigned int in_stage)
+{
+        Stage &stage = *m_stages[in_stage];
+        const bool last = in_stage + 1 == m_stages.size();
+        JobPtr job;
+        while(stage.m_queue.pop(job)) {
+                const size_t bytes = job->m_text.size();
+                const Clock::time_point begin = Clock::now();
+                bool ok = false;
+                {
+                        boost::lock_guard<boost::mutex> lock(m_access);
+                        ok = !m_error;
+                }
+                if(ok) {
+                        try {
+                                work(in_stage, *job);
+                        }
+                        catch(...) {
+                                fail();
+                                ok = false;
+                        }
+                }
+                const Clock::time_point worked = Clock::now();
+                if(ok && !last)
+                        ok = m_stages[in_stage + 1]->m_queue.push(move(job));
+                const Clock::time_point end = Clock::now();
+                {
+                        boost::lock_guard<boost::mutex> lock(stage.m_stats_access);
+                        stage.m_stats.m_items++;
+                        stage.m_stats.m_bytes += bytes;
+                        stage.m_stats.m_busy_seconds += seconds(worked - begin);
+                        stage.m_stats.m_blocked_seconds += seconds(end - worked);
+                }
+                if(!ok || last) {
+                        job.reset();
+                        done();
+                }
+        }
+}
+
+
+/*
+  The stages between them do what DataBlock::set_content() does,
+  then write the block.  The compressed and the cipher text are as
+  Encoder would make them, since Encoder is CompressSink feeding
+  EncryptSink.
+*/
+void StagePipeline::work(unsigned int in_stage, Job &io_job)
+{
+        DataBlock &block = *io_job.m_block;
+        string out;
+        StringSink sink(out);
+        switch(in_stage) {
+        case stage_compress: {
+                CompressSink compress(sink, block.compress_params(io_job.m_text.data(), io_job.m_text.size()));
+                const string salt(pseudo_random_string(data_block_salt_length));
+                compress.expect(salt.size() + io_job.m_text.size());
+                compress.write(salt.data(), salt.size());
+                compress.write(io_job.m_text.data(), io_job.m_text.size());
+                compress.close();
+                io_job.m_text.swap(out);
+                break;
+        }
+        case stage_encrypt: {
+                const shared_ptr<CipherContext> context(cipher_context(block.m_crypto_key));
+                EncryptSink encrypt(*context, sink);
+                encrypt.write(io_job.m_text.data(), io_job.m_text.size());
+                encrypt.close();
+                io_job.m_text.swap(out);
+                break;
+        }
+        case stage_write:
+                block.m_cipher_text = Bytes(move(io_job.m_text));
+                block.write();
+                break;
+        case stage_complete:
+                block.completion_action();
+                break;
+        }
+}
+
+
+// The job is finished, one way or another.
+void StagePipeline::done()
+{
+        boost::lock_guard<boost::mutex> lock(m_access);
+        if(0 == --m_pending)
+                m_idle.notify_all();
+}
+
+
+void StagePipeline::fail()
+{
+        boost::lock_guard<boost::mutex> lock(m_access);
+        if(!m_error)
+                m_error = current_exception();
+}
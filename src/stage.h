@@ -0,0 +1,220 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+#ifndef __STAGE_H__
+#define __STAGE_H__ 1
+
+
+#include <boost/thread.hpp>
+#include <chrono>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+namespace cryptar {
+
+        class DataBlock;
+
+
+        /*
+          A queue of bounded length between two stages.  push() waits
+          while the queue is full, pop() while it is empty.  Once the
+          queue is closed, push() refuses and pop() returns false when
+          nothing is left.
+        */
+        template<typename T> class BoundedQueue {
+        public:
+                explicit BoundedQueue(size_t in_capacity)
+                        : m_capacity(in_capacity ? in_capacity : 1), m_closed(false) {};
+
+                bool push(T &&in_item)
+                {
+                        boost::unique_lock<boost::mutex> lock(m_access);
+                        while(m_items.size() >= m_capacity && !m_closed)
+                                m_not_full.wait(lock);
+                        if(m_closed)
+                                return false;
+                        m_items.push_back(std::move(in_item));
+                        m_not_empty.notify_one();
+                        return true;
+                }
+
+                bool pop(T &out_item)
+                {
+                        boost::unique_lock<boost::mutex> lock(m_access);
+                        while(m_items.empty() && !m_closed)
+                                m_not_empty.wait(lock);
+                        if(m_items.empty())
+                                return false;
+                        out_item = std::move(m_items.front());
+                        m_items.pop_front();
+                        m_not_full.notify_one();
+                        return true;
+                }
+
+                void close()
+                {
+                        boost::lock_guard<boost::mutex> lock(m_access);
+                        m_closed = true;
+                        m_not_full.notify_all();
+                        m_not_empty.notify_all();
+                }
+
+        private:
+                const size_t m_capacity;
+                bool m_closed;
+                std::deque<T> m_items;
+                boost::mutex m_access;
+                boost::condition_variable m_not_full;
+                boost::condition_variable m_not_empty;
+        };
+
+
+        /*
+          Worker threads for each stage of a StagePipeline, and how
+          many blocks may wait between two stages.
+        */
+        struct StageThreads {
+                StageThreads() : m_compress(1), m_encrypt(1), m_write(1), m_queue_length(16) {};
+                StageThreads(unsigned int in_compress,
+                             unsigned int in_encrypt,
+                             unsigned int in_write,
+                             size_t in_queue_length = 16)
+                        : m_compress(in_compress), m_encrypt(in_encrypt),
+                          m_write(in_write), m_queue_length(in_queue_length) {};
+
+                unsigned int m_compress;
+                unsigned int m_encrypt;
+                unsigned int m_write;
+                size_t m_queue_length;
+        };
+
+
+        /*
+          What a stage has done.  Busy is time spent working, blocked
+          is time spent waiting for room in the next stage's queue.
+          Utilization is busy time over the time the stage's threads
+          have been running: a stage near 1 is the bottleneck, and
+          stages after it sit idle waiting for it.
+        */
+        struct StageStats {
+                StageStats() : m_threads(0), m_items(0), m_bytes(0),
+                               m_busy_seconds(0), m_blocked_seconds(0), m_wall_seconds(0) {};
+
+                double utilization() const
+                {
+                        const double capacity = m_threads * m_wall_seconds;
+                        return capacity > 0 ? m_busy_seconds / capacity : 0;
+                }
+
+                std::string m_name;
+                unsigned int m_threads;
+                unsigned long m_items;
+                unsigned long m_bytes;          /* into the stage */
+                double m_busy_seconds;
+                double m_blocked_seconds;
+                double m_wall_seconds;
+        };
+
+
+        /*
+          Make new DataBlock's and send them to the store on a pool of
+          threads, in stages:
+
+              chunk -> compress -> encrypt -> write -> complete
+
+          The client is the chunk stage: it cuts content into blocks
+          and push()es each with its plain text.  Each later stage has
+          its own threads and takes blocks from a bounded queue, so
+          encoding overlaps with I/O and with the client's scanning,
+          and a slow stage holds back the client rather than letting
+          the queues grow.  The complete stage, on one thread, runs
+          each block's completion actions and deletes it.
+
+          A block's id is known when it is made, so the client may
+          record it at once.  The block is in the store only after
+          wait().  The cipher text is what DataBlock::set_content()
+          would have made.
+        */
+        class StagePipeline {
+        public:
+                explicit StagePipeline(const StageThreads &in_threads = StageThreads());
+                ~StagePipeline();
+
+                /*
+                  Queue in_block to be given in_plain_text as its
+                  content and then written.  We take ownership of the
+                  block and take in_plain_text's contents.  Waits if
+                  the compress stage is full.
+                */
+                void push(DataBlock *in_block, std::string &io_plain_text);
+
+                /*
+                  Wait until every block pushed so far is written and
+                  complete.  If some stage failed, rethrow the first
+                  error (the blocks after it are dropped).
+                */
+                void wait();
+
+                // The chunk stage (the client) first, then the others.
+                std::vector<StageStats> stats() const;
+
+        private:
+                StagePipeline(const StagePipeline &);
+                StagePipeline &operator=(const StagePipeline &);
+
+                struct Job;
+                typedef std::unique_ptr<Job> JobPtr;
+                typedef BoundedQueue<JobPtr> JobQueue;
+                typedef std::chrono::steady_clock Clock;
+
+                struct Stage {
+                        Stage(const std::string &in_name, unsigned int in_threads, size_t in_queue_length);
+
+                        JobQueue m_queue;       /* the work for this stage */
+                        boost::thread_group m_workers;
+                        mutable boost::mutex m_stats_access;
+                        StageStats m_stats;
+                };
+
+                void start(unsigned int in_stage);
+                void run(unsigned int in_stage);
+                void work(unsigned int in_stage, Job &io_job);
+                void done();
+                void fail();
+
+                const Clock::time_point m_start;
+                std::vector<std::unique_ptr<Stage> > m_stages;
+
+                mutable boost::mutex m_access;
+                boost::condition_variable m_idle;
+                unsigned long m_pending;        /* pushed but not yet complete */
+                std::exception_ptr m_error;
+                StageStats m_chunk;             /* the client */
+        };
+}
+
+
+#endif  /* __STAGE_H__*/
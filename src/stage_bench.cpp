@@ -0,0 +1,131 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+
+#include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "cryptar.h"
+
+
+using namespace cryptar;
+using namespace std;
+
+
+/*
+  Make and store a lot of blocks, first one at a time on this thread
+  as block_by_content() does, then through a StagePipeline with
+  various numbers of threads per stage.  Report blocks per second
+  and how busy each stage was: the busiest stage is the bottleneck.
+*/
+
+
+namespace {
+
+        const unsigned long num_blocks = 500;
+        const unsigned long block_size = 64 * 1024;
+
+
+        // Half random, half text, so compression has something to do.
+        string block_content()
+        {
+                string content(pseudo_random_string(block_size / 2));
+                while(content.size() < block_size)
+                        content += "Text that compresses rather well.  ";
+                content.resize(block_size);
+                return content;
+        }
+
+
+        void report(const string &in_name,
+                    chrono::steady_clock::time_point in_start,
+                    chrono::steady_clock::time_point in_end)
+        {
+                double seconds = chrono::duration<double>(in_end - in_start).count();
+                cout << setw(24) << left << in_name
+                     << setw(10) << right << fixed << setprecision(0)
+                     << num_blocks / seconds << " blocks/s" << endl;
+        }
+
+
+        void bench_serial(const shared_ptr<Transport> &in_transport, const string &in_key)
+        {
+                const string content(block_content());
+                auto start = chrono::steady_clock::now();
+                for(unsigned long i = 0; i < num_blocks; i++) {
+                        DataBlock *bp = block_by_content<DataBlock>(in_transport, in_key, content);
+                        bp->write();
+                        delete bp;
+                }
+                report("serial", start, chrono::steady_clock::now());
+        }
+
+
+        void bench_stages(const shared_ptr<Transport> &in_transport,
+                          const string &in_key,
+                          const StageThreads &in_threads)
+        {
+                const string content(block_content());
+                ostringstream name;
+                name << "stages " << in_threads.m_compress << "/"
+                     << in_threads.m_encrypt << "/" << in_threads.m_write;
+                StagePipeline stages(in_threads);
+                auto start = chrono::steady_clock::now();
+                for(unsigned long i = 0; i < num_blocks; i++) {
+                        string text(content);
+                        stages.push(block_empty<DataBlock>(in_transport, in_key), text);
+                }
+                stages.wait();
+                report(name.str(), start, chrono::steady_clock::now());
+                const vector<StageStats> stats = stages.stats();
+                for(auto it = stats.begin(); it != stats.end(); ++it)
+                        cout << "    " << setw(10) << left << it->m_name
+                             << setw(3) << right << it->m_threads << " threads"
+                             << setw(6) << setprecision(0) << 100 * it->utilization() << "% busy"
+                             << setw(8) << setprecision(2) << it->m_blocked_seconds << " s blocked"
+                             << endl;
+        }
+}
+
+
+int main(int argc, char *argv[])
+{
+        const boost::filesystem::path dir
+                = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+        boost::filesystem::create_directories(dir);
+        const shared_ptr<Transport> transport(new TransportFS(dir.string() + "/"));
+        const string key(phrase_to_key(pseudo_random_string()));
+
+        const unsigned int cores = max(1U, boost::thread::hardware_concurrency());
+        bench_serial(transport, key);
+        bench_stages(transport, key, StageThreads(1, 1, 1));
+        bench_stages(transport, key, StageThreads(cores, cores, 2));
+        bench_stages(transport, key, StageThreads(2 * cores, cores, 4));
+
+        boost::filesystem::remove_all(dir);
+        return 0;
+}
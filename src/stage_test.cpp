@@ -0,0 +1,184 @@
+/*
+  Copyright 2013  Jeff Abrahamson
+  
+  This file is part of cryptar.
+  
+  cryptar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  cryptar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with cryptar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE tests
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "cryptar.h"
+#include "stage.h"
+#include "test_text.h"
+
+
+using namespace cryptar;
+using namespace std;
+
+
+namespace {
+
+        /*
+          A full queue holds back the producer, and everything pushed
+          comes out, in order, even after close().
+        */
+        void test_queue()
+        {
+                BoundedQueue<int> queue(4);
+                const int count = 10000;
+                atomic<int> pushed(0);
+                boost::thread producer([&]() {
+                        for(int i = 0; i < count; i++) {
+                                queue.push(int(i));
+                                pushed++;
+                        }
+                        queue.close();
+                });
+                // The producer stalls once the queue is full.
+                boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+                BOOST_CHECK_EQUAL(4, pushed.load());
+                int item;
+                for(int i = 0; i < count; i++) {
+                        BOOST_REQUIRE(queue.pop(item));
+                        BOOST_CHECK_EQUAL(i, item);
+                }
+                BOOST_CHECK(!queue.pop(item));
+                BOOST_CHECK(!queue.push(int(0)));
+                producer.join();
+        }
+
+
+        class CountAction : public ACT_Base {
+        public:
+                explicit CountAction(atomic<int> &io_count) : m_count(io_count) {};
+                virtual void operator()() { m_count++; }
+
+        private:
+                atomic<int> &m_count;
+        };
+
+
+        /*
+          Blocks made on the pipeline's threads read back as if made
+          by block_by_content(), and each block's completion actions
+          run once.
+        */
+        void test_blocks()
+        {
+                mode(Testing, true);
+                ConfigParam params(fs);
+                params.m_passphrase = pseudo_random_string();
+                params.m_local_dir = temp_dir_name();
+
+                const int num_blocks = 200;
+                vector<string> contents;
+                vector<BlockId> ids;
+                vector<unique_ptr<CountAction> > actions;
+                atomic<int> completed(0);
+                StagePipeline stages(StageThreads(2, 3, 2, 4));
+                for(int i = 0; i < num_blocks; i++) {
+                        // Some compress, some don't.
+                        contents.push_back(i % 2 ? pseudo_random_string(i * 100)
+                                           : string(i * 100, 'a' + i % 26));
+                        DataBlock *bp = block_empty<DataBlock>(params.transport(), params.m_passphrase);
+                        ids.push_back(bp->id());
+                        actions.emplace_back(new CountAction(completed));
+                        bp->completion_action(actions.back().get());
+                        string text(contents.back());
+                        stages.push(bp, text);
+                        BOOST_CHECK(text.empty());
+                }
+                stages.wait();
+                BOOST_CHECK_EQUAL(num_blocks, completed.load());
+
+                for(int i = 0; i < num_blocks; i++) {
+                        DataBlock block(Block::CreateById(), params.transport(), params.m_passphrase, ids[i]);
+                        block.read();
+                        BOOST_CHECK(block.plain_text() == contents[i]);
+                }
+
+                const vector<StageStats> stats = stages.stats();
+                BOOST_REQUIRE_EQUAL(5U, stats.size());
+                const char *names[] = { "chunk", "compress", "encrypt", "write", "complete" };
+                const unsigned int threads[] = { 1, 2, 3, 2, 1 };
+                for(unsigned int i = 0; i < stats.size(); i++) {
+                        BOOST_CHECK_EQUAL(names[i], stats[i].m_name);
+                        BOOST_CHECK_EQUAL(threads[i], stats[i].m_threads);
+                        BOOST_CHECK_EQUAL(num_blocks, stats[i].m_items);
+                        BOOST_CHECK(stats[i].utilization() >= 0);
+                        BOOST_CHECK(stats[i].utilization() <= 1.01);
+                }
+                clean_temp_dir(params.m_local_dir);
+        }
+
+
+        class FailingTransport : public Transport {
+        public:
+                virtual void read(Block *in_block) const {};
+                virtual void write(const Block *in_block) const
+                { throw(runtime_error("FailingTransport")); }
+        };
+
+
+        /*
+          An error in a stage comes out of wait(), and the pipeline
+          can be used again.
+        */
+        void test_error()
+        {
+                const string key(pseudo_random_string());
+                shared_ptr<Transport> failing(new FailingTransport);
+                StagePipeline stages;
+                for(int i = 0; i < 20; i++) {
+                        string text(pseudo_random_string(1000));
+                        stages.push(block_empty<DataBlock>(failing, key), text);
+                }
+                BOOST_CHECK_THROW(stages.wait(), runtime_error);
+
+                shared_ptr<Transport> none(new NoTransport);
+                string text(pseudo_random_string(1000));
+                stages.push(block_empty<DataBlock>(none, key), text);
+                stages.wait();
+        }
+}
+
+
+BOOST_AUTO_TEST_CASE(bounded_queue)
+{
+        test_queue();
+}
+
+BOOST_AUTO_TEST_CASE(blocks)
+{
+        test_blocks();
+}
+
+BOOST_AUTO_TEST_CASE(error)
+{
+        test_error();
+}
@@ -18,14 +18,17 @@
 */
 
 
+#include <boost/serialization/map.hpp>
 #include <fstream>
 #include <sstream>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include "bytes.h"
 #include "config.h"
 #include "crypt.h"
+#include "pipeline.h"
 #include "system.h"
 #include "transport.h"
 
@@ -86,6 +89,144 @@ TransportFS *cryptar::make_transport_fs(const std::shared_ptr<Config> config)
 #endif
 
 
+shared_ptr<Transport> cryptar::make_transport(TransportType in_transport_type,
+                                              const string &in_local_dir)
+{
+        if(no_transport == in_transport_type)
+                return make_shared<NoTransport>();
+        if(fs == in_transport_type)
+                return make_shared<TransportFS>(in_local_dir);
+        if(invalid_transport == in_transport_type)
+                throw(runtime_error("Invalid transport"));
+        throw(runtime_error("Unknown transport"));
+}
+
+
+namespace {
+        // Keep about this much sample text to train a dictionary.
+        const size_t dictionary_sample_bytes = 100 * default_dictionary_size;
+}
+
+
+CompressParams Transport::compress_params() const
+{
+        boost::mutex::scoped_lock lock(m_mutex);
+        CompressParams params(m_compress_params);
+        if(m_dictionary)
+                params.m_dictionary = load_dictionary(m_dictionary);
+        return params;
+}
+
+
+void Transport::compress_params(const CompressParams &in_params)
+{
+        in_params.validate();
+        boost::mutex::scoped_lock lock(m_mutex);
+        m_compress_params = in_params;
+}
+
+
+/*
+  Keep the first texts we see, and once we have enough, replace them
+  at random (reservoir sampling), so the sample is of all the texts
+  so far and not just the first.
+*/
+void Transport::sample(const char *in_buf, size_t in_len)
+{
+        if(0 == in_len || in_len > dictionary_text_limit)
+                return;
+        boost::mutex::scoped_lock lock(m_mutex);
+        if(m_dictionary)
+                return;
+        m_samples_seen++;
+        if(m_sample_bytes < dictionary_sample_bytes) {
+                m_samples.push_back(string(in_buf, in_len));
+                m_sample_bytes += in_len;
+                return;
+        }
+        const unsigned long i = m_random() % m_samples_seen;
+        if(i >= m_samples.size())
+                return;
+        m_sample_bytes += in_len - m_samples[i].size();
+        m_samples[i].assign(in_buf, in_len);
+}
+
+
+unsigned long Transport::train_dictionary()
+{
+        vector<string> samples;
+        {
+                boost::mutex::scoped_lock lock(m_mutex);
+                samples = m_samples;
+        }
+        return train_dictionary(samples);
+}
+
+
+/*
+  The dictionary's block has no transport of its own, so that it is
+  compressed as blocks always have been, and not against a
+  dictionary.  We hold m_mutex throughout, so that two trainings don't
+  take the same id.
+*/
+unsigned long Transport::train_dictionary(const vector<string> &in_samples)
+{
+        const string content(cryptar::train_dictionary(in_samples));
+        boost::mutex::scoped_lock lock(m_mutex);
+        const unsigned long id = m_dictionaries.empty() ? 1 : m_dictionaries.rbegin()->first + 1;
+        DataBlock block(Block::CreateByContent(), shared_ptr<Transport>(), dictionary_key(id), content);
+        write(&block);
+        m_dictionaries[id] = block.id();
+        m_loaded[id] = shared_ptr<const CompressDictionary>(new CompressDictionary(id, content));
+        m_dictionary = id;
+        m_samples.clear();
+        m_sample_bytes = 0;
+        m_samples_seen = 0;
+        return id;
+}
+
+
+unsigned long Transport::current_dictionary() const
+{
+        boost::mutex::scoped_lock lock(m_mutex);
+        return m_dictionary;
+}
+
+
+shared_ptr<const CompressDictionary> Transport::dictionary(unsigned long in_id) const
+{
+        boost::mutex::scoped_lock lock(m_mutex);
+        return load_dictionary(in_id);
+}
+
+
+/*
+  Fetch a dictionary from the store, once.  The caller holds m_mutex.
+*/
+shared_ptr<const CompressDictionary> Transport::load_dictionary(unsigned long in_id) const
+{
+        auto loaded = m_loaded.find(in_id);
+        if(m_loaded.end() != loaded)
+                return loaded->second;
+        auto it = m_dictionaries.find(in_id);
+        if(m_dictionaries.end() == it)
+                return shared_ptr<const CompressDictionary>();
+        DataBlock block(Block::CreateById(), shared_ptr<Transport>(), dictionary_key(in_id), it->second);
+        read(&block);
+        shared_ptr<const CompressDictionary> dictionary(new CompressDictionary(in_id, block.plain_text()));
+        m_loaded[in_id] = dictionary;
+        return dictionary;
+}
+
+
+string Transport::dictionary_key(unsigned long in_id) const
+{
+        ostringstream key;
+        key << m_store_key << " dictionary " << in_id;
+        return message_digest(key.str());
+}
+
+
 /*
 */
 TransportFS::TransportFS(const string &in_base_path)
@@ -104,11 +245,12 @@ TransportFS::TransportFS(const string &in_base_path)
 
 /*
   Return the name of the file in which this block's content should be
-  stored.
+  stored.  The id is random bytes (or, for an old id, a SHA-256 of
+  them), so its encoding will do as is.
 */
 const string TransportFS::block_to_filename(const Block *in_block) const
 {
-        return m_base_path + message_digest(in_block->id().as_string(), true);
+        return m_base_path + in_block->id_name();
 }
 
 
@@ -131,13 +273,7 @@ void TransportFS::read(Block *in_block) const
                 cerr << "Block read error: " << errstr << endl;
                 throw("Block::read()");
         }
-        fs.seekg(0, ios::end);
-        int length = fs.tellg();
-        fs.seekg(0, ios::beg);
-        char *buffer = new char[length];
-        fs.read(buffer, length);
-        string payload(buffer, length);
-        in_block->from_stream(payload);
+        in_block->from_stream(read_bytes(fs));
         fs.close();
 }
 
@@ -145,11 +281,12 @@ void TransportFS::read(Block *in_block) const
 void TransportFS::write(const Block *in_block) const
 {
         const string filename(block_to_filename(in_block));
-        const string payload(in_block->to_stream());
         ofstream fs(filename, ios_base::binary | ios_base::trunc);
-        fs.write(payload.data(), payload.size());
         if(!fs)
                 throw_system_error("TransportFS::write()");
+        OstreamSink sink(fs);
+        in_block->write_stream(sink);
+        sink.close();
         fs.close();
 }
 
@@ -177,14 +314,3 @@ shared_ptr<Communicator> Config::sender()
         return m_sender;
 }
 #endif
-
-
-/*
-  Serialize or deserialize according to context.
-*/
-template<class Archive>
-void Transport::serialize(Archive &in_ar, const unsigned int in_version)
-{
-        //in_ar & m_dbs;
-}
-
@@ -23,9 +23,16 @@
 #define __TRANSPORT_H__ 1
 
 
+#include <boost/serialization/map.hpp>
+#include <boost/thread/mutex.hpp>
+#include <map>
 #include <memory>
+#include <random>
+#include <string>
+#include <vector>
 
 #include "block.h"
+#include "compress.h"
 #include "config.h"
 
 
@@ -34,6 +41,10 @@ namespace cryptar {
         class Transport;
         Transport *make_transport(TransportType in_transport_type,
                                   const std::shared_ptr<Config> in_config);
+        // A transport of the type, reaching the store at in_local_dir
+        // (cf. ConfigParam).
+        std::shared_ptr<Transport> make_transport(TransportType in_transport_type,
+                                                  const std::string &in_local_dir);
 
         /*
           A Transport tells us how to access a store.
@@ -56,9 +67,11 @@ namespace cryptar {
           base class so that a programming error that slices to the
           base class will still be caught.
         */
-        class Transport {
+        class Transport : public DictionarySource {
         protected:
-                Transport() {};
+                Transport()
+                        : m_store_key(pseudo_random_string()), m_dictionary(0),
+                          m_sample_bytes(0), m_samples_seen(0) {};
                 // FIXME    (Config constructor unneeded?)
                 /*
                 Transport(const std::shared_ptr<Config> in_config) {};
@@ -70,6 +83,8 @@ namespace cryptar {
                 virtual ~Transport() {};
 
                 virtual TransportType transport_type() { return base_transport; }
+                // Where the store is, as make_transport() takes it.
+                virtual std::string local_dir() const { return std::string(); }
 
                 /*
                   An action to take before transporting anything.
@@ -95,11 +110,76 @@ namespace cryptar {
                   store, this is where we tear it down.
                 */
                 virtual void post() const {};
-                
+
+                /*
+                  How CoverBlock's cut content into blocks in this
+                  store.  Cf. chunk.h.
+                */
+                const CoverParams &cover_params() const { return m_cover_params; }
+                void cover_params(const CoverParams &in_params)
+                {
+                        in_params.validate();
+                        m_cover_params = in_params;
+                }
+
+                // How blocks in this store are compressed, with its
+                // current dictionary, if any.
+                CompressParams compress_params() const;
+                void compress_params(const CompressParams &in_params);
+
+                /*
+                  Until the store has a dictionary, sample() keeps a
+                  sample of the small texts written to it.
+                  train_dictionary() trains a dictionary from them
+                  (or from in_samples), writes it to the store, and
+                  makes it the one small blocks are compressed
+                  against from then on.  It returns the dictionary's
+                  id.  Blocks compressed against older dictionaries
+                  still find them by id.
+
+                  Each dictionary is a DataBlock of the store's, whose
+                  key we derive from the store's key and the
+                  dictionary's id, so the config need only persist
+                  the one key and where each dictionary is.
+                */
+                void sample(const char *in_buf, size_t in_len);
+                unsigned long train_dictionary();
+                unsigned long train_dictionary(const std::vector<std::string> &in_samples);
+                unsigned long current_dictionary() const;
+                virtual std::shared_ptr<const CompressDictionary> dictionary(unsigned long in_id) const;
+
         private:
+                std::shared_ptr<const CompressDictionary> load_dictionary(unsigned long in_id) const;
+                std::string dictionary_key(unsigned long in_id) const;
+
+                CoverParams m_cover_params;
+                CompressParams m_compress_params;
+                std::string m_store_key;        /* random, per store */
+                std::map<unsigned long, BlockId> m_dictionaries;
+                unsigned long m_dictionary;     /* the current one, or 0 */
+
+                mutable boost::mutex m_mutex;   /* for what follows, the compress params and the dictionaries */
+                mutable std::map<unsigned long, std::shared_ptr<const CompressDictionary> > m_loaded;
+                std::vector<std::string> m_samples;
+                size_t m_sample_bytes;
+                unsigned long m_samples_seen;
+                std::minstd_rand m_random;
+
+                /*
+                  What the store's config persists (cf. Config): how
+                  the store covers and compresses, its key, and where
+                  its dictionaries are.
+                */
                 friend class boost::serialization::access;
                 template<class Archive>
-                        void serialize(Archive &ar, const unsigned int version);
+                        void serialize(Archive &in_ar, const unsigned int in_version) {
+                        boost::mutex::scoped_lock lock(m_mutex);
+                        in_ar & m_cover_params;
+                        in_ar & m_compress_params;
+                        in_ar & m_store_key;
+                        in_ar & m_dictionaries;
+                        in_ar & m_dictionary;
+                }
         };
 
         //Transport *make_transport(const std::shared_ptr<Config> config);
@@ -163,6 +243,7 @@ namespace cryptar {
                 virtual ~TransportFS() {};
 
                 virtual TransportType transport_type() { return fs; }
+                virtual std::string local_dir() const { return m_base_path; }
 
                 virtual void read(Block *in_block) const;
                 virtual void write(const Block *in_block) const;